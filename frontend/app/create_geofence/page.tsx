@@ -8,6 +8,7 @@ import { ArrowLeft } from "lucide-react";
 import React from "react";
 import { db, collection,addDoc, auth } from "@/lib/firebase";
 import { onAuthStateChanged } from "firebase/auth";
+import { FieldValue, serverTimestamp } from "firebase/firestore";
 
 export default function CreateGeofence() {
   // const [hydrated, setHydrated] = useState(false);
@@ -107,14 +108,17 @@ export default function CreateGeofence() {
       c3: string;
       c4: string;
       speed_limit?: number;
+      updated_at: FieldValue;
     }
     
+    // updated_at lets the devices fetch only the zones changed since their last sync
     const geofenceData: GeofenceData = {
       name: name.trim(),
       c1: formattedCoordinates[0] || "",
       c2: formattedCoordinates[1] || "",
       c3: formattedCoordinates[2] || "",
       c4: formattedCoordinates[3] || "",
+      updated_at: serverTimestamp(),
     };
     
   
@@ -7,7 +7,7 @@ import { onAuthStateChanged } from "firebase/auth";
 import { motion } from "framer-motion";
 import { ToastContainer, toast } from "react-toastify";
 import "react-toastify/dist/ReactToastify.css";
-import { deleteDoc, doc } from "firebase/firestore";
+import { deleteDoc, doc, serverTimestamp, updateDoc } from "firebase/firestore";
 
 interface Geofence {
     id: string;
@@ -62,7 +62,7 @@ export default function GeofenceDashboard() {
                 }));
 
                 // Map no-parking data (yellow rectangle)
-                const noParkingData: Geofence[] = noParkingSnapshot.docs.map((doc) => ({
+                const noParkingData: Geofence[] = noParkingSnapshot.docs.filter((doc) => !doc.data().deleted).map((doc) => ({
                     id: doc.id,
                     name: doc.data().name || "-",
                     c1: doc.data().c1 || "-",
@@ -86,7 +86,13 @@ export default function GeofenceDashboard() {
         if (!isConfirmed) return;
     
         try {
-            await deleteDoc(doc(db, type, id));
+            // No-parking zones are only marked deleted, so the devices' query
+            // for changed zones sees the deletion too
+            if (type === "no_parking") {
+                await updateDoc(doc(db, type, id), { deleted: true, updated_at: serverTimestamp() });
+            } else {
+                await deleteDoc(doc(db, type, id));
+            }
             setGeofences(geofences.filter((geo) => geo.id !== id));
             toast.success("Geofence deleted successfully!", { autoClose: 1500 }); // Closes after 1.5 seconds
                     } catch (error) {
@@ -42,7 +42,7 @@ const Map = () => {
             .map((c) => doc.data()[c]?.split(",").map(Number)) as [number, number][],
         });
 
-        setNoParkingZones(noParkingSnap.docs.map((doc) => parseCoordinates(doc, "No Parking")));
+        setNoParkingZones(noParkingSnap.docs.filter((doc) => !doc.data().deleted).map((doc) => parseCoordinates(doc, "No Parking")));
         setOverSpeedingZones(overSpeedingSnap.docs.map((doc) => parseCoordinates(doc, "Over Speeding")));
       } catch (error) {
         console.error("Error fetching geofences:", error);
@@ -0,0 +1,79 @@
+#ifndef CONNECTIVITY_H
+#define CONNECTIVITY_H
+
+#include <Arduino.h>
+#include <WiFi.h>
+
+// Wait before the first reconnect attempt, doubled after every failed one up
+// to the maximum; each wait is spread by +-CONNECTIVITY_JITTER_PERCENT
+#define CONNECTIVITY_BACKOFF_MIN_MS 1000
+#define CONNECTIVITY_BACKOFF_MAX_MS 64000
+#define CONNECTIVITY_JITTER_PERCENT 25
+
+// An attempt that has not got an IP address by then is given up
+#define CONNECTIVITY_ATTEMPT_MS 15000
+
+// Keeps the WiFi link up without ever blocking loop().
+//
+// The WiFi driver reports connects and drops from its own task through
+// WiFi.onEvent(); poll(), called from loop(), picks them up and moves a
+// small state machine along: online, waiting out the backoff, or an attempt
+// in progress. WiFi.begin() returns at once, so the GPS, the zone checks and
+// the journal carry on while the link is down; only the network work waits
+// for online(). The driver's own reconnect is turned off so the backoff is
+// the only thing retrying.
+class Connectivity
+{
+public:
+    typedef void (*Callback)();
+
+    Connectivity(const char *ssid, const char *password);
+
+    // Register for the WiFi events and start the first attempt
+    void begin();
+
+    // Run the state machine; returns straight away. Calls the online
+    // callback from here, in loop() context, each time the link comes up.
+    void poll();
+
+    // Called once per reconnect, so the upload path can drain what queued
+    // up while offline
+    void onOnline(Callback callback) { onlineCallback = callback; }
+
+    // Called once each time an established link is lost
+    void onOffline(Callback callback) { offlineCallback = callback; }
+
+    bool online() const { return state == ONLINE; }
+
+    uint32_t attempts() const { return attemptCount; }
+    uint32_t reconnects() const { return reconnectCount; }
+    unsigned long offlineMs() const; // how long the link has been down, 0 if up
+
+private:
+    enum State
+    {
+        WAITING,    // backing off until nextAttemptMs
+        CONNECTING, // WiFi.begin() issued at attemptMs
+        ONLINE
+    };
+
+    const char *ssid;
+    const char *password;
+    State state;
+    unsigned long backoffMs;
+    unsigned long nextAttemptMs;
+    unsigned long attemptMs;
+    unsigned long downSinceMs;
+    uint32_t attemptCount, reconnectCount;
+    Callback onlineCallback;
+    Callback offlineCallback;
+
+    // Set by the WiFi event task, cleared by poll()
+    volatile bool gotIp;
+    volatile bool lostLink;
+
+    void startAttempt();
+    void backOff();
+};
+
+#endif // CONNECTIVITY_H
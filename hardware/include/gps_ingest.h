@@ -0,0 +1,83 @@
+#ifndef GPS_INGEST_H
+#define GPS_INGEST_H
+
+#include <Arduino.h>
+#include <TinyGPS++.h>
+#include "spsc_queue.h"
+
+// UART driver receive buffer: about 4 s of NMEA at 9600 baud, enough to ride
+// out a stalled ingest task
+#define GPS_INGEST_RX_BUFFER 4096
+
+// Decoded fixes waiting for the network side (one per second from the receiver)
+#define GPS_INGEST_QUEUE 32
+
+#define GPS_INGEST_STACK 4096
+#define GPS_INGEST_PRIORITY 3
+#define GPS_INGEST_CORE 0     // loop() and the Firebase calls run on core 1
+#define GPS_INGEST_POLL_MS 10 // Sleep while the UART has nothing new
+#define GPS_INGEST_BLOCK 64   // Bytes handed to TinyGPSPlus::encode() at a time
+
+// One receiver epoch, copied out of TinyGPS++ so the network side never
+// touches the parser
+struct GpsFix
+{
+    int32_t latE7, lonE7; // 1e-7 degree
+    uint32_t seconds;     // GPS clock as seconds since 2000-01-01 UTC, 0 if invalid
+    uint16_t year;
+    uint8_t month, day, hour, minute, second;
+    uint8_t centisecond; // 0 at 1 Hz; sets apart the fixes of one second at 5-10 Hz
+    bool dateTimeValid;
+    bool speedValid, courseValid, hdopValid;
+    float speedMps;
+    float courseDeg;
+    uint16_t hdop;      // hundredths
+    float accuracyM;    // receiver's horizontal error estimate (1 sigma), 0 if unknown
+    uint8_t satellites; // 0 if unknown
+    uint32_t receivedMs; // millis() when the fix was decoded
+};
+
+// Reads the GPS UART and runs the NMEA parser in its own FreeRTOS task on the
+// core the network code does not use, so a Firebase call blocking loop() for
+// seconds no longer overflows the UART or loses fixes. Each new fix is pushed
+// into a lock-free single-producer/single-consumer queue that loop() drains.
+class GpsIngest
+{
+public:
+    explicit GpsIngest(HardwareSerial &serial);
+
+    // Open the UART with a GPS_INGEST_RX_BUFFER receive buffer and start the task
+    bool begin(unsigned long baud, int rxPin, int txPin);
+
+    // Switch a u-blox 7 or M8 receiver from NMEA to UBX NAV-PVT, one solution
+    // every rateMs. At 100 bytes per fix instead of about 150 for GGA + RMC
+    // alone, up to 9 Hz fits in 9600 baud; 10 Hz needs a faster link. Not
+    // saved in the receiver, so call it after every begin().
+    void configureUbx(uint16_t rateMs);
+
+    // Network side: take the oldest waiting fix. Returns false if there is none.
+    bool pop(GpsFix &fix) { return fixes.pop(fix); }
+
+    // Fixes lost because the network side fell GPS_INGEST_QUEUE fixes behind
+    uint32_t dropped() const { return droppedCount; }
+
+    // Parser statistics, updated by the task
+    uint32_t charsProcessed() const { return charsCount; }
+    uint32_t failedChecksum() const { return failedCount; }
+
+private:
+    HardwareSerial &serial;
+    TinyGPSPlus gps; // only used by the task
+    SpscQueue<GpsFix, GPS_INGEST_QUEUE> fixes;
+    TaskHandle_t task;
+    uint32_t lastTime; // receiver time of the last fix pushed
+    volatile uint32_t droppedCount;
+    volatile uint32_t charsCount;
+    volatile uint32_t failedCount;
+
+    static void taskEntry(void *arg);
+    void run();
+    void publish();
+};
+
+#endif // GPS_INGEST_H
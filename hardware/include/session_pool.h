@@ -0,0 +1,83 @@
+#ifndef SESSION_POOL_H
+#define SESSION_POOL_H
+
+#include <Arduino.h>
+#include <Firebase_ESP_Client.h>
+#include "tls_session_cache.h"
+
+// Distinct hosts the firmware talks to (RTDB, Firestore, Storage)
+#define SESSION_POOL_HOSTS 4
+
+// A connection unused for this long is closed
+#define SESSION_POOL_IDLE_MS 45000
+
+// The Firebase client reopens any connection this old on its next request
+// (DEFAULT_TCP_CONNECTION_TIMEOUT), so a handshake is counted then too
+#define SESSION_POOL_LIFETIME_MS (3 * 60 * 1000UL)
+
+// Heap held by one open TLS connection: the BearSSL engine and its 2 KB + 512
+// byte record buffers, plus the socket. Open connections are kept within the
+// budget, and none is opened while the free heap is below the floor, by
+// closing the least recently used ones first.
+#define SESSION_POOL_SESSION_BYTES 8192
+#define SESSION_POOL_BUDGET_BYTES 24576
+#define SESSION_POOL_MIN_FREE_HEAP 40000
+
+// One FirebaseData per host, each keeping its connection warm.
+//
+// The Firebase client drops the connection whenever a FirebaseData moves to a
+// different host, so a single object shared by RTDB and Firestore calls pays
+// a TCP connect and a full TLS handshake at almost every switch, several
+// times per fix. Here each host has its own object and its own keep-alive
+// connection. The objects live as long as the pool, so a reference from
+// get() stays valid; only their connections are closed, when idle or to stay
+// within the memory budget.
+//
+// With a TlsSessionCache, each host's TLS session is copied into the cache
+// after its handshakes and back out before a new connection, so reconnects,
+// including the first after a reboot, resume instead of running a full
+// handshake.
+class SessionPool
+{
+public:
+    SessionPool();
+
+    // The session for host (a bare host name), created on first use. Call it
+    // right before each request: it counts whether that request can reuse
+    // an open connection.
+    FirebaseData &get(const char *host);
+
+    // Close connections idle for SESSION_POOL_IDLE_MS. Call from loop().
+    void poll();
+
+    // Close every connection, e.g. once the network is gone
+    void closeAll();
+
+    // Resume connections from, and save new sessions to, cache
+    void useTlsCache(TlsSessionCache &cache) { tlsCache = &cache; }
+
+    uint32_t handshakes() const { return handshakeCount; }  // requests that had to connect
+    uint32_t handshakesAvoided() const { return reuseCount; } // requests on an open connection
+    uint32_t evictions() const { return evictionCount; }
+    size_t openSessions() const;
+
+private:
+    struct Entry
+    {
+        const char *host;
+        FirebaseData *fbdo;
+        unsigned long lastUseMs;
+        unsigned long openedMs; // when the current connection was made
+    };
+
+    Entry entries[SESSION_POOL_HOSTS];
+    size_t count;
+    uint32_t handshakeCount, reuseCount, evictionCount;
+    TlsSessionCache *tlsCache;
+
+    bool isOpen(const Entry &entry) const;
+    void close(Entry &entry);
+    void makeRoom(const Entry &keep);
+};
+
+#endif // SESSION_POOL_H
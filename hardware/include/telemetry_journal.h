@@ -0,0 +1,111 @@
+#ifndef TELEMETRY_JOURNAL_H
+#define TELEMETRY_JOURNAL_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "mbfs/MB_FS.h"
+
+// Ring of segment files: 16 x 16 KB holds about 2.5 hours of driving at 1 Hz
+#define JOURNAL_SEGMENTS 16
+#define JOURNAL_SEGMENT_BYTES 16384
+
+// Largest record payload
+#define JOURNAL_MAX_PAYLOAD 64
+
+// Records appended are held in RAM and written to flash together, once this
+// many are waiting or on commit(), so flash sees one append per batch
+#define JOURNAL_STAGE 16
+
+#define JOURNAL_MAGIC 0x4A52 // "RJ" little-endian
+
+// One journal entry. seq numbers every record ever appended, from 1, with no
+// gaps; type and payload are the caller's.
+struct JournalRecord
+{
+    uint32_t seq;
+    uint8_t type;
+    uint8_t length;
+    uint8_t data[JOURNAL_MAX_PAYLOAD];
+};
+
+// Append-only, crash-safe record journal in flash.
+//
+// MB_FS can only read, truncate-and-write or append a file, so the ring is
+// made of JOURNAL_SEGMENTS files: records are appended to one segment until it
+// is full, then the next one is truncated and taken over, dropping its oldest
+// records if they were never delivered. Each record carries its sequence
+// number and a CRC, so begin() can rebuild the state from the files alone; a
+// record cut short by a power loss fails its CRC and ends its segment, and
+// writing carries on in a fresh segment.
+//
+// Delivery is read() then ack(): read() returns the oldest records not yet
+// acknowledged, in order, and ack(seq) marks everything up to seq delivered.
+// The acknowledged seq is saved in two alternating files with a CRC, so a
+// torn write leaves the previous one. After a crash between a delivery and
+// its ack the same records come back from read(), so the receiver must store
+// them by seq (a repeat overwrites) to see each exactly once.
+class TelemetryJournal
+{
+public:
+    // Files are named path.0 ... path.15, path.ack0 and path.ack1
+    TelemetryJournal(MB_FS &fs, const char *path);
+
+    // Recover from the files. Call once before anything else.
+    bool begin();
+
+    // Stage a record. Returns its seq, or 0 if it does not fit a record.
+    uint32_t append(uint8_t type, const void *data, size_t length);
+
+    // Write every staged record to flash. Returns false if the write failed;
+    // those records stay staged.
+    bool commit();
+
+    // Up to max of the oldest unacknowledged records, committed ones only
+    size_t read(JournalRecord *out, size_t max);
+
+    // Everything up to and including seq has been delivered
+    bool ack(uint32_t seq);
+
+    // Records not yet acknowledged, staged ones included
+    uint32_t pending() const;
+    uint32_t staged() const { return stageCount; }
+    uint32_t lastSeq() const { return nextSeq - 1; }
+    uint32_t ackedSeq() const { return acked; }
+
+    // Records overwritten before delivery, since begin()
+    uint32_t lost() const { return lostCount; }
+
+private:
+    struct Segment
+    {
+        uint32_t firstSeq, lastSeq; // 0 if empty
+        uint32_t bytes;
+        bool sealed; // full or torn: no more appends
+    };
+
+    MB_FS &fs;
+    const char *path;
+    Segment segments[JOURNAL_SEGMENTS];
+    uint8_t head; // segment being appended to
+    uint32_t nextSeq;
+    uint32_t acked;
+    uint32_t ackCounter; // generation of the ack file last written
+    uint32_t lostCount;
+
+    JournalRecord stage[JOURNAL_STAGE];
+    uint8_t stageCount;
+
+    // Where read() left off, so a drain does not rescan the segment
+    bool cursorValid;
+    uint8_t cursorSegment;
+    uint32_t cursorOffset, cursorSeq; // next record starts at cursorOffset with seq cursorSeq
+
+    void fileName(char *out, size_t size, const char *suffix, unsigned index) const;
+    void scanSegment(uint8_t index);
+    bool loadAck();
+    bool saveAck(uint32_t seq);
+    bool startSegment(uint8_t index);
+    uint32_t oldestSeq() const;
+};
+
+#endif // TELEMETRY_JOURNAL_H
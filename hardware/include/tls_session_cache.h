@@ -0,0 +1,68 @@
+#ifndef TLS_SESSION_CACHE_H
+#define TLS_SESSION_CACHE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "mbfs/MB_FS.h"
+#include "client/SSLClient/bssl/bearssl_ssl.h"
+
+// Hosts remembered; the least recently stored is replaced beyond that
+#define TLS_SESSION_CACHE_ENTRIES 4
+#define TLS_SESSION_CACHE_HOST_LEN 64
+
+#define TLS_SESSION_CACHE_MAGIC 0x53544C54 // "TLTS"
+
+// TLS sessions for resumption, one per host.
+//
+// A resumed handshake skips the ECDHE key exchange and the certificate chain
+// check, which are most of a connect's CPU time on the ESP32. BearSSL keeps
+// the session of each connection in a BearSSL_Session; this cache keeps one
+// per host across connections, so any client can start from it, and with
+// persistTo() across reboots too. A session the server no longer accepts
+// only costs a full handshake, after which the new one replaces it.
+//
+// The file holds the master secrets: anyone who can read the flash can
+// decrypt traffic captured in those sessions. Use flash encryption, or leave
+// persistence off, where that matters.
+class TlsSessionCache
+{
+public:
+    TlsSessionCache();
+
+    // Keep the cache in this file; load() reads it back
+    void persistTo(MB_FS &fs, const char *path);
+    bool load();
+
+    // The session last stored for host, if any, copied into session
+    bool restore(const char *host, br_ssl_session_parameters &session);
+
+    // Remember host's current session. Returns true if it was new; the file,
+    // if any, is rewritten then.
+    bool store(const char *host, const br_ssl_session_parameters &session);
+
+    // Forget host's session, e.g. after the server refused it
+    void forget(const char *host);
+
+    uint32_t hits() const { return hitCount; }
+    uint32_t misses() const { return missCount; }
+    uint32_t stores() const { return storeCount; }
+
+private:
+    struct Entry
+    {
+        char host[TLS_SESSION_CACHE_HOST_LEN];
+        uint32_t stamp; // order of storing, for replacement; 0 if unused
+        br_ssl_session_parameters session;
+    };
+
+    Entry entries[TLS_SESSION_CACHE_ENTRIES];
+    uint32_t nextStamp;
+    MB_FS *fs;
+    const char *path;
+    uint32_t hitCount, missCount, storeCount;
+
+    Entry *find(const char *host);
+    bool save();
+};
+
+#endif // TLS_SESSION_CACHE_H
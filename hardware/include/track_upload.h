@@ -0,0 +1,107 @@
+#ifndef TRACK_UPLOAD_H
+#define TRACK_UPLOAD_H
+
+#include <Arduino.h>
+#include <Firebase_ESP_Client.h>
+#include "telemetry_journal.h"
+
+// A flush is due once this many records are waiting, or the oldest of them
+// is this old
+#define TRACK_UPLOAD_BATCH 30
+#define TRACK_UPLOAD_MAX_AGE_MS 30000
+
+// A backlog left by an outage goes up this many records per request, one
+// request this often, so it drains without starving the rest of loop()
+#define TRACK_UPLOAD_DRAIN_BATCH 100
+#define TRACK_UPLOAD_DRAIN_MS 1000
+
+// Fixes are written to flash at least this often; zone events straight away
+#define TRACK_UPLOAD_COMMIT_MS 10000
+
+// A parked vehicle adds a point only after moving this far, or once this
+// long has passed
+#define TRACK_UPLOAD_MIN_SPACING_M 3.0f
+#define TRACK_UPLOAD_PARKED_MS 60000
+
+// Wait after a failed flush before the next attempt
+#define TRACK_UPLOAD_RETRY_MS 5000
+
+// Journal record types
+#define TRACK_RECORD_FIX 1
+#define TRACK_RECORD_ENTER 2
+#define TRACK_RECORD_EXIT 3
+#define TRACK_RECORD_VIOLATION 4
+
+// Records the vehicle's track and zone events in the telemetry journal and
+// uploads them in batches.
+//
+// Everything goes through flash first, so a dead link or a reset loses
+// nothing the journal has room for; after an outage the backlog goes up
+// oldest first, TRACK_UPLOAD_DRAIN_BATCH records per request.
+//
+// Every flush is one RTDB multi-location update at the root: each fix goes to
+// <track root>/<vehicle>/<time key>, each zone event to
+// <event root>/<vehicle>/<seconds>_<seq>, and the latest position, if one is
+// set, to /gps_data in the same request. A batch of 30 points therefore costs
+// one request, one auth token and one set of TLS records instead of 30. The
+// time key is the GPS clock (seconds since 2000) followed by two digits of
+// centiseconds, so keys sort in time order. Both keys are fixed by the record,
+// so a batch sent again after a reset overwrites instead of duplicating, and
+// the database ends up with each record exactly once.
+class TrackUpload
+{
+public:
+    TrackUpload(TelemetryJournal &journal, const char *trackRoot, const char *eventRoot);
+
+    // Record a fix. seconds == 0 (GPS clock not valid yet) is skipped.
+    void add(uint32_t seconds, uint8_t centisecond, int32_t latE7, int32_t lonE7, float speedMps, float courseDeg);
+
+    // Record a zone event (TRACK_RECORD_ENTER, _EXIT or _VIOLATION) at the
+    // position it was decided on, and write it to flash now
+    void addEvent(uint8_t type, uint32_t seconds, int32_t latE7, int32_t lonE7, const char *zone);
+
+    // Position for /gps_data, sent with the next flush
+    void setLatest(double lat, double lon, const String &dateTime);
+
+    // Enough records waiting, the oldest old enough, a zone event or a
+    // backlog to drain, and not backing off
+    bool due() const;
+
+    // Upload the oldest waiting records, up to TRACK_UPLOAD_DRAIN_BATCH, and
+    // the latest position in one request. On failure everything stays in the
+    // journal for the next attempt.
+    bool flush(FirebaseData &fbdo, const String &vehicle);
+
+    // The link is back: skip what is left of the retry wait
+    void resume() { failed = false; }
+
+    uint32_t pending() const { return journal.pending(); }
+    size_t lastBatch() const { return batchCount; } // records in the last successful flush
+    uint32_t flushes() const { return flushCount; }
+    uint32_t recordsSent() const { return sentCount; }
+    uint32_t recordsLost() const { return journal.lost(); }
+
+private:
+    TelemetryJournal &journal;
+    const char *trackRoot;
+    const char *eventRoot;
+    bool havePoint;
+    uint32_t lastSeconds;
+    uint8_t lastCentisecond;
+    int32_t lastLat, lastLon;
+    unsigned long oldestMs; // millis() when the oldest waiting record was added
+    unsigned long lastAddMs;
+    unsigned long lastCommitMs;
+    unsigned long lastFlushMs;
+    unsigned long lastFailMs;
+    bool failed;
+    bool eventWaiting;
+    bool backlog; // the last flush was a full batch
+    bool latestPending;
+    double latestLat, latestLon;
+    String latestDateTime;
+    size_t batchCount;
+    uint32_t flushCount, sentCount;
+};
+
+#endif // TRACK_UPLOAD_H
@@ -0,0 +1,122 @@
+#ifndef ZONE_SYNC_H
+#define ZONE_SYNC_H
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+#include <Firebase_ESP_Client.h>
+#include "geofence.h"
+#include "geofence_cache.h"
+
+#define MAX_GEOFENCE_VERTICES 64
+
+// Documents per request when loading every zone. Each page is parsed on its
+// own, so this bounds the response held in RAM (a 64-vertex zone is about
+// 4 KB of text) and the document it is parsed into (2.4 KB per such zone).
+#define ZONE_SYNC_LOAD_PAGE_SIZE 10
+
+// Documents listed per request when reconciling (name and updateTime only, a
+// few hundred bytes each)
+#define ZONE_SYNC_PAGE_SIZE 50
+
+// More changed documents than this in one poll are fetched with a full reload
+#define ZONE_SYNC_MAX_DELTA 16
+
+// Zone documents carry a server timestamp of their last change in this field,
+// and are deleted by setting the tombstone field to true with a new stamp
+// (see frontend/app/geo_fences), so a query on the stamp also sees deletions
+#define ZONE_SYNC_STAMP_FIELD "updated_at"
+#define ZONE_SYNC_TOMBSTONE_FIELD "deleted"
+
+// The full id and updateTime listing still runs this often, and once after
+// each boot, to catch changes made without a stamp (e.g. by hand in the
+// console)
+#define ZONE_SYNC_RECONCILE_MS (24 * 60 * 60 * 1000UL)
+
+// Next to the cache file: a compiled blob being downloaded, and the
+// generation of the blob the cache holds
+#define ZONE_SYNC_NEW_SUFFIX ".new"
+#define ZONE_SYNC_GENERATION_SUFFIX ".gen"
+
+// Keeps a GeofenceSet, and the GeofenceIndex over it, in step with a Firestore
+// collection of zones.
+//
+// After the first full download, sync() runs one query for the documents
+// stamped later than the newest change already applied. An idle poll is one
+// request with an empty result, whatever the number of zones. Each changed
+// document is then fetched and patched into the set; tombstones and replaced
+// zones are removed from it in place, so every other zone keeps its id.
+//
+// Documents written without a stamp are only seen by the reconcile: a listing
+// of every document's id and updateTime (a field mask keeps the zone data out
+// of the response) compared against the table, fetching just the documents
+// that are new or changed.
+//
+// With a cache file set, every change is also written to flash as a
+// GeofenceCache image together with the document table and the newest stamp.
+// loadCache() restores them at boot, before any network is up, and the first
+// sync() revalidates them with a reconcile.
+class ZoneSync
+{
+public:
+    ZoneSync(const char *projectId, const char *collection, GeofenceSet &zones, GeofenceIndex &index);
+
+    // Download every zone a page at a time, replacing the current set. The
+    // set is left untouched if any page fails. Returns true if it was replaced.
+    bool fullLoad(FirebaseData &fbdo);
+
+    // Patch new, changed and deleted zones into the set. Runs fullLoad() the
+    // first time and when too much has changed. Returns true if the set
+    // changed, in which case zone ids may have been renumbered.
+    bool sync(FirebaseData &fbdo);
+
+    // Alternative to sync(): load a blob built offline by tools/zone_compiler
+    // and published to Firebase Storage. The blob is a GeofenceCache image with
+    // the grid included, so it is loaded without parsing and then becomes the
+    // cache file. A download that fails its checks leaves the cache alone.
+    // Only downloads when the object's generation differs from the cached
+    // one; needs useCache(). Returns true if the set changed.
+    bool syncCompiled(FirebaseData &fbdo, const char *bucket, const char *object);
+
+    // Persist the zone set to path on fs after every change
+    void useCache(MB_FS &fs, const char *path);
+
+    // Restore the set saved by a previous run. Returns false, leaving the set
+    // alone, if there is no cache or it fails its version or checksum test.
+    bool loadCache();
+
+private:
+    struct ZoneDoc
+    {
+        std::string id;
+        std::string updateTime;
+        uint32_t zone; // UINT32_MAX if the document holds no usable polygon
+    };
+
+    const char *projectId;
+    const char *collection;
+    GeofenceSet &zones;
+    GeofenceIndex &index;
+    std::vector<ZoneDoc> docs; // sorted by id
+    bool loaded;
+    std::string changedSince; // newest ZONE_SYNC_STAMP_FIELD with every document at it applied, empty if none
+    bool reconciled;          // since boot
+    unsigned long lastReconcileMs;
+    MB_FS *cacheFs;
+    const char *cachePath;
+    unsigned long blobGeneration; // of the compiled blob loaded, 0 if none
+
+    bool queryChanges(FirebaseData &fbdo);
+    bool reconcile(FirebaseData &fbdo);
+    bool listDocuments(FirebaseData &fbdo, std::vector<ZoneDoc> &listed);
+    bool fetchZone(FirebaseData &fbdo, ZoneDoc &zoneDoc);
+    static uint32_t addZone(GeofenceSet &set, JsonObject fields);
+    void compactIfSparse();
+    bool readCache(const char *path, GeofenceSet &set, GeofenceIndex &grid, std::string &meta);
+    bool applyCache(GeofenceSet &cachedZones, GeofenceIndex &cachedIndex, const std::string &meta);
+    bool replaceCache(const char *newPath);
+    unsigned long readGeneration();
+    void saveGeneration(unsigned long generation);
+    void saveCache();
+};
+
+#endif // ZONE_SYNC_H
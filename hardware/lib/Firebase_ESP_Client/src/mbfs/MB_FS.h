@@ -745,6 +745,16 @@ public:
 #endif
         }
 
+#endif
+        return false;
+    }
+
+    // Rename file in flash.
+    bool rename(const MB_String &from, const MB_String &to, mbfs_file_type type)
+    {
+#if defined(MBFS_FLASH_FS)
+        if (type == mbfs_flash && checkStorageReady(type) && flashReady())
+            return MBFS_FLASH_FS.rename(from.c_str(), to.c_str());
 #endif
         return false;
     }
@@ -749,6 +749,15 @@ public:
    */
   bool isKeepAlive();
 
+  /** Get the TLS session parameters used to resume the next connection.
+   *
+   * @return The session parameters, updated after each handshake.
+   *
+   * @note Copy saved parameters in before a request to resume a session from
+   * another FirebaseData object or from before a reboot.
+   */
+  br_ssl_session_parameters *getTLSSession() { return bsslSession.getSession(); }
+
   Firebase_TCP_Client tcpClient;
 
 #if defined(FIREBASE_ESP32_CLIENT) || defined(FIREBASE_ESP8266_CLIENT)
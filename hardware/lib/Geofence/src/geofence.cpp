@@ -0,0 +1,574 @@
+#include "geofence.h"
+
+#include <math.h>
+
+// Upper bound on grid cells per zone; keeps the index at a few words per zone
+// even when the zones are spread over a large area
+#define GEOFENCE_GRID_CELLS_PER_ZONE 4
+
+// Furthest a boundary is searched for, and the slack taken off the resulting
+// skip budget to absorb the error of the local distance approximation
+#define GEOFENCE_TRACKER_MAX_BUDGET_M 2000.0f
+#define GEOFENCE_TRACKER_MARGIN_M 0.5f
+
+int32_t geofenceToE7(double deg)
+{
+    return (int32_t)lround(deg * GEOFENCE_E7);
+}
+
+float geofenceCosLat(int32_t lat)
+{
+    return cosf(lat * (float)(M_PI / 180.0 / GEOFENCE_E7));
+}
+
+float geofenceDistanceMeters(int32_t lat1, int32_t lon1, int32_t lat2, int32_t lon2, float cosLat)
+{
+    float dy = (float)((int64_t)lat2 - lat1) * GEOFENCE_METERS_PER_E7;
+    float dx = (float)((int64_t)lon2 - lon1) * GEOFENCE_METERS_PER_E7 * cosLat;
+    return sqrtf(dx * dx + dy * dy);
+}
+
+uint32_t geofenceReachTimeMs(float distanceMeters, float speedMps)
+{
+    if (distanceMeters <= 0)
+        return 0;
+    if (speedMps < 0)
+        speedMps = 0;
+
+    // Smallest t with speed * t + accel * t^2 / 2 = distance
+    float a = GEOFENCE_MAX_ACCEL_MPS2;
+    float t = (sqrtf(speedMps * speedMps + 2 * a * distanceMeters) - speedMps) / a;
+    return (uint32_t)(t * 1000);
+}
+
+bool GeofenceHits::add(uint32_t zone)
+{
+    if (count == GEOFENCE_MAX_HITS)
+    {
+        overflow = true;
+        return false;
+    }
+
+    // Keep ascending order; callers mostly add in order already
+    uint8_t i = count++;
+    for (; i > 0 && zones[i - 1] > zone; i--)
+        zones[i] = zones[i - 1];
+    zones[i] = zone;
+    return true;
+}
+
+bool GeofenceHits::contains(uint32_t zone) const
+{
+    for (uint8_t i = 0; i < count; i++)
+        if (zones[i] == zone)
+            return true;
+    return false;
+}
+
+bool GeofenceHits::operator==(const GeofenceHits &other) const
+{
+    if (count != other.count)
+        return false;
+    for (uint8_t i = 0; i < count; i++)
+        if (zones[i] != other.zones[i])
+            return false;
+    return true;
+}
+
+void GeofenceSet::clear()
+{
+    removedCount = 0;
+    names.clear();
+    dwellLimits.clear();
+    edgeOffsets.assign(1, 0);
+    boxMinLat.clear();
+    boxMinLon.clear();
+    boxMaxLat.clear();
+    boxMaxLon.clear();
+    qBoxMinLat.clear();
+    qBoxMinLon.clear();
+    qBoxMaxLat.clear();
+    qBoxMaxLon.clear();
+    edgeLat1.clear();
+    edgeLon1.clear();
+    edgeLat2.clear();
+    edgeSlope.clear();
+    edgeIntercept.clear();
+    qLatLo.clear();
+    qLatHi.clear();
+    qLonLo.clear();
+    qDLon.clear();
+}
+
+void GeofenceSet::reserve(size_t zones, size_t vertices)
+{
+    names.reserve(zones);
+    dwellLimits.reserve(zones);
+    edgeOffsets.reserve(zones + 1);
+    boxMinLat.reserve(zones);
+    boxMinLon.reserve(zones);
+    boxMaxLat.reserve(zones);
+    boxMaxLon.reserve(zones);
+    qBoxMinLat.reserve(zones);
+    qBoxMinLon.reserve(zones);
+    qBoxMaxLat.reserve(zones);
+    qBoxMaxLon.reserve(zones);
+    edgeLat1.reserve(vertices);
+    edgeLon1.reserve(vertices);
+    edgeLat2.reserve(vertices);
+    edgeSlope.reserve(vertices);
+    edgeIntercept.reserve(vertices);
+    qLatLo.reserve(vertices);
+    qLatHi.reserve(vertices);
+    qLonLo.reserve(vertices);
+    qDLon.reserve(vertices);
+}
+
+int GeofenceSet::add(const std::string &zoneName, const double *lats, const double *lons, size_t count,
+                     uint32_t dwellSeconds)
+{
+    // A closing vertex repeating the first one is implied
+    if (count > 3 && lats[count - 1] == lats[0] && lons[count - 1] == lons[0])
+        count--;
+    if (count < 3)
+        return -1;
+
+    double minLat = lats[0], maxLat = lats[0], minLon = lons[0], maxLon = lons[0];
+    for (size_t i = 1; i < count; i++)
+    {
+        minLat = lats[i] < minLat ? lats[i] : minLat;
+        maxLat = lats[i] > maxLat ? lats[i] : maxLat;
+        minLon = lons[i] < minLon ? lons[i] : minLon;
+        maxLon = lons[i] > maxLon ? lons[i] : maxLon;
+    }
+    int32_t qMinLat = geofenceToE7(minLat), qMinLon = geofenceToE7(minLon);
+
+    for (size_t i = 0; i < count; i++)
+    {
+        size_t j = (i + 1 == count) ? 0 : i + 1;
+        double lat1 = lats[i], lon1 = lons[i];
+        double lat2 = lats[j], lon2 = lons[j];
+
+        // Horizontal edges never straddle a fix, so their slope is never used.
+        // The intercept is taken relative to the zone's minLat to keep the
+        // products small and avoid cancellation on steep edges.
+        double slope = (lat2 != lat1) ? (lon2 - lon1) / (lat2 - lat1) : 0;
+        edgeLat1.push_back(lat1);
+        edgeLon1.push_back(lon1);
+        edgeLat2.push_back(lat2);
+        edgeSlope.push_back(slope);
+        edgeIntercept.push_back(lon1 - slope * (lat1 - minLat));
+
+        int32_t y1 = geofenceToE7(lat1) - qMinLat, x1 = geofenceToE7(lon1) - qMinLon;
+        int32_t y2 = geofenceToE7(lat2) - qMinLat, x2 = geofenceToE7(lon2) - qMinLon;
+        if (y2 < y1)
+        {
+            int32_t t = y1;
+            y1 = y2;
+            y2 = t;
+            t = x1;
+            x1 = x2;
+            x2 = t;
+        }
+        qLatLo.push_back(y1);
+        qLatHi.push_back(y2);
+        qLonLo.push_back(x1);
+        qDLon.push_back(x2 - x1);
+    }
+
+    names.push_back(zoneName);
+    dwellLimits.push_back(dwellSeconds);
+    edgeOffsets.push_back((uint32_t)edgeLat1.size());
+    boxMinLat.push_back(minLat);
+    boxMaxLat.push_back(maxLat);
+    boxMinLon.push_back(minLon);
+    boxMaxLon.push_back(maxLon);
+    qBoxMinLat.push_back(qMinLat);
+    qBoxMaxLat.push_back(geofenceToE7(maxLat));
+    qBoxMinLon.push_back(qMinLon);
+    qBoxMaxLon.push_back(geofenceToE7(maxLon));
+    return (int)names.size() - 1;
+}
+
+void GeofenceSet::remove(uint32_t zone)
+{
+    if (isRemoved(zone))
+        return;
+
+    boxMinLat[zone] = boxMinLon[zone] = INFINITY;
+    boxMaxLat[zone] = boxMaxLon[zone] = -INFINITY;
+    qBoxMinLat[zone] = qBoxMinLon[zone] = INT32_MAX;
+    qBoxMaxLat[zone] = qBoxMaxLon[zone] = INT32_MIN;
+    removedCount++;
+}
+
+void GeofenceSet::compact(std::vector<uint32_t> *remap)
+{
+    if (remap)
+        remap->assign(size(), UINT32_MAX);
+    if (removedCount == 0)
+    {
+        for (uint32_t zone = 0; remap && zone < size(); zone++)
+            (*remap)[zone] = zone;
+        return;
+    }
+
+    GeofenceSet live;
+    live.reserve(liveCount(), edgeCount());
+    std::vector<double> lats, lons;
+    for (uint32_t zone = 0; zone < size(); zone++)
+    {
+        if (isRemoved(zone))
+            continue;
+
+        lats.assign(edgeLat1.begin() + edgeOffsets[zone], edgeLat1.begin() + edgeOffsets[zone + 1]);
+        lons.assign(edgeLon1.begin() + edgeOffsets[zone], edgeLon1.begin() + edgeOffsets[zone + 1]);
+        int id = live.add(names[zone], lats.data(), lons.data(), lats.size(), dwellLimits[zone]);
+        if (remap)
+            (*remap)[zone] = (uint32_t)id;
+    }
+    std::swap(*this, live);
+}
+
+bool GeofenceSet::contains(uint32_t zone, double lat, double lon) const
+{
+    if (lat < boxMinLat[zone] || lat > boxMaxLat[zone] || lon < boxMinLon[zone] || lon > boxMaxLon[zone])
+        return false;
+
+    const double *lat1 = edgeLat1.data();
+    const double *lat2 = edgeLat2.data();
+    const double *slope = edgeSlope.data();
+    const double *intercept = edgeIntercept.data();
+    double dLat = lat - boxMinLat[zone];
+
+    // Ray-Casting Algorithm: count edges crossed by a ray towards +lon
+    int count = 0;
+    for (uint32_t e = edgeOffsets[zone]; e < edgeOffsets[zone + 1]; e++)
+        count += ((lat1[e] > lat) != (lat2[e] > lat)) & (lon < slope[e] * dLat + intercept[e]);
+
+    return count % 2 == 1;
+}
+
+bool GeofenceSet::containsE7(uint32_t zone, int32_t lat, int32_t lon) const
+{
+    if (lat < qBoxMinLat[zone] || lat > qBoxMaxLat[zone] || lon < qBoxMinLon[zone] || lon > qBoxMaxLon[zone])
+        return false;
+
+    const int32_t *latLo = qLatLo.data();
+    const int32_t *latHi = qLatHi.data();
+    const int32_t *lonLo = qLonLo.data();
+    const int32_t *dLon = qDLon.data();
+    int32_t y = lat - qBoxMinLat[zone];
+    int32_t x = lon - qBoxMinLon[zone];
+
+    // Same ray cast as contains(), with the intersection compared by cross
+    // product instead of division
+    int count = 0;
+    for (uint32_t e = edgeOffsets[zone]; e < edgeOffsets[zone + 1]; e++)
+    {
+        int64_t lhs = (int64_t)(x - lonLo[e]) * (latHi[e] - latLo[e]);
+        int64_t rhs = (int64_t)dLon[e] * (y - latLo[e]);
+        count += (latLo[e] <= y) & (y < latHi[e]) & (lhs < rhs);
+    }
+
+    return count % 2 == 1;
+}
+
+float GeofenceSet::boxDistanceMeters(uint32_t zone, int32_t lat, int32_t lon, float cosLat) const
+{
+    int64_t dy = 0, dx = 0;
+    if (lat < qBoxMinLat[zone])
+        dy = (int64_t)qBoxMinLat[zone] - lat;
+    else if (lat > qBoxMaxLat[zone])
+        dy = (int64_t)lat - qBoxMaxLat[zone];
+    if (lon < qBoxMinLon[zone])
+        dx = (int64_t)qBoxMinLon[zone] - lon;
+    else if (lon > qBoxMaxLon[zone])
+        dx = (int64_t)lon - qBoxMaxLon[zone];
+
+    float y = dy * GEOFENCE_METERS_PER_E7;
+    float x = dx * GEOFENCE_METERS_PER_E7 * cosLat;
+    return sqrtf(x * x + y * y);
+}
+
+float GeofenceSet::edgeDistanceMeters(uint32_t zone, int32_t lat, int32_t lon, float cosLat) const
+{
+    // Work in metres relative to the fix
+    float sy = GEOFENCE_METERS_PER_E7, sx = GEOFENCE_METERS_PER_E7 * cosLat;
+    float py = (float)((int64_t)lat - qBoxMinLat[zone]) * sy;
+    float px = (float)((int64_t)lon - qBoxMinLon[zone]) * sx;
+
+    float best = INFINITY;
+    for (uint32_t e = edgeOffsets[zone]; e < edgeOffsets[zone + 1]; e++)
+    {
+        float ay = qLatLo[e] * sy - py, ax = qLonLo[e] * sx - px;
+        float dy = (qLatHi[e] - qLatLo[e]) * sy, dx = qDLon[e] * sx;
+
+        // Closest point of segment a + t * d to the origin
+        float len = dx * dx + dy * dy;
+        float t = len > 0 ? -(ax * dx + ay * dy) / len : 0;
+        t = t < 0 ? 0 : (t > 1 ? 1 : t);
+        float cy = ay + t * dy, cx = ax + t * dx;
+        float d = cx * cx + cy * cy;
+        best = d < best ? d : best;
+    }
+    return sqrtf(best);
+}
+
+GeofenceIndex::GeofenceIndex()
+    : originLat(0), originLon(0), cellLat(1), cellLon(1), cols(0), rows(0)
+{
+}
+
+void GeofenceIndex::clear()
+{
+    cols = rows = 0;
+    cellStart.clear();
+    cellItems.clear();
+}
+
+uint32_t GeofenceIndex::cellRow(int32_t lat) const
+{
+    int64_t r = ((int64_t)lat - originLat) / cellLat;
+    if (r <= 0)
+        return 0;
+    return r >= rows ? rows - 1 : (uint32_t)r;
+}
+
+uint32_t GeofenceIndex::cellCol(int32_t lon) const
+{
+    int64_t c = ((int64_t)lon - originLon) / cellLon;
+    if (c <= 0)
+        return 0;
+    return c >= cols ? cols - 1 : (uint32_t)c;
+}
+
+void GeofenceIndex::build(const GeofenceSet &zones)
+{
+    clear();
+    if (zones.empty())
+        return;
+
+    // Extent of all zones and the average zone size
+    int32_t minLat = INT32_MAX, maxLat = INT32_MIN;
+    int32_t minLon = INT32_MAX, maxLon = INT32_MIN;
+    double sumLat = 0, sumLon = 0;
+    for (uint32_t i = 0; i < zones.size(); i++)
+    {
+        if (zones.isRemoved(i))
+            continue;
+        if (zones.minLatE7(i) < minLat)
+            minLat = zones.minLatE7(i);
+        if (zones.maxLatE7(i) > maxLat)
+            maxLat = zones.maxLatE7(i);
+        if (zones.minLonE7(i) < minLon)
+            minLon = zones.minLonE7(i);
+        if (zones.maxLonE7(i) > maxLon)
+            maxLon = zones.maxLonE7(i);
+        sumLat += (double)zones.maxLatE7(i) - zones.minLatE7(i);
+        sumLon += (double)zones.maxLonE7(i) - zones.minLonE7(i);
+    }
+
+    // Aim for cells about the size of an average zone, capped in number
+    double spanLat = (double)maxLat - minLat + 1, spanLon = (double)maxLon - minLon + 1;
+    double avgLat = sumLat / zones.liveCount(), avgLon = sumLon / zones.liveCount();
+    double c = (avgLon > 0) ? ceil(spanLon / avgLon) : 1;
+    double r = (avgLat > 0) ? ceil(spanLat / avgLat) : 1;
+    if (c < 1)
+        c = 1;
+    if (r < 1)
+        r = 1;
+    double maxCells = (double)zones.liveCount() * GEOFENCE_GRID_CELLS_PER_ZONE;
+    if (c * r > maxCells)
+    {
+        double shrink = sqrt(c * r / maxCells);
+        c = ceil(c / shrink);
+        r = ceil(r / shrink);
+    }
+
+    originLat = minLat;
+    originLon = minLon;
+    cellLat = (int32_t)ceil(spanLat / r);
+    cellLon = (int32_t)ceil(spanLon / c);
+    rows = (uint32_t)ceil(spanLat / cellLat);
+    cols = (uint32_t)ceil(spanLon / cellLon);
+
+    // Counting pass, then fill (compressed row storage)
+    cellStart.assign((size_t)cols * rows + 1, 0);
+    for (uint32_t i = 0; i < zones.size(); i++)
+    {
+        if (zones.isRemoved(i))
+            continue;
+        uint32_t r0 = cellRow(zones.minLatE7(i)), r1 = cellRow(zones.maxLatE7(i));
+        uint32_t c0 = cellCol(zones.minLonE7(i)), c1 = cellCol(zones.maxLonE7(i));
+        for (uint32_t y = r0; y <= r1; y++)
+            for (uint32_t x = c0; x <= c1; x++)
+                cellStart[(size_t)y * cols + x + 1]++;
+    }
+    for (size_t i = 1; i < cellStart.size(); i++)
+        cellStart[i] += cellStart[i - 1];
+
+    cellItems.resize(cellStart.back());
+    std::vector<uint32_t> fill(cellStart.begin(), cellStart.end() - 1);
+    for (uint32_t i = 0; i < zones.size(); i++)
+    {
+        if (zones.isRemoved(i))
+            continue;
+        uint32_t r0 = cellRow(zones.minLatE7(i)), r1 = cellRow(zones.maxLatE7(i));
+        uint32_t c0 = cellCol(zones.minLonE7(i)), c1 = cellCol(zones.maxLonE7(i));
+        for (uint32_t y = r0; y <= r1; y++)
+            for (uint32_t x = c0; x <= c1; x++)
+                cellItems[fill[(size_t)y * cols + x]++] = i;
+    }
+}
+
+uint32_t GeofenceIndex::cellOf(int32_t lat, int32_t lon) const
+{
+    // Points outside the grid can't be inside any zone
+    if (cols == 0 ||
+        lat < originLat || (int64_t)lat - originLat >= (int64_t)rows * cellLat ||
+        lon < originLon || (int64_t)lon - originLon >= (int64_t)cols * cellLon)
+        return GEOFENCE_NO_CELL;
+
+    return cellRow(lat) * cols + cellCol(lon);
+}
+
+const uint32_t *GeofenceIndex::candidates(int32_t lat, int32_t lon, size_t &count) const
+{
+    uint32_t cell = cellOf(lat, lon);
+    if (cell == GEOFENCE_NO_CELL)
+    {
+        count = 0;
+        return NULL;
+    }
+    return cellZones(cell, count);
+}
+
+int GeofenceIndex::find(const GeofenceSet &zones, int32_t lat, int32_t lon) const
+{
+    size_t count;
+    const uint32_t *ids = candidates(lat, lon, count);
+    for (size_t i = 0; i < count; i++)
+    {
+        if (zones.containsE7(ids[i], lat, lon))
+            return (int)ids[i];
+    }
+    return -1;
+}
+
+size_t GeofenceIndex::findAll(const GeofenceSet &zones, int32_t lat, int32_t lon, GeofenceHits &hits) const
+{
+    hits.clear();
+    size_t count;
+    const uint32_t *ids = candidates(lat, lon, count);
+    for (size_t i = 0; i < count; i++)
+    {
+        if (zones.containsE7(ids[i], lat, lon))
+            hits.add(ids[i]);
+    }
+    return hits.count;
+}
+
+int GeofenceIndex::find(const GeofenceSet &zones, double lat, double lon) const
+{
+    size_t count;
+    const uint32_t *ids = candidates(lat, lon, count);
+    for (size_t i = 0; i < count; i++)
+    {
+        if (zones.contains(ids[i], lat, lon))
+            return (int)ids[i];
+    }
+    return -1;
+}
+
+float GeofenceIndex::nearestBoundary(const GeofenceSet &zones, int32_t lat, int32_t lon, float maxMeters) const
+{
+    if (cols == 0)
+        return maxMeters;
+
+    float cosLat = geofenceCosLat(lat);
+    float cellH = cellLat * GEOFENCE_METERS_PER_E7, cellW = cellLon * GEOFENCE_METERS_PER_E7 * cosLat;
+    float cellMeters = cellH < cellW ? cellH : cellW;
+
+    // The fix's cell, which may lie outside the grid
+    int64_t dy = (int64_t)lat - originLat, dx = (int64_t)lon - originLon;
+    int64_t row = dy >= 0 ? dy / cellLat : -((cellLat - 1 - dy) / cellLat);
+    int64_t col = dx >= 0 ? dx / cellLon : -((cellLon - 1 - dx) / cellLon);
+    int64_t maxRing = (int64_t)(maxMeters / cellMeters) + 2;
+
+    float best = maxMeters;
+    for (int64_t k = 0; k <= maxRing; k++)
+    {
+        // Every cell in ring k is at least k - 1 whole cells away
+        if (k > 0 && (k - 1) * cellMeters >= best)
+            break;
+
+        int64_t r0 = row - k < 0 ? 0 : row - k;
+        int64_t r1 = row + k >= rows ? (int64_t)rows - 1 : row + k;
+        int64_t c0 = col - k < 0 ? 0 : col - k;
+        int64_t c1 = col + k >= cols ? (int64_t)cols - 1 : col + k;
+        for (int64_t y = r0; y <= r1; y++)
+        {
+            // Whole row at the top and bottom of the ring, both ends otherwise
+            bool ringRow = y == row - k || y == row + k;
+            int64_t step = ringRow || k == 0 ? 1 : 2 * k;
+            for (int64_t x = ringRow ? c0 : col - k; x <= c1; x += step)
+            {
+                if (x < c0)
+                    continue;
+
+                size_t cell = (size_t)y * cols + (size_t)x;
+                for (uint32_t i = cellStart[cell]; i < cellStart[cell + 1]; i++)
+                {
+                    uint32_t zone = cellItems[i];
+                    if (zones.boxDistanceMeters(zone, lat, lon, cosLat) >= best)
+                        continue;
+                    float d = zones.edgeDistanceMeters(zone, lat, lon, cosLat);
+                    best = d < best ? d : best;
+                }
+            }
+        }
+    }
+    return best;
+}
+
+GeofenceTracker::GeofenceTracker()
+    : evaluationCount(0), skippedCount(0)
+{
+    reset();
+}
+
+void GeofenceTracker::reset()
+{
+    valid = false;
+    hits.clear();
+    anchorLat = anchorLon = 0;
+    cosLat = 1;
+    budget = 0;
+    clearance = 0;
+}
+
+const GeofenceHits &GeofenceTracker::update(const GeofenceSet &zones, const GeofenceIndex &index, int32_t lat, int32_t lon)
+{
+    if (valid)
+    {
+        float moved = geofenceDistanceMeters(anchorLat, anchorLon, lat, lon, cosLat);
+        if (moved < budget)
+        {
+            clearance = budget - moved;
+            skippedCount++;
+            return hits;
+        }
+    }
+
+    evaluationCount++;
+    index.findAll(zones, lat, lon, hits);
+
+    budget = index.nearestBoundary(zones, lat, lon, GEOFENCE_TRACKER_MAX_BUDGET_M) - GEOFENCE_TRACKER_MARGIN_M;
+    clearance = budget > 0 ? budget : 0;
+    anchorLat = lat;
+    anchorLon = lon;
+    cosLat = geofenceCosLat(lat);
+    valid = true;
+    return hits;
+}
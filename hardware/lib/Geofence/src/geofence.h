@@ -0,0 +1,245 @@
+#ifndef GEOFENCE_H
+#define GEOFENCE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+#include <vector>
+
+// Fixed-point coordinates are int32 in units of 1e-7 degree (~1.1 cm)
+#define GEOFENCE_E7 10000000
+
+// Metres per 1e-7 degree of latitude on a sphere of radius 6371009 m
+#define GEOFENCE_METERS_PER_E7 0.0111195f
+
+int32_t geofenceToE7(double deg);
+inline double geofenceFromE7(int32_t e7) { return e7 / (double)GEOFENCE_E7; }
+
+// cos(lat), used to scale longitude differences to metres. Single precision
+// is plenty for the local (equirectangular) approximations used here.
+float geofenceCosLat(int32_t lat);
+
+// Approximate distance in metres between two nearby fixed-point positions
+float geofenceDistanceMeters(int32_t lat1, int32_t lon1, int32_t lat2, int32_t lon2, float cosLat);
+
+// Hardest acceleration assumed when bounding how far a vehicle can travel
+#define GEOFENCE_MAX_ACCEL_MPS2 3.0f
+
+// Shortest time in milliseconds in which a vehicle moving at speedMps, and
+// accelerating at GEOFENCE_MAX_ACCEL_MPS2, can cover distanceMeters
+uint32_t geofenceReachTimeMs(float distanceMeters, float speedMps);
+
+// Most zones a single fix is reported in; overlapping zones beyond this are
+// dropped (highest ids first) and flagged in GeofenceHits::overflow
+#define GEOFENCE_MAX_HITS 8
+
+#define GEOFENCE_NO_CELL UINT32_MAX
+
+// Seconds a vehicle may stay in a zone before it is a violation, for zones
+// whose data does not set their own limit
+#define GEOFENCE_DEFAULT_DWELL_S 120
+
+// Ids of every zone containing a fix, in ascending order
+struct GeofenceHits
+{
+    uint32_t zones[GEOFENCE_MAX_HITS];
+    uint8_t count;
+    bool overflow;
+
+    GeofenceHits() : count(0), overflow(false) {}
+
+    void clear() { count = 0, overflow = false; }
+    bool add(uint32_t zone);
+    bool contains(uint32_t zone) const;
+    bool operator==(const GeofenceHits &other) const;
+    bool operator!=(const GeofenceHits &other) const { return !(*this == other); }
+};
+
+// No-parking zones as N-vertex polygons, stored structure-of-arrays.
+// Zone i owns edges [edgeStart(i), edgeStart(i + 1)); edge e runs from vertex e
+// to the next vertex of the same zone (wrapping to the first one). Each edge's
+// slope and intercept are computed once in add(), so the ray-casting loop in
+// contains() is a multiply-compare per edge with no division.
+//
+// add() also quantizes every zone to fixed point, relative to the zone's
+// bounding box corner. containsE7() runs the same test with integer cross
+// products only, which is the path used on the device (the ESP32 FPU is
+// single precision, so double math is emulated in software).
+class GeofenceSet
+{
+public:
+    GeofenceSet() : edgeOffsets(1, 0), removedCount(0) {}
+
+    void clear();
+    void reserve(size_t zones, size_t vertices);
+
+    // Append a polygon with count >= 3 vertices. Returns the zone id, or -1
+    // if the polygon is degenerate.
+    int add(const std::string &name, const double *lats, const double *lons, size_t count,
+            uint32_t dwellSeconds = GEOFENCE_DEFAULT_DWELL_S);
+
+    // size() counts removed zones too; their ids stay reserved until compact()
+    size_t size() const { return names.size(); }
+    bool empty() const { return names.size() == removedCount; }
+    size_t liveCount() const { return names.size() - removedCount; }
+
+    // Take a zone out of service without renumbering the others. Its bounding
+    // box is emptied, so no fix can match it and the index skips it.
+    void remove(uint32_t zone);
+    bool isRemoved(uint32_t zone) const { return qBoxMinLat[zone] > qBoxMaxLat[zone]; }
+    size_t removedZones() const { return removedCount; }
+
+    // Drop removed zones and renumber the rest. If remap is given it receives
+    // the new id of every old zone, or UINT32_MAX for removed ones.
+    void compact(std::vector<uint32_t> *remap = NULL);
+    size_t edgeCount() const { return edgeLat1.size(); }
+    const std::string &name(uint32_t zone) const { return names[zone]; }
+    uint32_t dwellLimit(uint32_t zone) const { return dwellLimits[zone]; }
+
+    uint32_t edgeStart(uint32_t zone) const { return edgeOffsets[zone]; }
+    uint32_t vertexCount(uint32_t zone) const { return edgeOffsets[zone + 1] - edgeOffsets[zone]; }
+    double vertexLat(uint32_t vertex) const { return edgeLat1[vertex]; }
+    double vertexLon(uint32_t vertex) const { return edgeLon1[vertex]; }
+
+    double minLat(uint32_t zone) const { return boxMinLat[zone]; }
+    double maxLat(uint32_t zone) const { return boxMaxLat[zone]; }
+    double minLon(uint32_t zone) const { return boxMinLon[zone]; }
+    double maxLon(uint32_t zone) const { return boxMaxLon[zone]; }
+
+    int32_t minLatE7(uint32_t zone) const { return qBoxMinLat[zone]; }
+    int32_t maxLatE7(uint32_t zone) const { return qBoxMaxLat[zone]; }
+    int32_t minLonE7(uint32_t zone) const { return qBoxMinLon[zone]; }
+    int32_t maxLonE7(uint32_t zone) const { return qBoxMaxLon[zone]; }
+
+    // Fixed-point edge arrays, for batch kernels (see the layout note below)
+    const int32_t *edgeLatLoE7() const { return qLatLo.data(); }
+    const int32_t *edgeLatHiE7() const { return qLatHi.data(); }
+    const int32_t *edgeLonLoE7() const { return qLonLo.data(); }
+    const int32_t *edgeDLonE7() const { return qDLon.data(); }
+
+    // Ray-casting point-in-polygon test against a single zone
+    bool contains(uint32_t zone, double lat, double lon) const;
+    bool containsE7(uint32_t zone, int32_t lat, int32_t lon) const;
+
+    // Approximate distance in metres from (lat, lon) to the zone's bounding
+    // box (0 inside it) and to the nearest point of its boundary
+    float boxDistanceMeters(uint32_t zone, int32_t lat, int32_t lon, float cosLat) const;
+    float edgeDistanceMeters(uint32_t zone, int32_t lat, int32_t lon, float cosLat) const;
+
+private:
+    friend class GeofenceCache;
+
+    // Per zone
+    std::vector<std::string> names;
+    std::vector<uint32_t> dwellLimits; // seconds
+    std::vector<uint32_t> edgeOffsets; // size() + 1 entries
+    std::vector<double> boxMinLat, boxMinLon, boxMaxLat, boxMaxLon;
+    std::vector<int32_t> qBoxMinLat, qBoxMinLon, qBoxMaxLat, qBoxMaxLon;
+    size_t removedCount;
+
+    // Per edge
+    std::vector<double> edgeLat1, edgeLon1, edgeLat2;
+    std::vector<double> edgeSlope, edgeIntercept; // lon = slope * lat + intercept
+
+    // Per edge, fixed point relative to the zone's (qBoxMinLat, qBoxMinLon).
+    // Each edge is stored from its lower to its upper endpoint, so that the
+    // crossing test needs no sign handling: the edge straddles y when
+    // qLatLo <= y < qLatHi, and lies right of x when
+    // (x - qLonLo) * (qLatHi - qLatLo) < qDLon * (y - qLatLo).
+    std::vector<int32_t> qLatLo, qLatHi, qLonLo, qDLon;
+};
+
+// Uniform grid over the zone bounding boxes.
+// Each cell lists the zones whose bounding box overlaps it, so a fix only has
+// to ray-cast the handful of zones registered in its own cell. The grid is laid
+// out in fixed point so cell lookup needs no floating point either.
+class GeofenceIndex
+{
+public:
+    GeofenceIndex();
+
+    // Rebuild from scratch; call after every geofence refresh
+    void build(const GeofenceSet &zones);
+    void clear();
+
+    // Cell containing (lat, lon), or GEOFENCE_NO_CELL outside the grid
+    uint32_t cellOf(int32_t lat, int32_t lon) const;
+
+    // Zone ids registered in a cell, in ascending order
+    const uint32_t *cellZones(uint32_t cell, size_t &count) const
+    {
+        count = cellStart[cell + 1] - cellStart[cell];
+        return cellItems.data() + cellStart[cell];
+    }
+
+    // Returns the zone ids registered in the cell containing (lat, lon)
+    // and sets count. The pointer stays valid until the next build().
+    const uint32_t *candidates(int32_t lat, int32_t lon, size_t &count) const;
+    const uint32_t *candidates(double lat, double lon, size_t &count) const
+    {
+        return candidates(geofenceToE7(lat), geofenceToE7(lon), count);
+    }
+
+    // Id of the first zone containing (lat, lon), or -1
+    int find(const GeofenceSet &zones, int32_t lat, int32_t lon) const;
+    int find(const GeofenceSet &zones, double lat, double lon) const;
+
+    // Every zone containing (lat, lon); returns hits.count
+    size_t findAll(const GeofenceSet &zones, int32_t lat, int32_t lon, GeofenceHits &hits) const;
+
+    // Distance in metres from (lat, lon) to the nearest zone boundary, or
+    // maxMeters if none is closer. Searches outwards ring by ring from the
+    // fix's cell and stops once no unvisited cell can hold a closer edge.
+    float nearestBoundary(const GeofenceSet &zones, int32_t lat, int32_t lon, float maxMeters) const;
+
+    size_t cellCount() const { return (size_t)cols * rows; }
+
+private:
+    friend class GeofenceCache;
+
+    int32_t originLat, originLon;
+    int32_t cellLat, cellLon;
+    uint32_t cols, rows;
+    std::vector<uint32_t> cellStart; // cols * rows + 1 offsets into cellItems
+    std::vector<uint32_t> cellItems;
+
+    uint32_t cellRow(int32_t lat) const;
+    uint32_t cellCol(int32_t lon) const;
+};
+
+// Incremental zone tracking.
+// After a full evaluation the tracker remembers how far the fix was from the
+// nearest zone boundary. Until the vehicle has moved that far it cannot have
+// crossed one, so later fixes reuse the previous set of zones without
+// touching any polygon.
+class GeofenceTracker
+{
+public:
+    GeofenceTracker();
+
+    // Forget the cached state; call whenever the zones are reloaded
+    void reset();
+
+    // Every zone containing (lat, lon). The reference stays valid until the
+    // next update() or reset().
+    const GeofenceHits &update(const GeofenceSet &zones, const GeofenceIndex &index, int32_t lat, int32_t lon);
+
+    float budgetMeters() const { return budget; }
+
+    // Lower bound on the distance from the last fix passed to update() to the
+    // nearest zone boundary
+    float clearanceMeters() const { return clearance; }
+    uint32_t evaluations() const { return evaluationCount; }
+    uint32_t skipped() const { return skippedCount; }
+
+private:
+    bool valid;
+    GeofenceHits hits;
+    int32_t anchorLat, anchorLon;
+    float cosLat;
+    float budget;
+    float clearance;
+    uint32_t evaluationCount, skippedCount;
+};
+
+#endif // GEOFENCE_H
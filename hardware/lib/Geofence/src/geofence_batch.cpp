@@ -0,0 +1,280 @@
+#include "geofence_batch.h"
+
+#include <string.h>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+// Work split: fixes per chunk for the per-fix passes, cells per chunk for the
+// kernel pass
+#define GEOFENCE_BATCH_FIX_CHUNK 65536
+#define GEOFENCE_BATCH_CELL_CHUNK 256
+
+// Same test as GeofenceSet::containsE7(), one zone against n fixes.
+// inside[i] is set to 1 if fix i is in the zone, 0 otherwise.
+static void containsScalar(const GeofenceSet &zones, uint32_t zone,
+                           const int32_t *lats, const int32_t *lons, size_t n, uint8_t *inside)
+{
+    for (size_t i = 0; i < n; i++)
+        inside[i] = zones.containsE7(zone, lats[i], lons[i]);
+}
+
+#if defined(__AVX2__)
+static void containsAvx2(const GeofenceSet &zones, uint32_t zone,
+                         const int32_t *lats, const int32_t *lons, size_t n, uint8_t *inside)
+{
+    const int32_t *latLo = zones.edgeLatLoE7();
+    const int32_t *latHi = zones.edgeLatHiE7();
+    const int32_t *lonLo = zones.edgeLonLoE7();
+    const int32_t *dLon = zones.edgeDLonE7();
+    uint32_t first = zones.edgeStart(zone), last = first + zones.vertexCount(zone);
+
+    const __m256i minLat = _mm256_set1_epi32(zones.minLatE7(zone));
+    const __m256i maxLat = _mm256_set1_epi32(zones.maxLatE7(zone));
+    const __m256i minLon = _mm256_set1_epi32(zones.minLonE7(zone));
+    const __m256i maxLon = _mm256_set1_epi32(zones.maxLonE7(zone));
+    const __m256i ones = _mm256_set1_epi32(-1);
+
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8)
+    {
+        __m256i lat = _mm256_loadu_si256((const __m256i *)(lats + i));
+        __m256i lon = _mm256_loadu_si256((const __m256i *)(lons + i));
+
+        // Lanes outside the bounding box
+        __m256i outside = _mm256_or_si256(
+            _mm256_or_si256(_mm256_cmpgt_epi32(minLat, lat), _mm256_cmpgt_epi32(lat, maxLat)),
+            _mm256_or_si256(_mm256_cmpgt_epi32(minLon, lon), _mm256_cmpgt_epi32(lon, maxLon)));
+        if (_mm256_testc_si256(outside, ones))
+        {
+            memset(inside + i, 0, 8);
+            continue;
+        }
+
+        __m256i y = _mm256_sub_epi32(lat, minLat);
+        __m256i x = _mm256_sub_epi32(lon, minLon);
+        __m256i parity = _mm256_setzero_si256();
+        for (uint32_t e = first; e < last; e++)
+        {
+            __m256i lo = _mm256_set1_epi32(latLo[e]);
+            __m256i hi = _mm256_set1_epi32(latHi[e]);
+
+            // latLo <= y < latHi
+            __m256i straddle = _mm256_andnot_si256(_mm256_cmpgt_epi32(lo, y), _mm256_cmpgt_epi32(hi, y));
+            if (_mm256_testz_si256(straddle, straddle))
+                continue;
+
+            // (x - lonLo) * (latHi - latLo) < dLon * (y - latLo), in 64 bits:
+            // even lanes first, then the odd lanes shifted down
+            __m256i a = _mm256_sub_epi32(x, _mm256_set1_epi32(lonLo[e]));
+            __m256i b = _mm256_set1_epi32(latHi[e] - latLo[e]);
+            __m256i c = _mm256_set1_epi32(dLon[e]);
+            __m256i d = _mm256_sub_epi32(y, lo);
+            __m256i ltEven = _mm256_cmpgt_epi64(_mm256_mul_epi32(c, d), _mm256_mul_epi32(a, b));
+            __m256i ltOdd = _mm256_cmpgt_epi64(_mm256_mul_epi32(c, _mm256_srli_epi64(d, 32)),
+                                               _mm256_mul_epi32(_mm256_srli_epi64(a, 32), b));
+            __m256i lt = _mm256_blend_epi32(ltEven, ltOdd, 0xAA);
+
+            parity = _mm256_xor_si256(parity, _mm256_and_si256(straddle, lt));
+        }
+
+        int mask = _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_andnot_si256(outside, parity)));
+        for (int k = 0; k < 8; k++)
+            inside[i + k] = (mask >> k) & 1;
+    }
+
+    containsScalar(zones, zone, lats + i, lons + i, n - i, inside + i);
+}
+#endif
+
+const char *GeofenceBatch::kernel()
+{
+#if defined(__AVX2__)
+    return "avx2";
+#else
+    return "scalar";
+#endif
+}
+
+GeofenceBatch::GeofenceBatch(unsigned threads)
+    : job(NULL), jobSize(0), jobChunk(1), nextChunk(0), chunksLeft(0), generation(0), stopping(false)
+{
+    if (threads == 0)
+        threads = std::thread::hardware_concurrency();
+    for (unsigned i = 1; i < threads; i++)
+        workers.emplace_back(&GeofenceBatch::workerLoop, this);
+}
+
+GeofenceBatch::~GeofenceBatch()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    wake.notify_all();
+    for (std::thread &worker : workers)
+        worker.join();
+}
+
+void GeofenceBatch::workerLoop()
+{
+    uint64_t seen = 0;
+    for (;;)
+    {
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            wake.wait(lock, [&] { return stopping || generation != seen; });
+            if (stopping)
+                return;
+            seen = generation;
+        }
+        runChunks();
+    }
+}
+
+void GeofenceBatch::runChunks()
+{
+    for (;;)
+    {
+        const std::function<void(size_t, size_t)> *fn;
+        size_t begin, end;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (job == NULL || nextChunk * jobChunk >= jobSize)
+                return;
+            fn = job;
+            begin = nextChunk++ * jobChunk;
+            end = begin + jobChunk < jobSize ? begin + jobChunk : jobSize;
+        }
+
+        (*fn)(begin, end);
+
+        std::lock_guard<std::mutex> lock(mutex);
+        if (--chunksLeft == 0)
+            done.notify_all();
+    }
+}
+
+void GeofenceBatch::parallelFor(size_t n, size_t chunk, const std::function<void(size_t, size_t)> &fn)
+{
+    if (n == 0)
+        return;
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        job = &fn;
+        jobSize = n;
+        jobChunk = chunk;
+        nextChunk = 0;
+        chunksLeft = (n + chunk - 1) / chunk;
+        generation++;
+    }
+    wake.notify_all();
+
+    runChunks();
+
+    std::unique_lock<std::mutex> lock(mutex);
+    done.wait(lock, [&] { return chunksLeft == 0; });
+    job = NULL;
+}
+
+void GeofenceBatch::evaluate(const GeofenceSet &zones, const GeofenceIndex &index,
+                             const int32_t *lats, const int32_t *lons, size_t count, GeofenceHits *hits)
+{
+    for (size_t start = 0; start < count; start += GEOFENCE_BATCH_BLOCK)
+    {
+        size_t n = count - start < GEOFENCE_BATCH_BLOCK ? count - start : GEOFENCE_BATCH_BLOCK;
+        evaluateBlock(zones, index, lats + start, lons + start, n, hits + start);
+    }
+}
+
+void GeofenceBatch::evaluateBlock(const GeofenceSet &zones, const GeofenceIndex &index,
+                                  const int32_t *lats, const int32_t *lons, size_t count, GeofenceHits *hits)
+{
+    size_t cells = index.cellCount();
+    size_t parts = threads();
+    size_t partSize = (count + parts - 1) / parts;
+
+    // Cell of every fix
+    cellIds.resize(count);
+    parallelFor(count, GEOFENCE_BATCH_FIX_CHUNK, [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; i++)
+        {
+            cellIds[i] = index.cellOf(lats[i], lons[i]);
+            hits[i].clear();
+        }
+    });
+    if (cells == 0)
+        return;
+
+    // Counting sort by cell: one histogram per contiguous part of the block,
+    // turned into per-part write offsets, then a stable parallel scatter
+    threadCounts.assign(parts * cells, 0);
+    parallelFor(parts, 1, [&](size_t part, size_t) {
+        uint32_t *counts = &threadCounts[part * cells];
+        size_t end = (part + 1) * partSize < count ? (part + 1) * partSize : count;
+        for (size_t i = part * partSize; i < end; i++)
+            if (cellIds[i] != GEOFENCE_NO_CELL)
+                counts[cellIds[i]]++;
+    });
+
+    cellOffsets.resize(cells + 1);
+    uint32_t total = 0;
+    for (size_t c = 0; c < cells; c++)
+    {
+        cellOffsets[c] = total;
+        for (size_t part = 0; part < parts; part++)
+        {
+            uint32_t n = threadCounts[part * cells + c];
+            threadCounts[part * cells + c] = total;
+            total += n;
+        }
+    }
+    cellOffsets[cells] = total;
+
+    order.resize(total);
+    sortedLat.resize(total);
+    sortedLon.resize(total);
+    parallelFor(parts, 1, [&](size_t part, size_t) {
+        uint32_t *offsets = &threadCounts[part * cells];
+        size_t end = (part + 1) * partSize < count ? (part + 1) * partSize : count;
+        for (size_t i = part * partSize; i < end; i++)
+        {
+            if (cellIds[i] == GEOFENCE_NO_CELL)
+                continue;
+            uint32_t pos = offsets[cellIds[i]]++;
+            order[pos] = (uint32_t)i;
+            sortedLat[pos] = lats[i];
+            sortedLon[pos] = lons[i];
+        }
+    });
+
+    // Every zone of a cell against every fix in it. Each fix lives in exactly
+    // one cell, so its hits are only ever written by one thread, and zones are
+    // visited in ascending id order, matching findAll().
+    parallelFor(cells, GEOFENCE_BATCH_CELL_CHUNK, [&](size_t begin, size_t end) {
+        std::vector<uint8_t> inside;
+        for (size_t c = begin; c < end; c++)
+        {
+            uint32_t first = cellOffsets[c], n = cellOffsets[c + 1] - first;
+            if (n == 0)
+                continue;
+
+            size_t zoneCount;
+            const uint32_t *ids = index.cellZones((uint32_t)c, zoneCount);
+            inside.resize(n);
+            for (size_t z = 0; z < zoneCount; z++)
+            {
+#if defined(__AVX2__)
+                containsAvx2(zones, ids[z], &sortedLat[first], &sortedLon[first], n, inside.data());
+#else
+                containsScalar(zones, ids[z], &sortedLat[first], &sortedLon[first], n, inside.data());
+#endif
+                for (uint32_t k = 0; k < n; k++)
+                    if (inside[k])
+                        hits[order[first + k]].add(ids[z]);
+            }
+        }
+    });
+}
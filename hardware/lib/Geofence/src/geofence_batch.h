@@ -0,0 +1,65 @@
+#ifndef GEOFENCE_BATCH_H
+#define GEOFENCE_BATCH_H
+
+#include "geofence.h"
+
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+// Fixes are processed in blocks of this many, which bounds the scratch memory
+// at about 16 bytes per fix in a block
+#define GEOFENCE_BATCH_BLOCK (1u << 22)
+
+// Batch zone evaluation for host-side replay of recorded fixes.
+//
+// Each block of fixes is bucketed by grid cell with a parallel counting sort.
+// Every (cell, zone) pair then runs one kernel over all fixes in that cell,
+// so the zone's edges are loaded once and tested against 8 fixes per
+// instruction with AVX2 (scalar fallback elsewhere). Cells are spread over a
+// persistent thread pool. Results match GeofenceIndex::findAll() exactly.
+class GeofenceBatch
+{
+public:
+    // threads == 0 uses every hardware thread
+    explicit GeofenceBatch(unsigned threads = 0);
+    ~GeofenceBatch();
+
+    // hits[i] receives every zone containing fix i
+    void evaluate(const GeofenceSet &zones, const GeofenceIndex &index,
+                  const int32_t *lats, const int32_t *lons, size_t count, GeofenceHits *hits);
+
+    unsigned threads() const { return (unsigned)workers.size() + 1; }
+
+    // Name of the edge-test kernel compiled in ("avx2" or "scalar")
+    static const char *kernel();
+
+private:
+    void evaluateBlock(const GeofenceSet &zones, const GeofenceIndex &index,
+                       const int32_t *lats, const int32_t *lons, size_t count, GeofenceHits *hits);
+
+    // Runs fn(begin, end) over chunks of [0, n) on every thread, including the
+    // caller's, and returns once all chunks are done
+    void parallelFor(size_t n, size_t chunk, const std::function<void(size_t, size_t)> &fn);
+    void workerLoop();
+    void runChunks();
+
+    // Thread pool
+    std::vector<std::thread> workers;
+    std::mutex mutex;
+    std::condition_variable wake, done;
+    const std::function<void(size_t, size_t)> *job;
+    size_t jobSize, jobChunk, nextChunk, chunksLeft;
+    uint64_t generation;
+    bool stopping;
+
+    // Per-block scratch
+    std::vector<uint32_t> cellIds;      // cell of each fix
+    std::vector<uint32_t> cellOffsets;  // counting sort output offsets
+    std::vector<uint32_t> threadCounts; // per-thread cell histograms
+    std::vector<uint32_t> order;        // fix index, sorted by cell
+    std::vector<int32_t> sortedLat, sortedLon;
+};
+
+#endif // GEOFENCE_BATCH_H
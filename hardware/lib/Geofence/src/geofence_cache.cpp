@@ -0,0 +1,317 @@
+#include "geofence_cache.h"
+
+#include <string.h>
+
+#if defined(__linux__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// CRC-32 (IEEE, reflected), a nibble at a time: a 64-byte table is enough
+// for the few hundred kilobytes of a zone set
+static const uint32_t crcNibbles[16] = {
+    0x00000000, 0x1db71064, 0x3b6e20c8, 0x26d930ac, 0x76dc4190, 0x6b6b51f4, 0x4db26158, 0x5005713c,
+    0xedb88320, 0xf00f9344, 0xd6d6a3e8, 0xcb61b38c, 0x9b64c2b0, 0x86d3d2d4, 0xa00ae278, 0xbdbdf21c};
+
+static uint32_t crcUpdate(uint32_t crc, const uint8_t *data, size_t size)
+{
+    for (size_t i = 0; i < size; i++)
+    {
+        crc ^= data[i];
+        crc = (crc >> 4) ^ crcNibbles[crc & 15];
+        crc = (crc >> 4) ^ crcNibbles[crc & 15];
+    }
+    return crc;
+}
+
+static uint64_t alignUp(uint64_t size)
+{
+    return (size + GEOFENCE_CACHE_ALIGN - 1) & ~(uint64_t)(GEOFENCE_CACHE_ALIGN - 1);
+}
+
+// Origin, cell size and dimensions of the grid
+struct CacheGrid
+{
+    int32_t originLat, originLon;
+    int32_t cellLat, cellLon;
+    uint32_t cols, rows;
+};
+
+static uint64_t cacheSize(const GeofenceCacheHeader &header)
+{
+    uint64_t zones = header.zoneCount, edges = header.edgeCount, cells = header.cellCount;
+    uint64_t size = alignUp(sizeof(GeofenceCacheHeader)) +
+                    2 * alignUp((zones + 1) * sizeof(uint32_t)) + // edge and name offsets
+                    alignUp(zones * sizeof(uint32_t)) +           // dwell limits
+                    4 * alignUp(zones * sizeof(double)) + 4 * alignUp(zones * sizeof(int32_t)) +
+                    5 * alignUp(edges * sizeof(double)) + 4 * alignUp(edges * sizeof(int32_t)) +
+                    alignUp(header.nameBytes) + alignUp(header.metaBytes) + sizeof(uint32_t);
+    if (cells > 0)
+        size += alignUp(sizeof(CacheGrid)) + alignUp((cells + 1) * sizeof(uint32_t)) +
+                alignUp((uint64_t)header.cellItemCount * sizeof(uint32_t));
+    return size;
+}
+
+static GeofenceCacheHeader makeHeader(size_t zoneCount, size_t edgeCount, size_t removedCount,
+                                      size_t nameBytes, size_t metaBytes, size_t cellCount, size_t cellItemCount)
+{
+    GeofenceCacheHeader header;
+    memset(&header, 0, sizeof(header));
+    header.magic = GEOFENCE_CACHE_MAGIC;
+    header.version = GEOFENCE_CACHE_VERSION;
+    header.headerSize = sizeof(header);
+    header.zoneCount = (uint32_t)zoneCount;
+    header.edgeCount = (uint32_t)edgeCount;
+    header.removedCount = (uint32_t)removedCount;
+    header.nameBytes = (uint32_t)nameBytes;
+    header.metaBytes = (uint32_t)metaBytes;
+    header.cellCount = (uint32_t)cellCount;
+    header.cellItemCount = (uint32_t)cellItemCount;
+    header.fileSize = (uint32_t)cacheSize(header);
+    return header;
+}
+
+// Position and running checksum of a read or write in progress
+struct CacheCursor
+{
+    GeofenceCacheStream &stream;
+    uint64_t pos;
+    uint32_t crc;
+
+    explicit CacheCursor(GeofenceCacheStream &stream) : stream(stream), pos(0), crc(0xffffffff) {}
+
+    bool write(const void *data, size_t size)
+    {
+        if (size == 0)
+            return true;
+        crc = crcUpdate(crc, (const uint8_t *)data, size);
+        pos += size;
+        return stream.write(data, size) == size;
+    }
+
+    bool read(void *data, size_t size)
+    {
+        if (size == 0)
+            return true;
+        if (stream.read(data, size) != size)
+            return false;
+        crc = crcUpdate(crc, (const uint8_t *)data, size);
+        pos += size;
+        return true;
+    }
+
+    // Zero padding up to the next array boundary
+    bool pad(bool reading)
+    {
+        uint8_t zeros[GEOFENCE_CACHE_ALIGN] = {0};
+        size_t n = (size_t)(alignUp(pos) - pos);
+        return reading ? read(zeros, n) : write(zeros, n);
+    }
+};
+
+template <typename T>
+static bool writeArray(CacheCursor &cursor, const std::vector<T> &values)
+{
+    return cursor.write(values.data(), values.size() * sizeof(T)) && cursor.pad(false);
+}
+
+template <typename T>
+static bool readArray(CacheCursor &cursor, std::vector<T> &values, size_t count)
+{
+    values.resize(count);
+    return cursor.read(values.data(), count * sizeof(T)) && cursor.pad(true);
+}
+
+// Offsets must start at 0, never decrease and end at total
+static bool validOffsets(const std::vector<uint32_t> &offsets, uint32_t total)
+{
+    if (offsets.front() != 0 || offsets.back() != total)
+        return false;
+    for (size_t i = 1; i < offsets.size(); i++)
+        if (offsets[i] < offsets[i - 1])
+            return false;
+    return true;
+}
+
+size_t GeofenceMemoryStream::read(void *data, size_t size)
+{
+    if (size > inSize)
+        size = inSize;
+    memcpy(data, in, size);
+    in += size;
+    inSize -= size;
+    return size;
+}
+
+size_t GeofenceMemoryStream::write(const void *data, size_t size)
+{
+    if (out == NULL)
+        return 0;
+    out->insert(out->end(), (const uint8_t *)data, (const uint8_t *)data + size);
+    return size;
+}
+
+size_t GeofenceCache::fileSize(const GeofenceSet &zones, const GeofenceIndex *index, size_t metaBytes)
+{
+    size_t nameBytes = 0;
+    for (const std::string &name : zones.names)
+        nameBytes += name.size();
+    size_t cells = index ? index->cellCount() : 0;
+    return makeHeader(zones.size(), zones.edgeCount(), zones.removedCount, nameBytes, metaBytes,
+                      cells, cells ? index->cellItems.size() : 0).fileSize;
+}
+
+bool GeofenceCache::write(GeofenceCacheStream &out, const GeofenceSet &zones, const GeofenceIndex *index,
+                          const std::string &meta)
+{
+    std::vector<uint32_t> nameOffsets(1, 0);
+    nameOffsets.reserve(zones.size() + 1);
+    for (const std::string &name : zones.names)
+        nameOffsets.push_back(nameOffsets.back() + (uint32_t)name.size());
+
+    size_t cells = index ? index->cellCount() : 0;
+    GeofenceCacheHeader header = makeHeader(zones.size(), zones.edgeCount(), zones.removedCount, nameOffsets.back(),
+                                            meta.size(), cells, cells ? index->cellItems.size() : 0);
+
+    CacheCursor cursor(out);
+    bool ok = cursor.write(&header, sizeof(header)) && cursor.pad(false) &&
+              writeArray(cursor, zones.edgeOffsets) && writeArray(cursor, zones.dwellLimits) &&
+              writeArray(cursor, zones.boxMinLat) && writeArray(cursor, zones.boxMinLon) &&
+              writeArray(cursor, zones.boxMaxLat) && writeArray(cursor, zones.boxMaxLon) &&
+              writeArray(cursor, zones.qBoxMinLat) && writeArray(cursor, zones.qBoxMinLon) &&
+              writeArray(cursor, zones.qBoxMaxLat) && writeArray(cursor, zones.qBoxMaxLon) &&
+              writeArray(cursor, nameOffsets) &&
+              writeArray(cursor, zones.edgeLat1) && writeArray(cursor, zones.edgeLon1) &&
+              writeArray(cursor, zones.edgeLat2) && writeArray(cursor, zones.edgeSlope) &&
+              writeArray(cursor, zones.edgeIntercept) &&
+              writeArray(cursor, zones.qLatLo) && writeArray(cursor, zones.qLatHi) &&
+              writeArray(cursor, zones.qLonLo) && writeArray(cursor, zones.qDLon);
+    for (size_t i = 0; ok && i < zones.size(); i++)
+        ok = cursor.write(zones.names[i].data(), zones.names[i].size());
+    ok = ok && cursor.pad(false);
+    if (ok && cells > 0)
+    {
+        CacheGrid grid = {index->originLat, index->originLon, index->cellLat, index->cellLon, index->cols, index->rows};
+        ok = cursor.write(&grid, sizeof(grid)) && cursor.pad(false) &&
+             writeArray(cursor, index->cellStart) && writeArray(cursor, index->cellItems);
+    }
+    ok = ok && cursor.write(meta.data(), meta.size()) && cursor.pad(false);
+    if (!ok)
+        return false;
+
+    uint32_t crc = ~cursor.crc;
+    return out.write(&crc, sizeof(crc)) == sizeof(crc);
+}
+
+bool GeofenceCache::read(GeofenceCacheStream &in, GeofenceSet &zones, GeofenceIndex *index, std::string &meta)
+{
+    CacheCursor cursor(in);
+    GeofenceCacheHeader header;
+    if (!cursor.read(&header, sizeof(header)) || !cursor.pad(true))
+        return false;
+    if (header.magic != GEOFENCE_CACHE_MAGIC || header.version != GEOFENCE_CACHE_VERSION ||
+        header.headerSize != sizeof(header) || header.removedCount > header.zoneCount)
+        return false;
+
+    // Check the sizes before allocating anything for them
+    uint64_t size = cacheSize(header);
+    if (header.fileSize != size || size - cursor.pos > in.available())
+        return false;
+
+    uint32_t zoneCount = header.zoneCount, edgeCount = header.edgeCount;
+    GeofenceSet loaded;
+    std::vector<uint32_t> nameOffsets;
+    bool ok = readArray(cursor, loaded.edgeOffsets, zoneCount + 1) &&
+              readArray(cursor, loaded.dwellLimits, zoneCount) &&
+              readArray(cursor, loaded.boxMinLat, zoneCount) && readArray(cursor, loaded.boxMinLon, zoneCount) &&
+              readArray(cursor, loaded.boxMaxLat, zoneCount) && readArray(cursor, loaded.boxMaxLon, zoneCount) &&
+              readArray(cursor, loaded.qBoxMinLat, zoneCount) && readArray(cursor, loaded.qBoxMinLon, zoneCount) &&
+              readArray(cursor, loaded.qBoxMaxLat, zoneCount) && readArray(cursor, loaded.qBoxMaxLon, zoneCount) &&
+              readArray(cursor, nameOffsets, zoneCount + 1) &&
+              readArray(cursor, loaded.edgeLat1, edgeCount) && readArray(cursor, loaded.edgeLon1, edgeCount) &&
+              readArray(cursor, loaded.edgeLat2, edgeCount) && readArray(cursor, loaded.edgeSlope, edgeCount) &&
+              readArray(cursor, loaded.edgeIntercept, edgeCount) &&
+              readArray(cursor, loaded.qLatLo, edgeCount) && readArray(cursor, loaded.qLatHi, edgeCount) &&
+              readArray(cursor, loaded.qLonLo, edgeCount) && readArray(cursor, loaded.qDLon, edgeCount);
+    if (!ok || !validOffsets(loaded.edgeOffsets, edgeCount) || !validOffsets(nameOffsets, header.nameBytes))
+        return false;
+
+    std::string chars, loadedMeta;
+    chars.resize(header.nameBytes);
+    if (!cursor.read(&chars[0], chars.size()) || !cursor.pad(true))
+        return false;
+
+    GeofenceIndex loadedIndex;
+    if (header.cellCount > 0)
+    {
+        CacheGrid grid;
+        if (!cursor.read(&grid, sizeof(grid)) || !cursor.pad(true) ||
+            !readArray(cursor, loadedIndex.cellStart, header.cellCount + 1) ||
+            !readArray(cursor, loadedIndex.cellItems, header.cellItemCount))
+            return false;
+        if ((uint64_t)grid.cols * grid.rows != header.cellCount || grid.cellLat <= 0 || grid.cellLon <= 0 ||
+            !validOffsets(loadedIndex.cellStart, header.cellItemCount))
+            return false;
+        for (uint32_t zone : loadedIndex.cellItems)
+            if (zone >= zoneCount)
+                return false;
+        loadedIndex.originLat = grid.originLat;
+        loadedIndex.originLon = grid.originLon;
+        loadedIndex.cellLat = grid.cellLat;
+        loadedIndex.cellLon = grid.cellLon;
+        loadedIndex.cols = grid.cols;
+        loadedIndex.rows = grid.rows;
+    }
+
+    loadedMeta.resize(header.metaBytes);
+    if (!cursor.read(&loadedMeta[0], loadedMeta.size()) || !cursor.pad(true))
+        return false;
+
+    uint32_t crc;
+    if (in.read(&crc, sizeof(crc)) != sizeof(crc) || crc != ~cursor.crc)
+        return false;
+
+    loaded.names.reserve(zoneCount);
+    for (uint32_t i = 0; i < zoneCount; i++)
+        loaded.names.push_back(chars.substr(nameOffsets[i], nameOffsets[i + 1] - nameOffsets[i]));
+    loaded.removedCount = header.removedCount;
+
+    std::swap(zones, loaded);
+    if (index)
+        std::swap(*index, loadedIndex);
+    meta.swap(loadedMeta);
+    return true;
+}
+
+#if defined(__linux__)
+bool GeofenceCacheMapping::open(const char *path)
+{
+    close();
+
+    int fd = ::open(path, O_RDONLY);
+    if (fd < 0)
+        return false;
+
+    struct stat st;
+    void *addr = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && st.st_size > 0)
+        addr = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (addr == MAP_FAILED)
+        return false;
+
+    mapped = (const uint8_t *)addr;
+    mappedSize = (size_t)st.st_size;
+    return true;
+}
+
+void GeofenceCacheMapping::close()
+{
+    if (mapped)
+        munmap((void *)mapped, mappedSize);
+    mapped = NULL;
+    mappedSize = 0;
+}
+#endif
@@ -0,0 +1,114 @@
+#ifndef GEOFENCE_CACHE_H
+#define GEOFENCE_CACHE_H
+
+#include "geofence.h"
+
+// "GFC1" read as a little-endian word; a big-endian reader sees it reversed
+// and rejects the file
+#define GEOFENCE_CACHE_MAGIC 0x31434647u
+#define GEOFENCE_CACHE_VERSION 3
+
+// Every array in the file starts on this boundary, so a mapped file can be
+// read in place
+#define GEOFENCE_CACHE_ALIGN 8
+
+// File layout, all little-endian:
+//   header
+//   per zone:  edgeOffsets (zoneCount + 1), dwell limits, box min/max
+//              lat/lon as double, then as int32, name offsets (zoneCount + 1)
+//   per edge:  lat1, lon1, lat2, slope, intercept as double,
+//              latLo, latHi, lonLo, dLon as int32
+//   names:     nameBytes characters, not terminated
+//   grid:      only if cellCount > 0: origin lat/lon, cell lat/lon, cols,
+//              rows, cellStart (cellCount + 1), cellItems (cellItemCount)
+//   meta:      metaBytes of caller data
+//   CRC-32 of everything before it
+// with each array padded to GEOFENCE_CACHE_ALIGN.
+struct GeofenceCacheHeader
+{
+    uint32_t magic;
+    uint16_t version;
+    uint16_t headerSize;
+    uint32_t zoneCount;
+    uint32_t edgeCount;
+    uint32_t removedCount;
+    uint32_t nameBytes;
+    uint32_t metaBytes;
+    uint32_t cellCount;
+    uint32_t cellItemCount;
+    uint32_t fileSize;
+};
+
+// Byte source or sink for a cache file. Both calls return the number of
+// bytes transferred; a short count is treated as an error.
+class GeofenceCacheStream
+{
+public:
+    virtual ~GeofenceCacheStream() {}
+    virtual size_t read(void *data, size_t size) = 0;
+    virtual size_t write(const void *data, size_t size) = 0;
+
+    // Bytes left to read, or SIZE_MAX if unknown
+    virtual size_t available() const { return SIZE_MAX; }
+};
+
+// Reads from a buffer (for example a mapped file) or appends to a vector
+class GeofenceMemoryStream : public GeofenceCacheStream
+{
+public:
+    GeofenceMemoryStream(const uint8_t *data, size_t size) : in(data), inSize(size), out(NULL) {}
+    explicit GeofenceMemoryStream(std::vector<uint8_t> &out) : in(NULL), inSize(0), out(&out) {}
+
+    size_t read(void *data, size_t size);
+    size_t write(const void *data, size_t size);
+    size_t available() const { return inSize; }
+
+private:
+    const uint8_t *in;
+    size_t inSize;
+    std::vector<uint8_t> *out;
+};
+
+// Versioned, checksummed binary image of a GeofenceSet and, optionally, the
+// GeofenceIndex built over it. Loading copies each array straight into place:
+// nothing is parsed and neither edges nor grid are recomputed. meta carries
+// caller data alongside the zones (ZoneSync keeps its document table there).
+class GeofenceCache
+{
+public:
+    // index may be NULL to leave the grid out
+    static size_t fileSize(const GeofenceSet &zones, const GeofenceIndex *index, size_t metaBytes);
+    static bool write(GeofenceCacheStream &out, const GeofenceSet &zones, const GeofenceIndex *index,
+                      const std::string &meta);
+
+    // Replaces zones, index and meta only if the whole file checks out. A file
+    // without a grid leaves index cleared (cellCount() == 0); rebuild it then.
+    static bool read(GeofenceCacheStream &in, GeofenceSet &zones, GeofenceIndex *index, std::string &meta);
+};
+
+#if defined(__linux__)
+// Read-only mapping of a cache file, for host tools that share the device's
+// zone set
+class GeofenceCacheMapping
+{
+public:
+    GeofenceCacheMapping() : mapped(NULL), mappedSize(0) {}
+    ~GeofenceCacheMapping() { close(); }
+
+    bool open(const char *path);
+    void close();
+
+    const uint8_t *data() const { return mapped; }
+    size_t size() const { return mappedSize; }
+    const GeofenceCacheHeader *header() const { return (const GeofenceCacheHeader *)mapped; }
+
+private:
+    GeofenceCacheMapping(const GeofenceCacheMapping &);
+    GeofenceCacheMapping &operator=(const GeofenceCacheMapping &);
+
+    const uint8_t *mapped;
+    size_t mappedSize;
+};
+#endif
+
+#endif // GEOFENCE_CACHE_H
@@ -0,0 +1,252 @@
+#include "geofence_distance.h"
+
+#include <math.h>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#define GEOFENCE_DISTANCE_NEON
+#endif
+
+#define RADIANS_PER_E7 (M_PI / 180.0 / GEOFENCE_E7)
+#define METERS_PER_E7 ((float)(GEOFENCE_EARTH_RADIUS_M * RADIANS_PER_E7))
+#define E7_180 1800000000
+
+// 2^32 - 360 degrees: taking 360 degrees off a longitude difference is the
+// same as adding this in wrapping 32-bit arithmetic
+#define E7_WRAP 694967296
+
+// Taylor coefficients of cos(x) in x^2; the x^14 term is below 1e-8 for
+// |x| <= pi / 2, the range of a mean latitude
+#define COS_C2 (-1.0f / 2)
+#define COS_C4 (1.0f / 24)
+#define COS_C6 (-1.0f / 720)
+#define COS_C8 (1.0f / 40320)
+#define COS_C10 (-1.0f / 3628800)
+#define COS_C12 (1.0f / 479001600)
+
+// Longitude difference wrapped to +-180 degrees
+static inline int32_t lonDelta(int32_t lon, int32_t lon0)
+{
+    int64_t d = (int64_t)lon - lon0;
+    if (d > E7_180)
+        d -= 2 * (int64_t)E7_180;
+    else if (d < -E7_180)
+        d += 2 * (int64_t)E7_180;
+    return (int32_t)d;
+}
+
+// East and north offsets in metres on the plane of the given mode
+static inline void planeOffsets(GeofenceDistanceMode mode, int32_t lat0, int32_t lon0, float lonScale,
+                                int32_t lat, int32_t lon, float &x, float &y)
+{
+    y = (float)(lat - lat0) * METERS_PER_E7;
+    x = (float)lonDelta(lon, lon0) * METERS_PER_E7;
+    if (mode == GEOFENCE_DISTANCE_EQUIRECTANGULAR)
+        x *= cosf((float)(lat + lat0) * (float)(RADIANS_PER_E7 / 2));
+    else
+        x *= lonScale;
+}
+
+static void planeDistancesScalar(GeofenceDistanceMode mode, int32_t lat0, int32_t lon0, float lonScale,
+                                 const int32_t *lats, const int32_t *lons, size_t count, float *meters)
+{
+    for (size_t i = 0; i < count; i++)
+    {
+        float x, y;
+        planeOffsets(mode, lat0, lon0, lonScale, lats[i], lons[i], x, y);
+        meters[i] = sqrtf(x * x + y * y);
+    }
+}
+
+#if defined(__AVX2__)
+static void planeDistancesAvx2(GeofenceDistanceMode mode, int32_t lat0, int32_t lon0, float lonScale,
+                               const int32_t *lats, const int32_t *lons, size_t count, float *meters)
+{
+    const __m256i vLat0 = _mm256_set1_epi32(lat0);
+    const __m256i vLon0 = _mm256_set1_epi32(lon0);
+    const __m256 metersPerE7 = _mm256_set1_ps(METERS_PER_E7);
+    const __m256 scale = _mm256_set1_ps(lonScale);
+    const __m256 halfRadians = _mm256_set1_ps((float)(RADIANS_PER_E7 / 2));
+    const __m256i wrapHi = _mm256_set1_epi32(E7_180), wrapLo = _mm256_set1_epi32(-E7_180);
+    const __m256i wrap = _mm256_set1_epi32(E7_WRAP);
+    const __m256i zero = _mm256_setzero_si256();
+    // The 32-bit difference overflows only across the antimeridian: east of
+    // it (lon >= 0) from a reference west of it, or the other way round
+    const __m256i westOfZero = _mm256_set1_epi32(lon0 < 0 ? -1 : 0);
+    const __m256i eastOfZero = _mm256_set1_epi32(lon0 > 0 ? -1 : 0);
+    bool equirectangular = mode == GEOFENCE_DISTANCE_EQUIRECTANGULAR;
+
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8)
+    {
+        __m256i lat = _mm256_loadu_si256((const __m256i *)(lats + i));
+        __m256i lon = _mm256_loadu_si256((const __m256i *)(lons + i));
+
+        __m256 y = _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_sub_epi32(lat, vLat0)), metersPerE7);
+        // Same as lonDelta(): the true difference is above 180 degrees if
+        // the 32-bit one is or if it overflowed to negative, and below -180
+        // the other way round. An overflowed value may also be beyond the
+        // opposite limit, so that comparison only counts when it did not.
+        __m256i d = _mm256_sub_epi32(lon, vLon0);
+        __m256i negative = _mm256_cmpgt_epi32(zero, d);
+        __m256i lonNegative = _mm256_cmpgt_epi32(zero, lon);
+        __m256i overflowUp = _mm256_and_si256(westOfZero, _mm256_andnot_si256(lonNegative, negative));
+        __m256i overflowDown = _mm256_and_si256(eastOfZero, _mm256_andnot_si256(negative, lonNegative));
+        __m256i above = _mm256_or_si256(overflowUp, _mm256_andnot_si256(overflowDown, _mm256_cmpgt_epi32(d, wrapHi)));
+        __m256i below = _mm256_or_si256(overflowDown, _mm256_andnot_si256(overflowUp, _mm256_cmpgt_epi32(wrapLo, d)));
+        d = _mm256_add_epi32(d, _mm256_and_si256(above, wrap));
+        d = _mm256_sub_epi32(d, _mm256_and_si256(below, wrap));
+        __m256 x = _mm256_mul_ps(_mm256_cvtepi32_ps(d), metersPerE7);
+
+        if (equirectangular)
+        {
+            // Latitudes are within +-90 degrees, so their sum fits in an int32
+            __m256 m = _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_add_epi32(lat, vLat0)), halfRadians);
+            __m256 m2 = _mm256_mul_ps(m, m);
+            __m256 c = _mm256_set1_ps(COS_C12);
+            c = _mm256_add_ps(_mm256_mul_ps(c, m2), _mm256_set1_ps(COS_C10));
+            c = _mm256_add_ps(_mm256_mul_ps(c, m2), _mm256_set1_ps(COS_C8));
+            c = _mm256_add_ps(_mm256_mul_ps(c, m2), _mm256_set1_ps(COS_C6));
+            c = _mm256_add_ps(_mm256_mul_ps(c, m2), _mm256_set1_ps(COS_C4));
+            c = _mm256_add_ps(_mm256_mul_ps(c, m2), _mm256_set1_ps(COS_C2));
+            c = _mm256_add_ps(_mm256_mul_ps(c, m2), _mm256_set1_ps(1.0f));
+            x = _mm256_mul_ps(x, c);
+        }
+        else
+        {
+            x = _mm256_mul_ps(x, scale);
+        }
+
+        __m256 d2 = _mm256_add_ps(_mm256_mul_ps(x, x), _mm256_mul_ps(y, y));
+        _mm256_storeu_ps(meters + i, _mm256_sqrt_ps(d2));
+    }
+
+    planeDistancesScalar(mode, lat0, lon0, lonScale, lats + i, lons + i, count - i, meters + i);
+}
+#endif
+
+#if defined(GEOFENCE_DISTANCE_NEON)
+static void planeDistancesNeon(GeofenceDistanceMode mode, int32_t lat0, int32_t lon0, float lonScale,
+                               const int32_t *lats, const int32_t *lons, size_t count, float *meters)
+{
+    const int32x4_t vLat0 = vdupq_n_s32(lat0);
+    const int32x4_t vLon0 = vdupq_n_s32(lon0);
+    const int32x4_t wrapHi = vdupq_n_s32(E7_180), wrapLo = vdupq_n_s32(-E7_180);
+    const int32x4_t wrap = vdupq_n_s32(E7_WRAP);
+    const uint32x4_t westOfZero = vdupq_n_u32(lon0 < 0 ? ~0u : 0);
+    const uint32x4_t eastOfZero = vdupq_n_u32(lon0 > 0 ? ~0u : 0);
+    bool equirectangular = mode == GEOFENCE_DISTANCE_EQUIRECTANGULAR;
+
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4)
+    {
+        int32x4_t lat = vld1q_s32(lats + i);
+        int32x4_t lon = vld1q_s32(lons + i);
+
+        float32x4_t y = vmulq_n_f32(vcvtq_f32_s32(vsubq_s32(lat, vLat0)), METERS_PER_E7);
+        // See planeDistancesAvx2()
+        int32x4_t d = vsubq_s32(lon, vLon0);
+        uint32x4_t negative = vcltzq_s32(d);
+        uint32x4_t lonNegative = vcltzq_s32(lon);
+        uint32x4_t overflowUp = vandq_u32(westOfZero, vbicq_u32(negative, lonNegative));
+        uint32x4_t overflowDown = vandq_u32(eastOfZero, vbicq_u32(lonNegative, negative));
+        uint32x4_t above = vorrq_u32(overflowUp, vbicq_u32(vcgtq_s32(d, wrapHi), overflowDown));
+        uint32x4_t below = vorrq_u32(overflowDown, vbicq_u32(vcltq_s32(d, wrapLo), overflowUp));
+        d = vaddq_s32(d, vandq_s32(vreinterpretq_s32_u32(above), wrap));
+        d = vsubq_s32(d, vandq_s32(vreinterpretq_s32_u32(below), wrap));
+        float32x4_t x = vmulq_n_f32(vcvtq_f32_s32(d), METERS_PER_E7);
+
+        if (equirectangular)
+        {
+            float32x4_t m = vmulq_n_f32(vcvtq_f32_s32(vaddq_s32(lat, vLat0)), (float)(RADIANS_PER_E7 / 2));
+            float32x4_t m2 = vmulq_f32(m, m);
+            float32x4_t c = vdupq_n_f32(COS_C12);
+            c = vmlaq_f32(vdupq_n_f32(COS_C10), c, m2);
+            c = vmlaq_f32(vdupq_n_f32(COS_C8), c, m2);
+            c = vmlaq_f32(vdupq_n_f32(COS_C6), c, m2);
+            c = vmlaq_f32(vdupq_n_f32(COS_C4), c, m2);
+            c = vmlaq_f32(vdupq_n_f32(COS_C2), c, m2);
+            c = vmlaq_f32(vdupq_n_f32(1.0f), c, m2);
+            x = vmulq_f32(x, c);
+        }
+        else
+        {
+            x = vmulq_n_f32(x, lonScale);
+        }
+
+        vst1q_f32(meters + i, vsqrtq_f32(vmlaq_f32(vmulq_f32(y, y), x, x)));
+    }
+
+    planeDistancesScalar(mode, lat0, lon0, lonScale, lats + i, lons + i, count - i, meters + i);
+}
+#endif
+
+void geofenceDistances(GeofenceDistanceMode mode, int32_t lat, int32_t lon,
+                       const int32_t *lats, const int32_t *lons, size_t count, float *meters)
+{
+    if (mode == GEOFENCE_DISTANCE_HAVERSINE)
+    {
+        double lat0 = lat * RADIANS_PER_E7;
+        double cosLat0 = cos(lat0);
+        for (size_t i = 0; i < count; i++)
+        {
+            double lat1 = lats[i] * RADIANS_PER_E7;
+            double halfDLat = sin((lat1 - lat0) / 2);
+            double halfDLon = sin(((int64_t)lons[i] - lon) * (RADIANS_PER_E7 / 2));
+            double h = halfDLat * halfDLat + cosLat0 * cos(lat1) * halfDLon * halfDLon;
+            meters[i] = (float)(2 * GEOFENCE_EARTH_RADIUS_M * asin(sqrt(h < 1 ? h : 1)));
+        }
+        return;
+    }
+
+    float lonScale = (float)cos(lat * RADIANS_PER_E7);
+#if defined(__AVX2__)
+    planeDistancesAvx2(mode, lat, lon, lonScale, lats, lons, count, meters);
+#elif defined(GEOFENCE_DISTANCE_NEON)
+    planeDistancesNeon(mode, lat, lon, lonScale, lats, lons, count, meters);
+#else
+    planeDistancesScalar(mode, lat, lon, lonScale, lats, lons, count, meters);
+#endif
+}
+
+void geofenceCourses(GeofenceDistanceMode mode, int32_t lat, int32_t lon,
+                     const int32_t *lats, const int32_t *lons, size_t count, float *degrees)
+{
+    if (mode == GEOFENCE_DISTANCE_HAVERSINE)
+    {
+        double lat0 = lat * RADIANS_PER_E7;
+        double sinLat0 = sin(lat0), cosLat0 = cos(lat0);
+        for (size_t i = 0; i < count; i++)
+        {
+            double lat1 = lats[i] * RADIANS_PER_E7;
+            double dLon = ((int64_t)lons[i] - lon) * RADIANS_PER_E7;
+            double cosLat1 = cos(lat1);
+            double course = atan2(sin(dLon) * cosLat1, cosLat0 * sin(lat1) - sinLat0 * cosLat1 * cos(dLon));
+            course *= 180 / M_PI;
+            degrees[i] = (float)(course < 0 ? course + 360 : course);
+        }
+        return;
+    }
+
+    float lonScale = (float)cos(lat * RADIANS_PER_E7);
+    for (size_t i = 0; i < count; i++)
+    {
+        float x, y;
+        planeOffsets(mode, lat, lon, lonScale, lats[i], lons[i], x, y);
+        float course = atan2f(x, y) * (float)(180 / M_PI);
+        degrees[i] = course < 0 ? course + 360 : course;
+    }
+}
+
+const char *geofenceDistanceKernel()
+{
+#if defined(__AVX2__)
+    return "avx2";
+#elif defined(GEOFENCE_DISTANCE_NEON)
+    return "neon";
+#else
+    return "scalar";
+#endif
+}
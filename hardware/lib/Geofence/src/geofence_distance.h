@@ -0,0 +1,46 @@
+#ifndef GEOFENCE_DISTANCE_H
+#define GEOFENCE_DISTANCE_H
+
+#include "geofence.h"
+
+// Mean Earth radius, as used by TinyGPSPlus::distanceBetween()
+#define GEOFENCE_EARTH_RADIUS_M 6371009.0
+
+// How geofenceDistances() and geofenceCourses() treat the Earth.
+//
+// HAVERSINE is the great-circle distance on the sphere, in double precision:
+// TinyGPSPlus::distanceBetween() to within float rounding, for any two points.
+//
+// EQUIRECTANGULAR projects each pair onto a plane scaled by the cosine of
+// their mean latitude. Against HAVERSINE, up to 70 degrees of latitude, the
+// relative error stays below 0.001% up to 10 km, 0.03% up to 100 km and 3%
+// up to 1000 km (tools/distance_bench.cpp measures it).
+//
+// LOCAL_PLANE scales by the cosine of the reference latitude only, worked out
+// once per call, so a point costs a few multiplies and a square root. The
+// north-south offset from the reference adds to the error: 0.02% up to 1 km,
+// 0.2% up to 10 km and 2% up to 100 km at 70 degrees (less nearer the
+// equator). This is the approximation GeofenceTracker uses.
+enum GeofenceDistanceMode
+{
+    GEOFENCE_DISTANCE_HAVERSINE,
+    GEOFENCE_DISTANCE_EQUIRECTANGULAR,
+    GEOFENCE_DISTANCE_LOCAL_PLANE
+};
+
+// Distance in metres from (lat, lon) to each of count points. All coordinates
+// are 1e-7 degree. The approximate modes run 8 points per instruction with
+// AVX2, or 4 with NEON, where the host has them.
+void geofenceDistances(GeofenceDistanceMode mode, int32_t lat, int32_t lon,
+                       const int32_t *lats, const int32_t *lons, size_t count, float *meters);
+
+// Initial course in degrees from (lat, lon) to each point, clockwise from
+// north in [0, 360): the great-circle course for HAVERSINE (as
+// TinyGPSPlus::courseTo()), the course on the projected plane otherwise.
+void geofenceCourses(GeofenceDistanceMode mode, int32_t lat, int32_t lon,
+                     const int32_t *lats, const int32_t *lons, size_t count, float *degrees);
+
+// Name of the approximate-mode kernel compiled in ("avx2", "neon" or "scalar")
+const char *geofenceDistanceKernel();
+
+#endif // GEOFENCE_DISTANCE_H
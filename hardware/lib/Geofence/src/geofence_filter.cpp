@@ -0,0 +1,229 @@
+#include "geofence_filter.h"
+
+#include <math.h>
+
+void GeofenceFilter::Axis::start(float position, float variance)
+{
+    p = position;
+    v = 0;
+    pp = variance;
+    pv = 0;
+    // Unknown velocity: anything a road vehicle does
+    vv = 30.0f * 30.0f;
+}
+
+void GeofenceFilter::Axis::predict(float dt, float q)
+{
+    // p += v * dt, with white acceleration noise of variance q
+    float dt2 = dt * dt;
+    p += v * dt;
+    pp += 2 * dt * pv + dt2 * vv + q * dt2 * dt2 / 4;
+    pv += dt * vv + q * dt2 * dt / 2;
+    vv += q * dt2;
+}
+
+void GeofenceFilter::Axis::observePosition(float z, float r)
+{
+    float s = pp + r;
+    float kp = pp / s, kv = pv / s;
+    float y = z - p;
+    p += kp * y;
+    v += kv * y;
+    vv -= kv * pv;
+    pp -= kp * pp;
+    pv -= kp * pv;
+}
+
+void GeofenceFilter::Axis::observeVelocity(float z, float r)
+{
+    float s = vv + r;
+    float kp = pv / s, kv = vv / s;
+    float y = z - v;
+    p += kp * y;
+    v += kv * y;
+    pp -= kp * pv;
+    pv -= kv * pv;
+    vv -= kv * vv;
+}
+
+GeofenceFilter::GeofenceFilter()
+    : rejectedCount(0)
+{
+    reset();
+}
+
+void GeofenceFilter::reset()
+{
+    initialized = false;
+    lastMs = 0;
+    originLat = originLon = 0;
+    metersPerLonE7 = GEOFENCE_METERS_PER_E7;
+    east.start(0, 0);
+    north.start(0, 0);
+    rejectsInRow = 0;
+}
+
+void GeofenceFilter::start(uint32_t ms, int32_t lat, int32_t lon, float r)
+{
+    initialized = true;
+    lastMs = ms;
+    originLat = lat;
+    originLon = lon;
+    metersPerLonE7 = GEOFENCE_METERS_PER_E7 * geofenceCosLat(lat);
+    east.start(0, r);
+    north.start(0, r);
+    rejectsInRow = 0;
+}
+
+bool GeofenceFilter::update(uint32_t ms, int32_t lat, int32_t lon, float hdop, float accuracyM)
+{
+    if (hdop <= 0)
+        hdop = GEOFENCE_FILTER_DEFAULT_HDOP;
+    float sigma = accuracyM > 0 ? accuracyM : hdop * GEOFENCE_FILTER_UERE_M;
+    float r = sigma * sigma;
+
+    if (!initialized || ms - lastMs > GEOFENCE_FILTER_RESET_MS)
+    {
+        start(ms, lat, lon, r);
+        return true;
+    }
+
+    float dt = (ms - lastMs) / 1000.0f;
+    float q = GEOFENCE_FILTER_ACCEL_MPS2 * GEOFENCE_FILTER_ACCEL_MPS2;
+    east.predict(dt, q);
+    north.predict(dt, q);
+    lastMs = ms;
+
+    float x = (float)((int64_t)lon - originLon) * metersPerLonE7;
+    float y = (float)((int64_t)lat - originLat) * GEOFENCE_METERS_PER_E7;
+
+    // Squared distance from the prediction in sigmas
+    float ex = x - east.p, ey = y - north.p;
+    float d2 = ex * ex / east.innovationVariance(r) + ey * ey / north.innovationVariance(r);
+    if (d2 > GEOFENCE_FILTER_GATE_SIGMAS * GEOFENCE_FILTER_GATE_SIGMAS)
+    {
+        rejectedCount++;
+        // Several in a row: the model is wrong, not the fixes
+        if (++rejectsInRow >= GEOFENCE_FILTER_MAX_REJECTS)
+            start(ms, lat, lon, r);
+        return false;
+    }
+    rejectsInRow = 0;
+
+    east.observePosition(x, r);
+    north.observePosition(y, r);
+
+    if (fabsf(east.p) > GEOFENCE_FILTER_REANCHOR_M || fabsf(north.p) > GEOFENCE_FILTER_REANCHOR_M)
+    {
+        originLat = latE7();
+        originLon = lonE7();
+        metersPerLonE7 = GEOFENCE_METERS_PER_E7 * geofenceCosLat(originLat);
+        east.p = north.p = 0;
+    }
+    return true;
+}
+
+void GeofenceFilter::updateVelocity(float speedMps, float courseDeg)
+{
+    if (!initialized)
+        return;
+    float course = courseDeg * (float)(M_PI / 180.0);
+    float r = GEOFENCE_FILTER_SPEED_SIGMA_MPS * GEOFENCE_FILTER_SPEED_SIGMA_MPS;
+    east.observeVelocity(speedMps * sinf(course), r);
+    north.observeVelocity(speedMps * cosf(course), r);
+}
+
+int32_t GeofenceFilter::latE7() const
+{
+    return originLat + (int32_t)lroundf(north.p / GEOFENCE_METERS_PER_E7);
+}
+
+int32_t GeofenceFilter::lonE7() const
+{
+    return originLon + (int32_t)lroundf(east.p / metersPerLonE7);
+}
+
+float GeofenceFilter::speedMps() const
+{
+    return sqrtf(east.v * east.v + north.v * north.v);
+}
+
+float GeofenceFilter::sigmaMeters() const
+{
+    return sqrtf(east.pp > north.pp ? east.pp : north.pp);
+}
+
+GeofenceHysteresis::GeofenceHysteresis()
+    : pendingCount(0), suppressedCount(0)
+{
+}
+
+void GeofenceHysteresis::reset()
+{
+    result.clear();
+    pendingCount = 0;
+}
+
+bool GeofenceHysteresis::accept(const GeofenceSet &zones, uint32_t zone, int32_t lat, int32_t lon, float cosLat,
+                                float margin, Pending *next, uint8_t &nextCount)
+{
+    if (zones.edgeDistanceMeters(zone, lat, lon, cosLat) >= margin)
+        return true;
+
+    // Too close to call: count the evaluations it has been on the new side
+    uint16_t count = 1;
+    for (uint8_t k = 0; k < pendingCount; k++)
+        if (pending[k].zone == zone)
+            count = pending[k].count + 1;
+    if (count >= GEOFENCE_HYSTERESIS_CONFIRM)
+        return true;
+
+    next[nextCount].zone = zone;
+    next[nextCount++].count = count;
+    suppressedCount++;
+    return false;
+}
+
+const GeofenceHits &GeofenceHysteresis::update(const GeofenceSet &zones, const GeofenceHits &current,
+                                               const GeofenceHits &observed, int32_t lat, int32_t lon,
+                                               float sigmaMeters)
+{
+    float margin = GEOFENCE_HYSTERESIS_SIGMAS * sigmaMeters;
+    margin = margin > GEOFENCE_HYSTERESIS_M ? margin : GEOFENCE_HYSTERESIS_M;
+    float cosLat = geofenceCosLat(lat);
+
+    // Same merge as the caller's: zones only in current are exits, zones
+    // only in observed are entries. A transition not accepted keeps the zone
+    // as it was and stays pending for the next evaluation.
+    Pending next[2 * GEOFENCE_MAX_HITS];
+    uint8_t nextCount = 0;
+    result.clear();
+    result.overflow = observed.overflow;
+    uint8_t i = 0, j = 0;
+    while (i < current.count || j < observed.count)
+    {
+        if (j == observed.count || (i < current.count && current.zones[i] < observed.zones[j]))
+        {
+            uint32_t zone = current.zones[i++];
+            bool gone = zone >= zones.size() || zones.isRemoved(zone);
+            if (!gone && !accept(zones, zone, lat, lon, cosLat, margin, next, nextCount))
+                result.add(zone);
+        }
+        else if (i == current.count || observed.zones[j] < current.zones[i])
+        {
+            uint32_t zone = observed.zones[j++];
+            if (accept(zones, zone, lat, lon, cosLat, margin, next, nextCount))
+                result.add(zone);
+        }
+        else
+        {
+            result.add(current.zones[i++]);
+            j++;
+        }
+    }
+
+    for (uint8_t k = 0; k < nextCount; k++)
+        pending[k] = next[k];
+    pendingCount = nextCount;
+    return result;
+}
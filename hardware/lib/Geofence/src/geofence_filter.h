@@ -0,0 +1,137 @@
+#ifndef GEOFENCE_FILTER_H
+#define GEOFENCE_FILTER_H
+
+#include "geofence.h"
+
+// Horizontal error in metres (1 sigma) per unit of HDOP, and the HDOP assumed
+// when the receiver does not report one
+#define GEOFENCE_FILTER_UERE_M 3.0f
+#define GEOFENCE_FILTER_DEFAULT_HDOP 2.0f
+
+// Velocity error (1 sigma) of the receiver's Doppler speed and course
+#define GEOFENCE_FILTER_SPEED_SIGMA_MPS 0.3f
+
+// Random acceleration (1 sigma) the constant-velocity model allows for
+#define GEOFENCE_FILTER_ACCEL_MPS2 1.5f
+
+// A fix further than this many sigmas from the prediction is taken for a
+// multipath jump and skipped; after GEOFENCE_FILTER_MAX_REJECTS in a row the
+// filter starts over from the newest fix, as it does after a gap of
+// GEOFENCE_FILTER_RESET_MS
+#define GEOFENCE_FILTER_GATE_SIGMAS 5.0f
+#define GEOFENCE_FILTER_MAX_REJECTS 3
+#define GEOFENCE_FILTER_RESET_MS 10000
+
+// State is kept in metres from an origin that follows the vehicle, so single
+// precision keeps centimetres
+#define GEOFENCE_FILTER_REANCHOR_M 1000.0f
+
+// Constant-velocity Kalman filter over GNSS fixes.
+// East and north are filtered independently, each with a position and
+// velocity state. Each fix is weighted by the receiver's own accuracy
+// estimate where it reports one, or else by its HDOP, so a poor fix moves the
+// estimate less than a good one, and the receiver's speed and course (when
+// valid) pin the velocity, which keeps a parked vehicle from wandering with
+// the noise. Every fix the receiver produces should go through update(),
+// not only the ones that get evaluated.
+class GeofenceFilter
+{
+public:
+    GeofenceFilter();
+
+    void reset();
+
+    // Add a fix taken at ms (any millisecond clock). hdop <= 0 means unknown.
+    // accuracyM, the receiver's 1 sigma horizontal error, is used instead of
+    // hdop when > 0. Returns false if the fix was rejected as an outlier.
+    bool update(uint32_t ms, int32_t lat, int32_t lon, float hdop, float accuracyM = 0);
+
+    // Add the receiver's velocity for the fix last passed to update()
+    void updateVelocity(float speedMps, float courseDeg);
+
+    bool valid() const { return initialized; }
+
+    // Filtered position, 1e-7 degree
+    int32_t latE7() const;
+    int32_t lonE7() const;
+
+    // Filtered speed in m/s
+    float speedMps() const;
+
+    // Position uncertainty, 1 sigma, along the worse axis
+    float sigmaMeters() const;
+
+    uint32_t rejected() const { return rejectedCount; }
+
+private:
+    // One axis: position p and velocity v, covariance [[pp, pv], [pv, vv]]
+    struct Axis
+    {
+        float p, v;
+        float pp, pv, vv;
+
+        void start(float position, float variance);
+        void predict(float dt, float q);
+        float innovationVariance(float r) const { return pp + r; }
+        void observePosition(float z, float r);
+        void observeVelocity(float z, float r);
+    };
+
+    bool initialized;
+    uint32_t lastMs;
+    int32_t originLat, originLon;
+    float metersPerLonE7;
+    Axis east, north;
+    uint8_t rejectsInRow;
+    uint32_t rejectedCount;
+
+    void start(uint32_t ms, int32_t lat, int32_t lon, float r);
+};
+
+// Entry/exit hysteresis.
+// A zone is only entered once the position is GEOFENCE_HYSTERESIS_M (or
+// GEOFENCE_HYSTERESIS_SIGMAS times its uncertainty, if more) inside its
+// boundary, and only left once that far outside. A vehicle that stays on the
+// other side of the line without getting that far, parked on the kerb that
+// bounds the zone for example, still changes over after
+// GEOFENCE_HYSTERESIS_CONFIRM evaluations in a row.
+#define GEOFENCE_HYSTERESIS_M 4.0f
+#define GEOFENCE_HYSTERESIS_SIGMAS 2.0f
+#define GEOFENCE_HYSTERESIS_CONFIRM 20
+
+class GeofenceHysteresis
+{
+public:
+    GeofenceHysteresis();
+
+    // Forget pending transitions; call whenever the zones are reloaded
+    void reset();
+
+    // The zones the vehicle is in after this fix. current is the membership
+    // after the previous one, observed every zone containing (lat, lon) now,
+    // both in ascending order. A zone in current that no longer exists is
+    // left at once. The reference stays valid until the next update().
+    const GeofenceHits &update(const GeofenceSet &zones, const GeofenceHits &current, const GeofenceHits &observed,
+                               int32_t lat, int32_t lon, float sigmaMeters);
+
+    // Zone changes held back, counted once per evaluation, because the
+    // position was too close to the boundary
+    uint32_t suppressed() const { return suppressedCount; }
+
+private:
+    struct Pending
+    {
+        uint32_t zone;
+        uint16_t count;
+    };
+
+    GeofenceHits result;
+    Pending pending[2 * GEOFENCE_MAX_HITS];
+    uint8_t pendingCount;
+    uint32_t suppressedCount;
+
+    bool accept(const GeofenceSet &zones, uint32_t zone, int32_t lat, int32_t lon, float cosLat, float margin,
+                Pending *next, uint8_t &nextCount);
+};
+
+#endif // GEOFENCE_FILTER_H
@@ -0,0 +1,66 @@
+#ifndef SPSC_QUEUE_H
+#define SPSC_QUEUE_H
+
+#include <atomic>
+#include <stddef.h>
+#include <stdint.h>
+
+// Keeps the producer's and the consumer's index on separate cache lines
+#define SPSC_QUEUE_ALIGN 64
+
+// Fixed-size lock-free queue for exactly one producer and one consumer, for
+// example two tasks on different cores. Each index is written by one side
+// only; the release store of an index publishes the slot it covers, so items
+// need no locking and neither side ever blocks. Capacity must be a power of
+// two; all of it is usable.
+template <typename T, size_t Capacity>
+class SpscQueue
+{
+    static_assert(Capacity >= 2 && (Capacity & (Capacity - 1)) == 0, "capacity must be a power of two");
+
+public:
+    SpscQueue() : head(0), tail(0) {}
+
+    // Producer side. Returns false, leaving the queue alone, if it is full.
+    bool push(const T &item)
+    {
+        size_t t = tail.load(std::memory_order_relaxed);
+        if (t - head.load(std::memory_order_acquire) == Capacity)
+            return false;
+        slots[t & (Capacity - 1)] = item;
+        tail.store(t + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Consumer side. Returns false if there is nothing to take.
+    bool pop(T &item)
+    {
+        size_t h = head.load(std::memory_order_relaxed);
+        if (tail.load(std::memory_order_acquire) == h)
+            return false;
+        item = slots[h & (Capacity - 1)];
+        head.store(h + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Either side; only a snapshot while the other side is running
+    size_t size() const
+    {
+        // head first: tail can only have moved further by the time it is read
+        size_t h = head.load(std::memory_order_acquire);
+        return tail.load(std::memory_order_acquire) - h;
+    }
+    bool empty() const { return size() == 0; }
+    static size_t capacity() { return Capacity; }
+
+private:
+    SpscQueue(const SpscQueue &);
+    SpscQueue &operator=(const SpscQueue &);
+
+    // Free-running counters; only their difference and low bits are used
+    alignas(SPSC_QUEUE_ALIGN) std::atomic<size_t> head; // written by the consumer
+    alignas(SPSC_QUEUE_ALIGN) std::atomic<size_t> tail; // written by the producer
+    T slots[Capacity];
+};
+
+#endif // SPSC_QUEUE_H
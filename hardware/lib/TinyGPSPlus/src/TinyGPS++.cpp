@@ -27,8 +27,77 @@ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
 #include <ctype.h>
 #include <stdlib.h>
 
-#define _RMCterm "RMC"
-#define _GGAterm "GGA"
+// Sentences decoded here, from any of the talkers in _GPS_TALKERS. The slot
+// of each is the sum of its three formatter characters, modulo 8, which the
+// static_asserts below check is collision-free.
+struct SentenceSlot
+{
+  char formatter[4];
+  uint8_t type;
+};
+
+static constexpr uint8_t sentenceSlot(char a, char b, char c)
+{
+  return (uint8_t)((a + b + c) & (_GPS_SENTENCE_SLOTS - 1));
+}
+
+static const SentenceSlot sentenceSlots[_GPS_SENTENCE_SLOTS] =
+{
+  {"GSV", TinyGPSPlus::GPS_SENTENCE_GSV},
+  {"VTG", TinyGPSPlus::GPS_SENTENCE_VTG},
+  {"RMC", TinyGPSPlus::GPS_SENTENCE_RMC},
+  {"GSA", TinyGPSPlus::GPS_SENTENCE_GSA},
+  {"", TinyGPSPlus::GPS_SENTENCE_OTHER},
+  {"", TinyGPSPlus::GPS_SENTENCE_OTHER},
+  {"", TinyGPSPlus::GPS_SENTENCE_OTHER},
+  {"GGA", TinyGPSPlus::GPS_SENTENCE_GGA},
+};
+
+static_assert(sentenceSlot('G', 'S', 'V') == 0, "GSV slot");
+static_assert(sentenceSlot('V', 'T', 'G') == 1, "VTG slot");
+static_assert(sentenceSlot('R', 'M', 'C') == 2, "RMC slot");
+static_assert(sentenceSlot('G', 'S', 'A') == 3, "GSA slot");
+static_assert(sentenceSlot('G', 'G', 'A') == 7, "GGA slot");
+
+// What each term of each known sentence holds, indexed by sentence type and
+// term number
+enum
+{
+  FIELD_NONE, FIELD_TIME, FIELD_RMC_STATUS, FIELD_LAT, FIELD_NS, FIELD_LNG, FIELD_EW,
+  FIELD_SPEED, FIELD_COURSE, FIELD_DATE, FIELD_GGA_QUALITY, FIELD_SATELLITES, FIELD_HDOP,
+  FIELD_ALTITUDE, FIELD_RMC_MODE, FIELD_GSA_FIX_TYPE, FIELD_PDOP, FIELD_VDOP,
+  FIELD_SATELLITES_IN_VIEW, FIELD_VTG_MODE
+};
+
+static const uint8_t termFields[TinyGPSPlus::GPS_SENTENCE_OTHER][_GPS_DISPATCH_TERMS] =
+{
+  // GGA
+  {FIELD_NONE, FIELD_TIME, FIELD_LAT, FIELD_NS, FIELD_LNG, FIELD_EW, FIELD_GGA_QUALITY,
+   FIELD_SATELLITES, FIELD_HDOP, FIELD_ALTITUDE},
+  // RMC
+  {FIELD_NONE, FIELD_TIME, FIELD_RMC_STATUS, FIELD_LAT, FIELD_NS, FIELD_LNG, FIELD_EW,
+   FIELD_SPEED, FIELD_COURSE, FIELD_DATE, FIELD_NONE, FIELD_NONE, FIELD_RMC_MODE},
+  // GSA: mode, fix type, 12 satellite ids, PDOP, HDOP, VDOP
+  {FIELD_NONE, FIELD_NONE, FIELD_GSA_FIX_TYPE, FIELD_NONE, FIELD_NONE, FIELD_NONE, FIELD_NONE,
+   FIELD_NONE, FIELD_NONE, FIELD_NONE, FIELD_NONE, FIELD_NONE, FIELD_NONE, FIELD_NONE, FIELD_NONE,
+   FIELD_PDOP, FIELD_NONE, FIELD_VDOP},
+  // GSV: message count, message number, satellites in view
+  {FIELD_NONE, FIELD_NONE, FIELD_NONE, FIELD_SATELLITES_IN_VIEW},
+  // VTG: true course, T, magnetic course, M, knots, N, km/h, K, mode
+  {FIELD_NONE, FIELD_COURSE, FIELD_NONE, FIELD_NONE, FIELD_NONE, FIELD_SPEED, FIELD_NONE,
+   FIELD_NONE, FIELD_NONE, FIELD_VTG_MODE},
+};
+
+static const char talkers[] = _GPS_TALKERS;
+
+// Bucket of the custom element hash table a sentence name falls in
+static uint8_t customBucket(const char *name)
+{
+  uint8_t hash = 0;
+  while (*name)
+    hash = (uint8_t)(hash * 31 + *name++);
+  return hash & (_GPS_CUSTOM_BUCKETS - 1);
+}
 
 #if !defined(ARDUINO) && !defined(__AVR__)
 // Alternate implementation of millis() that relies on std
@@ -50,14 +119,20 @@ TinyGPSPlus::TinyGPSPlus()
   ,  curTermNumber(0)
   ,  curTermOffset(0)
   ,  sentenceHasFix(false)
-  ,  customElts(0)
+  ,  curTalker(0)
+  ,  newSatellitesInView(0)
+  ,  ubxState(UBX_IDLE)
   ,  customCandidates(0)
+  ,  customEnd(0)
+  ,  customCursor(0)
   ,  encodedCharCount(0)
   ,  sentencesWithFixCount(0)
   ,  failedChecksumCount(0)
   ,  passedChecksumCount(0)
 {
   term[0] = '\0';
+  memset(satellitesInViewByTalker, 0, sizeof(satellitesInViewByTalker));
+  memset(customBuckets, 0, sizeof(customBuckets));
 }
 
 //
@@ -68,6 +143,9 @@ bool TinyGPSPlus::encode(char c)
 {
   ++encodedCharCount;
 
+  if (ubxState != UBX_IDLE)
+    return encodeUbx((uint8_t)c);
+
   switch(c)
   {
   case ',': // term terminators
@@ -75,26 +153,14 @@ bool TinyGPSPlus::encode(char c)
   case '\r':
   case '\n':
   case '*':
-    {
-      bool isValidSentence = false;
-      if (curTermOffset < sizeof(term))
-      {
-        term[curTermOffset] = 0;
-        isValidSentence = endOfTermHandler();
-      }
-      ++curTermNumber;
-      curTermOffset = 0;
-      isChecksumTerm = c == '*';
-      return isValidSentence;
-    }
-    break;
+    return endOfTerm(c);
 
   case '$': // sentence begin
-    curTermNumber = curTermOffset = 0;
-    parity = 0;
-    curSentenceType = GPS_SENTENCE_OTHER;
-    isChecksumTerm = false;
-    sentenceHasFix = false;
+    beginSentence();
+    return false;
+
+  case (char)_GPS_UBX_SYNC1: // UBX frame begin; never part of NMEA text
+    ubxState = UBX_SYNC2;
     return false;
 
   default: // ordinary characters
@@ -108,9 +174,101 @@ bool TinyGPSPlus::encode(char c)
   return false;
 }
 
+// Same result as feeding each character to encode(char), but the ordinary
+// characters of a term are scanned in one tight loop: parity is folded over
+// the whole run and the part that fits is copied into term at once
+size_t TinyGPSPlus::encode(const char *buf, size_t len)
+{
+  const char *p = buf;
+  const char *end = buf + len;
+  size_t sentences = 0;
+
+  encodedCharCount += len;
+
+  while (p < end)
+  {
+    // Binary frames go through the UBX state machine byte by byte
+    if (ubxState != UBX_IDLE)
+    {
+      while (p < end && ubxState != UBX_IDLE)
+        if (encodeUbx((uint8_t)*p++))
+          ++sentences;
+      continue;
+    }
+
+    const char *run = p;
+    uint8_t runParity = 0;
+    // Every delimiter is either at or below ',' or the UBX sync character, so
+    // one unsigned range test passes most characters
+    while (p < end && ((uint8_t)((uint8_t)*p - (',' + 1)) < _GPS_UBX_SYNC1 - (',' + 1) || !isDelimiter(*p)))
+      runParity ^= (uint8_t)*p++;
+
+    size_t runLength = p - run;
+    if (runLength > 0)
+    {
+      size_t room = curTermOffset < sizeof(term) - 1 ? sizeof(term) - 1 - curTermOffset : 0;
+      size_t copied = runLength < room ? runLength : room;
+      memcpy(term + curTermOffset, run, copied);
+      curTermOffset += copied;
+      if (!isChecksumTerm)
+        parity ^= runParity;
+    }
+
+    if (p == end)
+      break;
+
+    char c = *p++;
+    if (c == '$')
+    {
+      beginSentence();
+      continue;
+    }
+    if (c == (char)_GPS_UBX_SYNC1)
+    {
+      ubxState = UBX_SYNC2;
+      continue;
+    }
+    if (c == ',')
+      parity ^= (uint8_t)c;
+    if (endOfTerm(c))
+      ++sentences;
+  }
+
+  return sentences;
+}
+
 //
 // internal utilities
 //
+bool TinyGPSPlus::isDelimiter(char c)
+{
+  return c == ',' || c == '*' || c == '\r' || c == '\n' || c == '$' || c == (char)_GPS_UBX_SYNC1;
+}
+
+void TinyGPSPlus::beginSentence()
+{
+  curTermNumber = curTermOffset = 0;
+  parity = 0;
+  curSentenceType = GPS_SENTENCE_OTHER;
+  isChecksumTerm = false;
+  sentenceHasFix = false;
+}
+
+// Closes the current term on one of the terminators , * \r \n
+bool TinyGPSPlus::endOfTerm(char c)
+{
+  bool isValidSentence = false;
+  if (curTermOffset < sizeof(term))
+  {
+    term[curTermOffset] = 0;
+    isValidSentence = endOfTermHandler();
+  }
+  ++curTermNumber;
+  curTermOffset = 0;
+  isChecksumTerm = c == '*';
+  return isValidSentence;
+}
+
 int TinyGPSPlus::fromHex(char a)
 {
   if (a >= 'A' && a <= 'F')
@@ -163,8 +321,6 @@ void TinyGPSPlus::parseDegrees(const char *term, RawDegrees &deg)
   deg.negative = false;
 }
 
-#define COMBINE(sentence_type, term_number) (((unsigned)(sentence_type) << 5) | term_number)
-
 // Processes a just-completed term
 // Returns true if new sentence has just passed checksum test and is validated
 bool TinyGPSPlus::endOfTermHandler()
@@ -201,10 +357,32 @@ bool TinyGPSPlus::endOfTermHandler()
         satellites.commit();
         hdop.commit();
         break;
+      case GPS_SENTENCE_GSA:
+        pdop.commit();
+        vdop.commit();
+        break;
+      case GPS_SENTENCE_GSV:
+        {
+          // Each constellation reports its own satellites; sum the latest counts
+          satellitesInViewByTalker[curTalker] = newSatellitesInView;
+          uint32_t total = 0;
+          for (uint8_t i = 0; i < sizeof(satellitesInViewByTalker); ++i)
+            total += satellitesInViewByTalker[i];
+          satellitesInView.newval = total;
+          satellitesInView.commit();
+        }
+        break;
+      case GPS_SENTENCE_VTG:
+        if (sentenceHasFix)
+        {
+          speed.commit();
+          course.commit();
+        }
+        break;
       }
 
       // Commit all custom listeners of this sentence type
-      for (TinyGPSCustom *p = customCandidates; p != NULL && strcmp(p->sentenceName, customCandidates->sentenceName) == 0; p = p->next)
+      for (TinyGPSCustom *p = customCandidates; p != customEnd; p = p->next)
          p->commit();
       return true;
     }
@@ -220,83 +398,263 @@ bool TinyGPSPlus::endOfTermHandler()
   // the first term determines the sentence type
   if (curTermNumber == 0)
   {
-    if (term[0] == 'G' && strchr("PNABL", term[1]) != NULL && !strcmp(term + 2, _RMCterm))
-      curSentenceType = GPS_SENTENCE_RMC;
-    else if (term[0] == 'G' && strchr("PNABL", term[1]) != NULL && !strcmp(term + 2, _GGAterm))
-      curSentenceType = GPS_SENTENCE_GGA;
-    else
-      curSentenceType = GPS_SENTENCE_OTHER;
+    curSentenceType = GPS_SENTENCE_OTHER;
+    const char *talker = term[0] == 'G' && term[1] ? strchr(talkers, term[1]) : NULL;
+    if (talker != NULL && term[2] && term[3] && term[4] && !term[5])
+    {
+      const SentenceSlot &slot = sentenceSlots[sentenceSlot(term[2], term[3], term[4])];
+      if (slot.formatter[0] == term[2] && slot.formatter[1] == term[3] && slot.formatter[2] == term[4])
+      {
+        curSentenceType = slot.type;
+        curTalker = (uint8_t)(talker - talkers);
+      }
+    }
 
-    // Any custom candidates of this sentence type?
-    for (customCandidates = customElts; customCandidates != NULL && strcmp(customCandidates->sentenceName, term) < 0; customCandidates = customCandidates->next);
+    // Any custom candidates of this sentence type? Each bucket is sorted by
+    // name, then term number, so they form one run
+    for (customCandidates = customBuckets[customBucket(term)]; customCandidates != NULL && strcmp(customCandidates->sentenceName, term) < 0; customCandidates = customCandidates->next);
     if (customCandidates != NULL && strcmp(customCandidates->sentenceName, term) > 0)
        customCandidates = NULL;
+    for (customEnd = customCandidates; customEnd != NULL && strcmp(customEnd->sentenceName, term) == 0; customEnd = customEnd->next);
+    customCursor = customCandidates;
 
     return false;
   }
 
-  if (curSentenceType != GPS_SENTENCE_OTHER && term[0])
-    switch(COMBINE(curSentenceType, curTermNumber))
+  if (curSentenceType != GPS_SENTENCE_OTHER && term[0] && curTermNumber < _GPS_DISPATCH_TERMS)
+    switch(termFields[curSentenceType][curTermNumber])
   {
-    case COMBINE(GPS_SENTENCE_RMC, 1): // Time in both sentences
-    case COMBINE(GPS_SENTENCE_GGA, 1):
+    case FIELD_TIME:
       time.setTime(term);
       break;
-    case COMBINE(GPS_SENTENCE_RMC, 2): // RMC validity
+    case FIELD_RMC_STATUS: // RMC validity
       sentenceHasFix = term[0] == 'A';
       break;
-    case COMBINE(GPS_SENTENCE_RMC, 3): // Latitude
-    case COMBINE(GPS_SENTENCE_GGA, 2):
+    case FIELD_LAT:
       location.setLatitude(term);
       break;
-    case COMBINE(GPS_SENTENCE_RMC, 4): // N/S
-    case COMBINE(GPS_SENTENCE_GGA, 3):
+    case FIELD_NS:
       location.rawNewLatData.negative = term[0] == 'S';
       break;
-    case COMBINE(GPS_SENTENCE_RMC, 5): // Longitude
-    case COMBINE(GPS_SENTENCE_GGA, 4):
+    case FIELD_LNG:
       location.setLongitude(term);
       break;
-    case COMBINE(GPS_SENTENCE_RMC, 6): // E/W
-    case COMBINE(GPS_SENTENCE_GGA, 5):
+    case FIELD_EW:
       location.rawNewLngData.negative = term[0] == 'W';
       break;
-    case COMBINE(GPS_SENTENCE_RMC, 7): // Speed (RMC)
+    case FIELD_SPEED: // Knots (RMC, VTG)
       speed.set(term);
       break;
-    case COMBINE(GPS_SENTENCE_RMC, 8): // Course (RMC)
+    case FIELD_COURSE: // True course (RMC, VTG)
       course.set(term);
       break;
-    case COMBINE(GPS_SENTENCE_RMC, 9): // Date (RMC)
+    case FIELD_DATE: // Date (RMC)
       date.setDate(term);
       break;
-    case COMBINE(GPS_SENTENCE_GGA, 6): // Fix data (GGA)
+    case FIELD_GGA_QUALITY: // Fix data (GGA)
       sentenceHasFix = term[0] > '0';
       location.newFixQuality = (TinyGPSLocation::Quality)term[0];
       break;
-    case COMBINE(GPS_SENTENCE_GGA, 7): // Satellites used (GGA)
+    case FIELD_SATELLITES: // Satellites used (GGA)
       satellites.set(term);
       break;
-    case COMBINE(GPS_SENTENCE_GGA, 8): // HDOP
+    case FIELD_HDOP:
       hdop.set(term);
       break;
-    case COMBINE(GPS_SENTENCE_GGA, 9): // Altitude (GGA)
+    case FIELD_ALTITUDE: // Altitude (GGA)
       altitude.set(term);
       break;
-    case COMBINE(GPS_SENTENCE_RMC, 12):
+    case FIELD_RMC_MODE:
       location.newFixMode = (TinyGPSLocation::Mode)term[0];
       break;
+    case FIELD_GSA_FIX_TYPE: // 1 none, 2 2D, 3 3D
+      sentenceHasFix = term[0] > '1';
+      break;
+    case FIELD_PDOP:
+      pdop.set(term);
+      break;
+    case FIELD_VDOP:
+      vdop.set(term);
+      break;
+    case FIELD_SATELLITES_IN_VIEW: // This constellation only (GSV)
+      newSatellitesInView = (uint8_t)atoi(term);
+      break;
+    case FIELD_VTG_MODE: // Absent before NMEA 2.3, and then nothing is committed
+      sentenceHasFix = term[0] != 'N';
+      break;
   }
 
-  // Set custom values as needed
-  for (TinyGPSCustom *p = customCandidates; p != NULL && strcmp(p->sentenceName, customCandidates->sentenceName) == 0 && p->termNumber <= curTermNumber; p = p->next)
-    if (p->termNumber == curTermNumber)
-         p->set(term);
+  // Set custom values as needed. The cursor only moves forward, so each
+  // candidate is looked at once per sentence.
+  for (; customCursor != customEnd && customCursor->termNumber <= curTermNumber; customCursor = customCursor->next)
+    if (customCursor->termNumber == curTermNumber)
+      customCursor->set(term);
 
   return false;
 }
 
-/* static */
+static uint16_t ubxU2(const uint8_t *p)
+{
+  return (uint16_t)(p[0] | (p[1] << 8));
+}
+
+static uint32_t ubxU4(const uint8_t *p)
+{
+  return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static void e7ToRawDegrees(int32_t e7, RawDegrees &deg)
+{
+  uint32_t magnitude = e7 < 0 ? 0 - (uint32_t)e7 : (uint32_t)e7;
+  deg.deg = (uint16_t)(magnitude / 10000000UL);
+  deg.billionths = (magnitude % 10000000UL) * 100;
+  deg.negative = e7 < 0;
+}
+
+// One byte of a UBX frame: sync, class, id, 16-bit length, payload and the
+// two Fletcher checksum bytes, which are accumulated as the bytes arrive.
+// Returns true when a frame has passed its checksum.
+bool TinyGPSPlus::encodeUbx(uint8_t c)
+{
+  switch(ubxState)
+  {
+  case UBX_SYNC2:
+    ubxState = c == _GPS_UBX_SYNC2 ? UBX_CLASS : UBX_IDLE;
+    ubxCkA = ubxCkB = 0;
+    return false;
+
+  case UBX_CK_A:
+    ubxState = UBX_CK_B;
+    ubxChecksumOk = c == ubxCkA;
+    return false;
+
+  case UBX_CK_B:
+    ubxState = UBX_IDLE;
+    if (!ubxChecksumOk || c != ubxCkB)
+    {
+      ++failedChecksumCount;
+      return false;
+    }
+    passedChecksumCount++;
+    if (ubxClass == _GPS_UBX_CLASS_NAV && ubxId == _GPS_UBX_ID_NAV_PVT && ubxLength == _GPS_UBX_NAV_PVT_LEN)
+      ubxNavPvt();
+    return true;
+  }
+
+  ubxCkA += c;
+  ubxCkB += ubxCkA;
+
+  switch(ubxState)
+  {
+  case UBX_CLASS:
+    ubxClass = c;
+    ubxState = UBX_ID;
+    break;
+  case UBX_ID:
+    ubxId = c;
+    ubxState = UBX_LENGTH1;
+    break;
+  case UBX_LENGTH1:
+    ubxLength = c;
+    ubxState = UBX_LENGTH2;
+    break;
+  case UBX_LENGTH2:
+    ubxLength |= (uint16_t)c << 8;
+    ubxOffset = 0;
+    ubxState = ubxLength == 0 ? UBX_CK_A : UBX_PAYLOAD;
+    // A corrupt length would swallow up to 64 KB of NMEA
+    if (ubxLength > _GPS_UBX_MAX_LEN)
+    {
+      ++failedChecksumCount;
+      ubxState = UBX_IDLE;
+    }
+    break;
+  case UBX_PAYLOAD:
+    // Only NAV-PVT is kept; everything else is checksummed and dropped
+    if (ubxOffset < sizeof(ubxPayload))
+      ubxPayload[ubxOffset] = c;
+    if (++ubxOffset == ubxLength)
+      ubxState = UBX_CK_A;
+    break;
+  }
+  return false;
+}
+
+// Commits a NAV-PVT solution into the same objects RMC and GGA fill. Every
+// field is an integer in the frame, so nothing is parsed.
+void TinyGPSPlus::ubxNavPvt()
+{
+  const uint8_t *p = ubxPayload;
+  uint8_t valid = p[11];
+  uint8_t fixType = p[20];
+  uint8_t flags = p[21];
+  bool hasFix = (flags & 0x01) && fixType >= 2 && fixType <= 4; // gnssFixOK, 2D, 3D or GNSS+DR
+  bool differential = (flags & 0x02) != 0;
+
+  if (valid & 0x01) // validDate
+  {
+    date.newDate = p[7] * 10000UL + p[6] * 100UL + ubxU2(p + 4) % 100;
+    date.commit();
+  }
+
+  if (valid & 0x02) // validTime
+  {
+    int32_t nano = (int32_t)ubxU4(p + 16);
+    uint32_t centiseconds = nano > 0 ? (uint32_t)nano / 10000000UL : 0;
+    time.newTime = p[8] * 1000000UL + p[9] * 10000UL + p[10] * 100UL + centiseconds;
+    time.commit();
+  }
+
+  satellites.newval = p[23];
+  satellites.commit();
+  pdop.newval = ubxU2(p + 76);
+  pdop.commit();
+
+  if (!hasFix)
+    return;
+
+  ++sentencesWithFixCount;
+  e7ToRawDegrees((int32_t)ubxU4(p + 28), location.rawNewLatData);
+  e7ToRawDegrees((int32_t)ubxU4(p + 24), location.rawNewLngData);
+  location.newFixQuality = differential ? TinyGPSLocation::DGPS : TinyGPSLocation::GPS;
+  location.newFixMode = differential ? TinyGPSLocation::D : TinyGPSLocation::A;
+  location.commit();
+  hAcc.newval = ubxU4(p + 40);
+  hAcc.commit();
+
+  // Ground speed in mm/s to hundredths of a knot (1 knot = 514.444 mm/s)
+  int32_t groundSpeed = (int32_t)ubxU4(p + 60);
+  speed.newval = (int32_t)(((int64_t)groundSpeed * 100000 + 257222) / 514444);
+  speed.commit();
+  course.newval = (int32_t)ubxU4(p + 64) / 1000; // 1e-5 degree to hundredths
+  course.commit();
+  altitude.newval = (int32_t)ubxU4(p + 36) / 10; // hMSL, mm to cm
+  altitude.commit();
+}
+
+// static
+size_t TinyGPSPlus::ubxFrame(uint8_t msgClass, uint8_t msgId, const uint8_t *payload, uint16_t len, uint8_t *out)
+{
+  out[0] = _GPS_UBX_SYNC1;
+  out[1] = _GPS_UBX_SYNC2;
+  out[2] = msgClass;
+  out[3] = msgId;
+  out[4] = (uint8_t)len;
+  out[5] = (uint8_t)(len >> 8);
+  if (len > 0)
+    memcpy(out + 6, payload, len);
+
+  uint8_t ckA = 0, ckB = 0;
+  for (size_t i = 2; i < 6 + (size_t)len; ++i)
+  {
+    ckA += out[i];
+    ckB += ckA;
+  }
+  out[6 + len] = ckA;
+  out[7 + len] = ckB;
+  return len + 8;
+}
+
 double TinyGPSPlus::distanceBetween(double lat1, double long1, double lat2, double long2)
 {
   // returns distance in meters between two positions, both specified
@@ -508,7 +866,7 @@ void TinyGPSPlus::insertCustom(TinyGPSCustom *pElt, const char *sentenceName, in
 {
    TinyGPSCustom **ppelt;
 
-   for (ppelt = &this->customElts; *ppelt != NULL; ppelt = &(*ppelt)->next)
+   for (ppelt = &this->customBuckets[customBucket(sentenceName)]; *ppelt != NULL; ppelt = &(*ppelt)->next)
    {
       int cmp = strcmp(sentenceName, (*ppelt)->sentenceName);
       if (cmp < 0 || (cmp == 0 && termNumber < (*ppelt)->termNumber))
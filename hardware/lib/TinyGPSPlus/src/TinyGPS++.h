@@ -39,6 +39,16 @@ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
 #define _GPS_FEET_PER_METER 3.2808399
 #define _GPS_MAX_FIELD_SIZE 15
 #define _GPS_EARTH_MEAN_RADIUS 6371009 // old: 6372795
+#define _GPS_TALKERS "PNABL" // GP, GN, GA, GB and GL sentences are decoded alike
+#define _GPS_SENTENCE_SLOTS 8 // perfect hash table of the decoded sentence types
+#define _GPS_DISPATCH_TERMS 18 // terms per sentence looked up in the dispatch table
+#define _GPS_CUSTOM_BUCKETS 16 // hash buckets for TinyGPSCustom sentence names
+#define _GPS_UBX_SYNC1 0xB5
+#define _GPS_UBX_SYNC2 0x62
+#define _GPS_UBX_CLASS_NAV 0x01
+#define _GPS_UBX_ID_NAV_PVT 0x07
+#define _GPS_UBX_NAV_PVT_LEN 92
+#define _GPS_UBX_MAX_LEN 1024 // longer UBX frames are taken to be corrupt
 
 struct RawDegrees
 {
@@ -228,6 +238,10 @@ class TinyGPSPlus
 public:
   TinyGPSPlus();
   bool encode(char c); // process one character received from GPS
+  size_t encode(const char *buf, size_t len); // process a block, returns the number of valid sentences in it
+  // UBX frames (u-blox binary) may be mixed with NMEA in the same stream.
+  // NAV-PVT fills location, date, time, speed, course, altitude, satellites,
+  // pdop and hAcc; other frames are only checksummed and counted.
   TinyGPSPlus &operator << (char c) {encode(c); return *this;}
 
   TinyGPSLocation location;
@@ -238,6 +252,10 @@ public:
   TinyGPSAltitude altitude;
   TinyGPSInteger satellites;
   TinyGPSHDOP hdop;
+  TinyGPSDecimal pdop; // hundredths, from GSA or NAV-PVT
+  TinyGPSDecimal vdop;
+  TinyGPSInteger satellitesInView; // from GSV, summed over constellations
+  TinyGPSInteger hAcc; // horizontal accuracy estimate in mm, from NAV-PVT
 
   static const char *libraryVersion() { return _GPS_VERSION; }
 
@@ -245,6 +263,10 @@ public:
   static double courseTo(double lat1, double long1, double lat2, double long2);
   static const char *cardinal(double course);
 
+  // Builds a UBX frame, for example to configure the receiver; out needs
+  // len + 8 bytes. Returns the frame length.
+  static size_t ubxFrame(uint8_t msgClass, uint8_t msgId, const uint8_t *payload, uint16_t len, uint8_t *out);
+
   static int32_t parseDecimal(const char *term);
   static void parseDegrees(const char *term, RawDegrees &deg);
 
@@ -253,8 +275,9 @@ public:
   uint32_t failedChecksum()   const { return failedChecksumCount; }
   uint32_t passedChecksum()   const { return passedChecksumCount; }
 
+  enum {GPS_SENTENCE_GGA, GPS_SENTENCE_RMC, GPS_SENTENCE_GSA, GPS_SENTENCE_GSV, GPS_SENTENCE_VTG, GPS_SENTENCE_OTHER};
+
 private:
-  enum {GPS_SENTENCE_GGA, GPS_SENTENCE_RMC, GPS_SENTENCE_OTHER};
 
   // parsing state variables
   uint8_t parity;
@@ -264,11 +287,25 @@ private:
   uint8_t curTermNumber;
   uint8_t curTermOffset;
   bool sentenceHasFix;
+  uint8_t curTalker; // index into _GPS_TALKERS
+  uint8_t newSatellitesInView;
+  uint8_t satellitesInViewByTalker[sizeof(_GPS_TALKERS) - 1];
+
+  // UBX frame state
+  enum {UBX_IDLE, UBX_SYNC2, UBX_CLASS, UBX_ID, UBX_LENGTH1, UBX_LENGTH2, UBX_PAYLOAD, UBX_CK_A, UBX_CK_B};
+  uint8_t ubxState;
+  uint8_t ubxClass, ubxId;
+  uint16_t ubxLength, ubxOffset;
+  uint8_t ubxCkA, ubxCkB;
+  bool ubxChecksumOk;
+  uint8_t ubxPayload[_GPS_UBX_NAV_PVT_LEN];
 
   // custom element support
   friend class TinyGPSCustom;
-  TinyGPSCustom *customElts;
-  TinyGPSCustom *customCandidates;
+  TinyGPSCustom *customBuckets[_GPS_CUSTOM_BUCKETS];
+  TinyGPSCustom *customCandidates; // first custom element of the current sentence
+  TinyGPSCustom *customEnd;        // one past its last
+  TinyGPSCustom *customCursor;     // next one still to be set
   void insertCustom(TinyGPSCustom *pElt, const char *sentenceName, int index);
 
   // statistics
@@ -279,7 +316,12 @@ private:
 
   // internal utilities
   int fromHex(char a);
+  static bool isDelimiter(char c);
+  void beginSentence();
+  bool endOfTerm(char c);
   bool endOfTermHandler();
+  bool encodeUbx(uint8_t c);
+  void ubxNavPvt();
 };
 
 #endif // def(__TinyGPSPlus_h)
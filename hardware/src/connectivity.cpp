@@ -0,0 +1,95 @@
+#include "connectivity.h"
+
+// Arduino-ESP32 2.x renamed the WiFi events
+#if defined(ESP_ARDUINO_VERSION_MAJOR) && ESP_ARDUINO_VERSION_MAJOR >= 2
+#define CONNECTIVITY_EVENT_GOT_IP ARDUINO_EVENT_WIFI_STA_GOT_IP
+#define CONNECTIVITY_EVENT_DISCONNECTED ARDUINO_EVENT_WIFI_STA_DISCONNECTED
+#else
+#define CONNECTIVITY_EVENT_GOT_IP SYSTEM_EVENT_STA_GOT_IP
+#define CONNECTIVITY_EVENT_DISCONNECTED SYSTEM_EVENT_STA_DISCONNECTED
+#endif
+
+Connectivity::Connectivity(const char *ssid, const char *password)
+    : ssid(ssid), password(password), state(WAITING), backoffMs(CONNECTIVITY_BACKOFF_MIN_MS), nextAttemptMs(0),
+      attemptMs(0), downSinceMs(0), attemptCount(0), reconnectCount(0), onlineCallback(NULL),
+      offlineCallback(NULL), gotIp(false), lostLink(false)
+{
+}
+
+void Connectivity::begin()
+{
+    WiFi.mode(WIFI_STA);
+    WiFi.setAutoReconnect(false);
+    WiFi.onEvent([this](WiFiEvent_t, WiFiEventInfo_t) { gotIp = true; }, CONNECTIVITY_EVENT_GOT_IP);
+    WiFi.onEvent([this](WiFiEvent_t, WiFiEventInfo_t) { lostLink = true; }, CONNECTIVITY_EVENT_DISCONNECTED);
+    downSinceMs = millis();
+    startAttempt();
+}
+
+void Connectivity::startAttempt()
+{
+    gotIp = false;
+    lostLink = false;
+    WiFi.begin(ssid, password);
+    attemptMs = millis();
+    attemptCount++;
+    state = CONNECTING;
+}
+
+void Connectivity::backOff()
+{
+    WiFi.disconnect();
+    long jitter = (long)(backoffMs * CONNECTIVITY_JITTER_PERCENT / 100);
+    nextAttemptMs = millis() + backoffMs + random(-jitter, jitter + 1);
+    backoffMs = backoffMs * 2 > CONNECTIVITY_BACKOFF_MAX_MS ? CONNECTIVITY_BACKOFF_MAX_MS : backoffMs * 2;
+    state = WAITING;
+}
+
+void Connectivity::poll()
+{
+    switch (state)
+    {
+    case ONLINE:
+        if (lostLink || WiFi.status() != WL_CONNECTED)
+        {
+            Serial.println("WiFi lost");
+            downSinceMs = millis();
+            backoffMs = CONNECTIVITY_BACKOFF_MIN_MS;
+            backOff();
+            if (offlineCallback)
+                offlineCallback();
+        }
+        break;
+
+    case CONNECTING:
+        if (gotIp || WiFi.status() == WL_CONNECTED)
+        {
+            state = ONLINE;
+            lostLink = false;
+            backoffMs = CONNECTIVITY_BACKOFF_MIN_MS;
+            reconnectCount++;
+            Serial.printf("WiFi connected after %lu ms offline, %u attempts so far\n", millis() - downSinceMs,
+                          (unsigned)attemptCount);
+            if (onlineCallback)
+                onlineCallback();
+        }
+        else if (lostLink || millis() - attemptMs >= CONNECTIVITY_ATTEMPT_MS)
+        {
+            // A wrong password or a missing AP is reported as a disconnect
+            // right away; otherwise the attempt times out
+            backOff();
+            Serial.printf("WiFi attempt failed, next in %lu ms\n", nextAttemptMs - millis());
+        }
+        break;
+
+    case WAITING:
+        if ((long)(millis() - nextAttemptMs) >= 0)
+            startAttempt();
+        break;
+    }
+}
+
+unsigned long Connectivity::offlineMs() const
+{
+    return state == ONLINE ? 0 : millis() - downSinceMs;
+}
@@ -0,0 +1,121 @@
+#include "gps_ingest.h"
+#include "geofence.h"
+
+// TinyGPS++ keeps whole degrees plus billionths; convert to 1e-7 degree units
+static int32_t rawDegreesToE7(const RawDegrees &raw)
+{
+    int32_t e7 = (int32_t)raw.deg * GEOFENCE_E7 + (int32_t)((raw.billionths + 50) / 100);
+    return raw.negative ? -e7 : e7;
+}
+
+// GPS clock as seconds since 2000-01-01 UTC, or 0 while date or time is invalid
+static uint32_t gpsSeconds(TinyGPSPlus &gps)
+{
+    if (!gps.date.isValid() || !gps.time.isValid() || gps.date.year() <= 2000)
+        return 0;
+
+    // Days since 2000-01-01: count whole years from 2000-03-01 so the leap day
+    // ends a year, then add the 60 days of January and February 2000
+    int month = gps.date.month();
+    uint32_t year = gps.date.year() - 2000 - (month <= 2);
+    uint32_t dayOfYear = (153 * ((month + 9) % 12) + 2) / 5 + gps.date.day() - 1;
+    uint32_t days = year * 365 + year / 4 - year / 100 + year / 400 + dayOfYear + 60;
+    return days * 86400 + gps.time.hour() * 3600 + gps.time.minute() * 60 + gps.time.second();
+}
+
+GpsIngest::GpsIngest(HardwareSerial &serial)
+    : serial(serial), task(NULL), lastTime(UINT32_MAX), droppedCount(0), charsCount(0), failedCount(0)
+{
+}
+
+bool GpsIngest::begin(unsigned long baud, int rxPin, int txPin)
+{
+    // The receive buffer size only takes effect before begin()
+    serial.setRxBufferSize(GPS_INGEST_RX_BUFFER);
+    serial.begin(baud, SERIAL_8N1, rxPin, txPin);
+    return xTaskCreatePinnedToCore(taskEntry, "gps_ingest", GPS_INGEST_STACK, this, GPS_INGEST_PRIORITY,
+                                   &task, GPS_INGEST_CORE) == pdPASS;
+}
+
+void GpsIngest::configureUbx(uint16_t rateMs)
+{
+    uint8_t frame[16];
+
+    // CFG-MSG (class, id, rate on this port): NAV-PVT on, GGA, GLL, GSA, GSV,
+    // RMC and VTG off
+    static const uint8_t messages[][3] = {
+        {0x01, 0x07, 1}, {0xF0, 0x00, 0}, {0xF0, 0x01, 0}, {0xF0, 0x02, 0},
+        {0xF0, 0x03, 0}, {0xF0, 0x04, 0}, {0xF0, 0x05, 0},
+    };
+    for (size_t i = 0; i < sizeof(messages) / sizeof(messages[0]); i++)
+        serial.write(frame, TinyGPSPlus::ubxFrame(0x06, 0x01, messages[i], sizeof(messages[i]), frame));
+
+    // CFG-RATE: measurement period, one solution per measurement, GPS time
+    uint8_t rate[6] = {(uint8_t)rateMs, (uint8_t)(rateMs >> 8), 1, 0, 1, 0};
+    serial.write(frame, TinyGPSPlus::ubxFrame(0x06, 0x08, rate, sizeof(rate), frame));
+    serial.flush();
+}
+
+void GpsIngest::taskEntry(void *arg)
+{
+    static_cast<GpsIngest *>(arg)->run();
+}
+
+void GpsIngest::run()
+{
+    char buffer[GPS_INGEST_BLOCK];
+    for (;;)
+    {
+        int pending = serial.available();
+        if (pending <= 0)
+        {
+            vTaskDelay(pdMS_TO_TICKS(GPS_INGEST_POLL_MS));
+            continue;
+        }
+
+        size_t count = serial.readBytes(buffer, min(pending, GPS_INGEST_BLOCK));
+        if (gps.encode(buffer, count) > 0 && gps.location.isUpdated() && gps.location.isValid())
+            publish();
+        charsCount = gps.charsProcessed();
+        failedCount = gps.failedChecksum();
+    }
+}
+
+// With NMEA, RMC and GGA both carry the position, so each epoch commits it
+// twice; only the first commit of a new receiver time is published. Receivers
+// send RMC first, so hdop and satellites (from GGA) are those of the previous
+// epoch. NAV-PVT commits each epoch once, with satellites and the accuracy
+// estimate from the same solution, and no hdop.
+void GpsIngest::publish()
+{
+    GpsFix fix;
+    fix.latE7 = rawDegreesToE7(gps.location.rawLat());
+    fix.lonE7 = rawDegreesToE7(gps.location.rawLng());
+
+    uint32_t time = gps.time.isValid() ? gps.time.value() : UINT32_MAX;
+    if (time != UINT32_MAX && time == lastTime)
+        return;
+    lastTime = time;
+
+    fix.dateTimeValid = gps.date.isValid() && gps.time.isValid();
+    fix.year = gps.date.year();
+    fix.month = gps.date.month();
+    fix.day = gps.date.day();
+    fix.hour = gps.time.hour();
+    fix.minute = gps.time.minute();
+    fix.second = gps.time.second();
+    fix.centisecond = gps.time.centisecond();
+    fix.seconds = gpsSeconds(gps);
+    fix.speedValid = gps.speed.isValid();
+    fix.speedMps = gps.speed.mps();
+    fix.courseValid = gps.course.isValid();
+    fix.courseDeg = gps.course.deg();
+    fix.hdopValid = gps.hdop.isValid();
+    fix.hdop = gps.hdop.value();
+    fix.accuracyM = gps.hAcc.isValid() ? gps.hAcc.value() / 1000.0f : 0;
+    fix.satellites = gps.satellites.isValid() ? gps.satellites.value() : 0;
+    fix.receivedMs = millis();
+
+    if (!fixes.push(fix))
+        droppedCount = droppedCount + 1;
+}
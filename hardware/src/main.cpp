@@ -1,8 +1,15 @@
 #include <Arduino.h>
-#include <TinyGPS++.h>
 #include <ArduinoJson.h>
 #include <WiFi.h>
 #include <Firebase_ESP_Client.h>
+#include "connectivity.h"
+#include "geofence.h"
+#include "geofence_filter.h"
+#include "gps_ingest.h"
+#include "session_pool.h"
+#include "telemetry_journal.h"
+#include "track_upload.h"
+#include "zone_sync.h"
 
 // Firebase credentials
 #define WIFI_SSID "Hari Ram"
@@ -13,13 +20,31 @@
 #define USER_PASSWORD "123456"
 #define DATABASE_URL "https://gnss-trafficviolationdetection-default-rtdb.firebaseio.com/"
 
+// Hosts behind DATABASE_URL, Firestore and Storage; each keeps its own session
+#define RTDB_HOST "gnss-trafficviolationdetection-default-rtdb.firebaseio.com"
+#define FIRESTORE_HOST "firestore.googleapis.com"
+#define STORAGE_HOST "firebasestorage.googleapis.com"
+
 // Firestore Collection Paths
 #define GEOFENCE_ENTRIES_COLLECTION "geofence_entries"
 #define VIOLATION_COLLECTION "violation_details"
 #define NO_PARKING_COLLECTION "no_parking"
 
+// RTDB nodes holding every vehicle's track and zone events
+#define TRACK_ROOT "tracks"
+#define EVENT_ROOT "zone_events"
+
+// Upper bound on each Firebase connect and on each wait for a response, so
+// a poor link cannot hold up the next fix for long
+#define FIREBASE_TIMEOUT_MS 5000
+
 // Firebase Objects
-FirebaseData fbdo;
+SessionPool sessions; // One warm connection per host instead of a shared FirebaseData
+TlsSessionCache tlsSessions; // TLS sessions per host, so reconnects resume
+// Comment out to keep the TLS sessions in RAM only; the file holds their
+// master secrets (see tls_session_cache.h)
+#define TLS_SESSION_CACHE_PATH "/tls_sessions.bin"
+MB_FS tlsCacheFs;
 FirebaseAuth auth;
 FirebaseConfig config;
 
@@ -27,110 +52,213 @@ FirebaseConfig config;
 #define RX_PIN 16 // GPS TX → ESP RX
 #define TX_PIN 17 // GPS RX → ESP TX
 #define BAUD_RATE 9600
+// Uncomment for a u-blox 7 or M8 receiver: binary NAV-PVT solutions at 5 Hz
+// instead of NMEA at 1 Hz, on the same 9600 baud link
+// #define GPS_UBX_RATE_MS 200
 
-TinyGPSPlus gps;
 HardwareSerial gpsSerial(1); // UART1 for GPS
+GpsIngest gpsIngest(gpsSerial); // Parses NMEA on the other core
 
 // Store no-parking zones
-struct Geofence
+GeofenceSet geofences;
+GeofenceIndex geofenceIndex;     // Maintained by zoneSync
+GeofenceTracker geofenceTracker; // Skips re-evaluation while far from any boundary
+GeofenceFilter positionFilter;   // Smooths every fix, weighted by its accuracy
+GeofenceHysteresis geofenceHysteresis; // One entry and one exit per real crossing
+ZoneSync zoneSync(FIREBASE_PROJECT_ID, NO_PARKING_COLLECTION, geofences, geofenceIndex); // Only refetches changed zones
+MB_FS zoneCacheFs;
+#define GEOFENCE_CACHE_PATH "/geofences.bin" // Zone set saved across reboots
+MB_FS journalFs;
+#define JOURNAL_PATH "/journal" // Fixes and zone events not uploaded yet
+TelemetryJournal journal(journalFs, JOURNAL_PATH);
+
+// Uncomment to load zones compiled offline (tools/zone_compiler.cpp) from
+// Firebase Storage instead of the no_parking collection
+// #define GEOFENCE_BLOB_BUCKET "gnss-trafficviolationdetection.appspot.com"
+// #define GEOFENCE_BLOB_OBJECT "geofences.bin"
+
+// Store last known status: every zone the vehicle is currently in, sorted by
+// zone id. Strings are only written on entry, not on every fix. The zone logic
+// only marks which Firestore records a stay needs; writeGeofenceRecords()
+// writes them while the link is up and keeps any that fail for later.
+struct ActiveGeofence
 {
-    double c1_lat, c1_lon, c2_lat, c2_lon, c3_lat, c3_lon, c4_lat, c4_lon;
+    uint32_t zone;
     String name;
+    String entryDateTime;
+    String exitDateTime;      // Set on exit
+    String entryDocument;     // geofence_entries/<id>, named at the first attempt to write it; empty before
+    String violationDocument; // violations/VID_<id>, named when the dwell limit passes; empty before
+    int32_t entryLat, entryLon;
+    uint32_t entrySeconds;    // GPS clock at entry (GpsFix::seconds), 0 until the clock is valid
+    bool entryPending;        // Entry record not written yet
+    bool violated;            // Dwell limit passed and the violation event recorded
+    bool violationPending;    // Violated, but the violation record not written yet
 };
-std::vector<Geofence> geofences;
-
-// Store last known status
-bool insideGeofence = false;
-String activeGeofence = "";
-String entryDateTime = "";
+ActiveGeofence activeGeofences[GEOFENCE_MAX_HITS];
+size_t activeGeofenceCount = 0;
+#define GEOFENCE_PENDING_EXITS 16
+ActiveGeofence pendingExits[GEOFENCE_PENDING_EXITS]; // Stays that ended with records still to write, oldest first
+size_t pendingExitCount = 0;
+#define GEOFENCE_RECORD_RETRY_MS 5000 // Wait after a failed Firestore write
+unsigned long lastRecordFailTime = 0;
+bool recordFailed = false;
 String vehicleNo = "TN19S4105";
 unsigned long lastFetchTime = 0;            // Store last fetch time globally
 const unsigned long fetchInterval = 300000; // 5 minutes in milliseconds
+bool geofencesFetched = false;              // Fetch attempted since boot
+Connectivity connectivity(WIFI_SSID, WIFI_PASSWORD); // WiFi with backoff, never blocks loop()
+
+// Adaptive sampling: fixes are evaluated and uploaded only as often as the
+// distance to the nearest zone boundary and the speed require
+#define SAMPLE_MIN_MS 1000        // GPS fix rate; used inside zones and near edges
+#define SAMPLE_MAX_MS 30000       // Longest gap between evaluations
+#define STATIONARY_MPS 0.5f
+#define GPS_POLL_MS 20        // loop() period
+#define GPS_FIX_TIMEOUT_MS 3000 // No fix for this long is reported as no fix
+unsigned long lastSampleTime = 0;
+unsigned long sampleInterval = 0;
+
+// Deadband on the /gps_data updates: a position is only sent once the vehicle
+// has moved or turned enough since the last one sent, or that one is too old
+#define UPLOAD_DEADBAND_M 10.0f
+#define UPLOAD_DEADBAND_DEG 20.0f     // Heading change, only while moving
+#define UPLOAD_MAX_INTERVAL_MS 60000 // Position refresh while nothing changes
+unsigned long lastUploadTime = 0;
+int32_t lastUploadLat = 0, lastUploadLon = 0;
+float lastUploadCourse = 0;
+bool uploadedOnce = false;
+uint32_t uploadsSent = 0;       // /gps_data updates made
+uint32_t uploadsSuppressed = 0; // Evaluated fixes held back by the deadband
+TrackUpload trackUpload(journal, TRACK_ROOT, EVENT_ROOT); // Full track and zone events, through flash, in batches with /gps_data
+unsigned long lastNoFixLog = 0;
+GpsFix lastFix;           // Newest fix taken from gpsIngest
+bool fixPending = false;  // lastFix not evaluated yet
+bool haveFix = false;     // At least one fix received
+uint32_t droppedFixesLogged = 0;
 
 void fetchGeofences(); // Declare function before setup()
+void geofencesChanged();
+void connectivityRestored();
+void connectivityLost();
 
 void setup()
 {
     Serial.begin(57600);
-    gpsSerial.begin(BAUD_RATE, SERIAL_8N1, RX_PIN, TX_PIN);
-
-    // Connect to WiFi
-    WiFi.begin(WIFI_SSID, WIFI_PASSWORD);
-    Serial.print("Connecting to WiFi...");
-    while (WiFi.status() != WL_CONNECTED)
-    {
-        Serial.print(".");
-        delay(1000);
-    }
-    Serial.println("\nConnected to WiFi!");
-
-    // Configure Firebase
+    if (!gpsIngest.begin(BAUD_RATE, RX_PIN, TX_PIN))
+        Serial.println("Failed to start GPS task");
+#if defined(GPS_UBX_RATE_MS)
+    gpsIngest.configureUbx(GPS_UBX_RATE_MS);
+#endif
+
+    // Zones from the last run are usable before WiFi is up; the first
+    // fetchGeofences() once it is only revalidates them
+    zoneSync.useCache(zoneCacheFs, GEOFENCE_CACHE_PATH);
+    if (zoneSync.loadCache())
+        geofencesChanged();
+
+    // Whatever was recorded but not uploaded before the reset goes up first
+    journal.begin();
+    if (journal.pending() > 0)
+        Serial.printf("Journal: %u records from the last run to upload\n", (unsigned)journal.pending());
+
+    // Configure Firebase; signing in waits for the first connection
     config.api_key = API_KEY;
     config.database_url = DATABASE_URL;
+    config.timeout.socketConnection = FIREBASE_TIMEOUT_MS;
+    config.timeout.serverResponse = FIREBASE_TIMEOUT_MS;
     auth.user.email = USER_EMAIL;
     auth.user.password = USER_PASSWORD;
 
     Firebase.begin(&config, &auth);
-    Firebase.reconnectWiFi(true);
-    Serial.println("\nAuthentication successful!");
+    Firebase.reconnectWiFi(false); // connectivity does the reconnecting
+#if defined(TLS_SESSION_CACHE_PATH)
+    tlsSessions.persistTo(tlsCacheFs, TLS_SESSION_CACHE_PATH);
+    tlsSessions.load();
+#endif
+    sessions.useTlsCache(tlsSessions);
+
+    // Connect to WiFi in the background; loop() runs from the start and the
+    // zones are fetched once the link is up
+    connectivity.onOnline(connectivityRestored);
+    connectivity.onOffline(connectivityLost);
+    connectivity.begin();
+    Serial.println("Connecting to WiFi...");
+}
 
-    fetchGeofences();
+// Sockets do not survive the link going down; drop them now rather than on
+// the first request after it is back
+void connectivityLost()
+{
+    sessions.closeAll();
 }
 
-void parseCoordinates(String coord, double &lat, double &lon)
+// The link is back: fetch the zones if that never happened, and let the
+// journal backlog and the zone records go up straight away instead of after
+// the retry wait
+void connectivityRestored()
 {
-    int commaIndex = coord.indexOf(',');
-    if (commaIndex != -1)
-    {
-        lat = coord.substring(0, commaIndex).toDouble();
-        lon = coord.substring(commaIndex + 1).toDouble();
-    }
+    if (!geofencesFetched)
+        lastFetchTime = millis() - fetchInterval;
+    trackUpload.resume();
+    recordFailed = false;
 }
 
-void fetchGeofences()
+// Zone ids change when the set is reloaded or compacted; find the active zones
+// again by name. Zones that disappeared get an id no fix can match, so the next
+// checkGeofence() reports them as exited.
+void remapActiveGeofences()
 {
-    Serial.println("Fetching geofences from Firestore...");
-    String query = String(NO_PARKING_COLLECTION);
-    if (Firebase.Firestore.getDocument(&fbdo, FIREBASE_PROJECT_ID, "", query.c_str()))
+    for (size_t i = 0; i < activeGeofenceCount; i++)
     {
-        DynamicJsonDocument doc(8192);
-        deserializeJson(doc, fbdo.payload().c_str());
-        JsonArray documents = doc["documents"].as<JsonArray>();
-
-        geofences.clear();
-        for (JsonObject document : documents)
+        ActiveGeofence &active = activeGeofences[i];
+        active.zone = UINT32_MAX;
+        for (uint32_t zone = 0; zone < geofences.size(); zone++)
         {
-            JsonObject fields = document["fields"];
-            Geofence gf;
-            parseCoordinates(fields["c1"]["stringValue"].as<String>(), gf.c1_lat, gf.c1_lon);
-            parseCoordinates(fields["c2"]["stringValue"].as<String>(), gf.c2_lat, gf.c2_lon);
-            parseCoordinates(fields["c3"]["stringValue"].as<String>(), gf.c3_lat, gf.c3_lon);
-            parseCoordinates(fields["c4"]["stringValue"].as<String>(), gf.c4_lat, gf.c4_lon);
-            gf.name = fields["name"]["stringValue"].as<String>();
-            geofences.push_back(gf);
-
-            Serial.printf("Geofence: %s, c1: %.6f, %.6f\n", gf.name.c_str(), gf.c1_lat, gf.c1_lon);
-            Serial.printf("Geofence: %s, c2: %.6f, %.6f\n", gf.name.c_str(), gf.c2_lat, gf.c2_lon);
-            Serial.printf("Geofence: %s, c3: %.6f, %.6f\n", gf.name.c_str(), gf.c3_lat, gf.c3_lon);
-            Serial.printf("Geofence: %s, c4: %.6f, %.6f\n", gf.name.c_str(), gf.c4_lat, gf.c4_lon);
+            if (!geofences.isRemoved(zone) && geofences.name(zone) == active.name.c_str())
+            {
+                active.zone = zone;
+                break;
+            }
         }
-        Serial.println("Geofences updated!");
-    }
-    else
-    {
-        Serial.println("Failed to retrieve geofences: " + fbdo.errorReason());
     }
+
+    // Restore ascending id order
+    for (size_t i = 1; i < activeGeofenceCount; i++)
+        for (size_t j = i; j > 0 && activeGeofences[j - 1].zone > activeGeofences[j].zone; j--)
+            std::swap(activeGeofences[j - 1], activeGeofences[j]);
+}
+
+void fetchGeofences()
+{
+#if defined(GEOFENCE_BLOB_BUCKET)
+    bool changed = zoneSync.syncCompiled(sessions.get(STORAGE_HOST), GEOFENCE_BLOB_BUCKET, GEOFENCE_BLOB_OBJECT);
+#else
+    bool changed = zoneSync.sync(sessions.get(FIRESTORE_HOST));
+#endif
+    if (changed)
+        geofencesChanged();
+}
+
+// ZoneSync has replaced the zones and their index
+void geofencesChanged()
+{
+    geofenceTracker.reset();
+    geofenceHysteresis.reset();
+    sampleInterval = 0; // Re-evaluate against the new zones on the next fix
+    remapActiveGeofences();
+    Serial.printf("Geofences updated! %u zones, %u grid cells\n", (unsigned)geofences.liveCount(), (unsigned)geofenceIndex.cellCount());
 }
 
-String getDateAndTime()
+String getDateAndTime(const GpsFix &fix)
 {
-    if (gps.date.isValid() && gps.time.isValid())
+    if (fix.dateTimeValid)
     {
-        int hour = gps.time.hour();
-        int minute = gps.time.minute();
-        int day = gps.date.day();
-        int month = gps.date.month();
-        int year = gps.date.year();
+        int hour = fix.hour;
+        int minute = fix.minute;
+        int day = fix.day;
+        int month = fix.month;
+        int year = fix.year;
 
         // Convert to IST (UTC +5:30)
         minute += 30;
@@ -173,213 +301,485 @@ bool isPointOnEdge(double lat, double lon, double lat1, double lon1, double lat2
     return false;
 }
 
-bool isInsideGeofence(double lat, double lon)
+const GeofenceHits &findGeofences(int32_t lat, int32_t lon)
 {
-    for (auto &geo : geofences)
+    // Only re-evaluated once the vehicle may have crossed a boundary, and then
+    // only the zones registered in this fix's grid cell are ray-cast
+    const GeofenceHits &hits = geofenceTracker.update(geofences, geofenceIndex, lat, lon);
+    if (hits.count > 0)
+        Serial.printf("Inside %u zone(s)%s\n", hits.count, hits.overflow ? " (truncated)" : "");
+    else
+        Serial.println("Outside");
+    return hits;
+}
+
+// A document name for one record of one stay, picked here rather than by
+// Firestore so a create retried after a lost response finds the first one
+// instead of adding a second. It is random, not derived from the zone or the
+// entry time, so no two stays can share it.
+String newRecordId()
+{
+    char id[20];
+    snprintf(id, sizeof(id), "%08lx%08lx", (unsigned long)esp_random(), (unsigned long)esp_random());
+    return vehicleNo + "_" + id;
+}
+
+// Create the document at path; as every record is named for its own stay,
+// ALREADY_EXISTS means an earlier attempt got through
+bool createRecord(const String &path, const String &jsonStr)
+{
+    FirebaseData &fbdo = sessions.get(FIRESTORE_HOST);
+    if (Firebase.Firestore.createDocument(&fbdo, FIREBASE_PROJECT_ID, "", path.c_str(), jsonStr) ||
+        fbdo.httpCode() == 409)
+        return true;
+    Serial.println("Failed to write " + path + ": " + fbdo.errorReason());
+    return false;
+}
+
+bool writeEntry(ActiveGeofence &active)
+{
+    if (active.entryDocument.length() == 0)
+        active.entryDocument = String(GEOFENCE_ENTRIES_COLLECTION) + "/" + newRecordId();
+    String jsonStr = "{ \"fields\": {"
+                     "\"name\": { \"stringValue\": \"" +
+                     active.name + "\" },"
+                                   "\"vehicle_no\": { \"stringValue\": \"" +
+                     vehicleNo + "\" },"
+                                 "\"entry_date_time\": { \"stringValue\": \"" +
+                     active.entryDateTime + "\" },"
+                                            "\"lat\": { \"stringValue\": \"" +
+                     String(geofenceFromE7(active.entryLat), 5) + "\" },"
+                                                                  "\"long\": { \"stringValue\": \"" +
+                     String(geofenceFromE7(active.entryLon), 5) + "\" }"
+                                                                  "} }";
+    if (!createRecord(active.entryDocument, jsonStr))
+        return false;
+    active.entryPending = false;
+    return true;
+}
+
+void enterGeofence(ActiveGeofence &active, int32_t lat, int32_t lon, const String &date_time, uint32_t now)
+{
+    active.name = geofences.name(active.zone).c_str();
+    active.entryDateTime = date_time;
+    active.exitDateTime = "";
+    active.entryDocument = "";
+    active.violationDocument = "";
+    active.entryLat = lat;
+    active.entryLon = lon;
+    active.entrySeconds = now;
+    active.entryPending = true;
+    active.violated = false;
+    active.violationPending = false;
+    trackUpload.addEvent(TRACK_RECORD_ENTER, now, lat, lon, active.name.c_str());
+    Serial.println("Entered geofence: " + active.name);
+}
+
+// Removes the entry record; a delete is idempotent, so no precondition
+void addEntryDelete(std::vector<firebase_firestore_document_write_t> &writes, const ActiveGeofence &exited)
+{
+    if (exited.entryDocument.length() == 0)
+        return; // Nothing was sent
+
+    firebase_firestore_document_write_t write;
+    write.type = firebase_firestore_document_write_type_delete;
+    write.delete_document_path = exited.entryDocument.c_str();
+    writes.push_back(write);
+}
+
+String violationJson(const ActiveGeofence &active, const String &exitDateTime)
+{
+    return "{ \"fields\": {"
+           "\"name\": { \"stringValue\": \"" +
+           active.name + "\" },"
+                         "\"vehicle_no\": { \"stringValue\": \"" +
+           vehicleNo + "\" },"
+                       "\"entry_date_time\": { \"stringValue\": \"" +
+           active.entryDateTime + "\" },"
+                                  "\"type\": { \"stringValue\": \"No Parking\" },"
+                                  "\"exit_date_time\": { \"stringValue\": \"" +
+           exitDateTime + "\" },"
+                          "\"notified\": { \"booleanValue\": false }"
+                          "} }";
+}
+
+// Written while the vehicle is still in the zone; the exit closes it
+bool reportViolation(ActiveGeofence &active)
+{
+    if (!createRecord(active.violationDocument, violationJson(active, "Still active")))
+        return false;
+    active.violationPending = false;
+    Serial.println("Violation logged for " + active.name);
+    return true;
+}
+
+// Dwell timer: a stay counts from entry on the GPS clock, and once it outlasts
+// the zone's limit it is a violation, decided here exactly once whatever the
+// link does. Exiting before that just ends the stay.
+void checkDwell(ActiveGeofence &active, int32_t lat, int32_t lon, uint32_t now)
+{
+    if (active.violated || now == 0)
+        return;
+
+    // Entered before the GPS clock was valid (or it went backwards): start now
+    if (active.entrySeconds == 0 || now < active.entrySeconds)
     {
-        int count = 0;
-
-        // Define corners of the quadrilateral
-        double lat1 = geo.c1_lat, lon1 = geo.c1_lon;
-        double lat2 = geo.c2_lat, lon2 = geo.c2_lon;
-        double lat3 = geo.c3_lat, lon3 = geo.c3_lon;
-        double lat4 = geo.c4_lat, lon4 = geo.c4_lon;
-
-        // // Check if the point is exactly on any edge
-        // if (isPointOnEdge(lat, lon, lat1, lon1, lat2, lon2) ||
-        //     isPointOnEdge(lat, lon, lat2, lon2, lat3, lon3) ||
-        //     isPointOnEdge(lat, lon, lat3, lon3, lat4, lon4) ||
-        //     isPointOnEdge(lat, lon, lat4, lon4, lat1, lon1))
-        // {
-
-        //     activeGeofence = geo.name;
-        //     Serial.println("Inside - On the Edge");
-        //     return true;
-        // }
-
-        // Ray-Casting Algorithm for inside check
-        if ((lat1 > lat) != (lat2 > lat) && lon < (lon2 - lon1) * (lat - lat1) / (lat2 - lat1) + lon1)
-            count++;
-        if ((lat2 > lat) != (lat3 > lat) && lon < (lon3 - lon2) * (lat - lat2) / (lat3 - lat2) + lon2)
-            count++;
-        if ((lat3 > lat) != (lat4 > lat) && lon < (lon4 - lon3) * (lat - lat3) / (lat4 - lat3) + lon3)
-            count++;
-        if ((lat4 > lat) != (lat1 > lat) && lon < (lon1 - lon4) * (lat - lat4) / (lat1 - lat4) + lon4)
-            count++;
-
-        if (count % 2 == 1)
-        {
-            activeGeofence = geo.name;
-            Serial.println("Inside");
-            return true;
-        }
+        active.entrySeconds = now;
+        return;
     }
-    Serial.println("Outside");
-    return false;
+
+    if (now - active.entrySeconds < geofences.dwellLimit(active.zone))
+        return;
+
+    // The journal keeps the event; the record follows once it can be written,
+    // always under this name
+    active.violationDocument = String(VIOLATION_COLLECTION) + "/VID_" + newRecordId();
+    active.violated = true;
+    active.violationPending = true;
+    trackUpload.addEvent(TRACK_RECORD_VIOLATION, now, lat, lon, active.name.c_str());
+    Serial.println("Dwell limit passed in " + active.name);
 }
 
-void checkGeofence(double lat, double lon, String date_time)
+// Everything a stay that has ended still needs, in one commit: the entry
+// record goes in the same request that closes the violation, so neither can
+// be left behind without the other. Returns false, leaving the stay queued,
+// if the commit fails.
+bool writeExit(ActiveGeofence &exited)
 {
-    if (isInsideGeofence(lat, lon))
+    std::vector<firebase_firestore_document_write_t> writes;
+    firebase_firestore_document_write_t violation;
+    String content;
+    if (exited.violationPending)
     {
-        if (!insideGeofence)
-        {
-            insideGeofence = true;
-            entryDateTime = date_time;
-            String jsonStr = "{ \"fields\": {"
-                             "\"name\": { \"stringValue\": \"" +
-                             activeGeofence + "\" },"
-                                              "\"vehicle_no\": { \"stringValue\": \"" +
-                             vehicleNo + "\" },"
-                                         "\"entry_date_time\": { \"stringValue\": \"" +
-                             entryDateTime + "\" },"
-                                             "\"lat\": { \"stringValue\": \"" +
-                             String(lat, 5) + "\" },"
-                                              "\"long\": { \"stringValue\": \"" +
-                             String(lon, 5) + "\" }"
-                                              "} }";
-
-            Firebase.Firestore.createDocument(&fbdo, FIREBASE_PROJECT_ID, "", GEOFENCE_ENTRIES_COLLECTION, jsonStr);
-            Serial.println("Entered geofence: " + activeGeofence);
-        }
+        // Never written while the vehicle was in the zone: the whole record,
+        // exit time included, and only if an earlier attempt did not get
+        // through after all
+        content = violationJson(exited, exited.exitDateTime);
+        violation.current_document.exists = "false";
     }
-    else
+    else if (exited.violated)
     {
-        if (insideGeofence)
-        {
-            insideGeofence = false;
+        // Only exit_date_time changes, and only if the record exists, so a
+        // late or repeated exit can never create a bare one
+        FirebaseJson updateData;
+        updateData.set("fields/exit_date_time/stringValue", exited.exitDateTime);
+        updateData.toString(content);
+        violation.update_masks = "exit_date_time";
+        violation.current_document.exists = "true";
+    }
+    if (exited.violated)
+    {
+        violation.type = firebase_firestore_document_write_type_update;
+        violation.update_document_path = exited.violationDocument.c_str();
+        violation.update_document_content = content.c_str();
+        writes.push_back(violation);
+    }
+    addEntryDelete(writes, exited);
+    if (writes.empty())
+        return true;
 
-            // Construct the query
-            String query = String(GEOFENCE_ENTRIES_COLLECTION) +
-                           "?where=vehicle_no='" + vehicleNo +
-                           "' AND name='" + activeGeofence +
-                           "' AND entry_date_time='" + entryDateTime + "'";
+    // Applied together, preconditions and all, or not at all
+    FirebaseData &fbdo = sessions.get(FIRESTORE_HOST);
+    if (!Firebase.Firestore.commitDocument(&fbdo, FIREBASE_PROJECT_ID, "", writes))
+    {
+        Serial.println("Failed to write the exit from " + exited.name + ": " + fbdo.errorReason());
+        if (exited.violationPending && fbdo.httpCode() == 409)
+            exited.violationPending = false; // An earlier attempt wrote it; close it next time
+        else if (!exited.violationPending && exited.violated && fbdo.httpCode() == 404)
+            exited.violated = false; // The record was deleted; nothing left to close
+        return false;
+    }
+    Serial.println(exited.violated ? "Closed violation and removed geofence entry for " + exited.name
+                                   : "Removed geofence entry for " + exited.name);
+    return true;
+}
 
-            // Attempt to delete the document from geofence_entries
-            if (Firebase.Firestore.deleteDocument(&fbdo, FIREBASE_PROJECT_ID, "", query))
-            {
-                Serial.println("Exited geofence. Removed all matching documents.");
-            }
-            else
-            {
-                Serial.println("Document not found in geofence_entries, checking violation_details...");
-
-                // Query to check if the document exists in violation_details
-                String violationQuery = String(VIOLATION_COLLECTION) +
-                                        "?where=vehicle_no='" + vehicleNo +
-                                        "' AND name='" + activeGeofence +
-                                        "' AND entry_date_time='" + entryDateTime + "'";
-
-                if (Firebase.Firestore.getDocument(&fbdo, FIREBASE_PROJECT_ID, "", violationQuery))
-                {
-                    // If the document exists in violation_details, update exit_date_time
-                    FirebaseJson updateData;
-                    updateData.set("fields/exit_date_time/stringValue", date_time); // Using date_time directly
-                    String updateDataStr;
-                    updateData.toString(updateDataStr, true);
-
-                    if (Firebase.Firestore.patchDocument(&fbdo, FIREBASE_PROJECT_ID, "", violationQuery, updateDataStr.c_str(), "exit_date_time"))
-                    {
-                        Serial.println("Updated exit_date_time in violation_details.");
-                    }
-                    else
-                    {
-                        Serial.println("Failed to update exit_date_time.");
-                    }
-                }
-                else
-                {
-                    Serial.println("Document not found in violation_details either.");
-                }
-            }
+void exitGeofence(ActiveGeofence &active, int32_t lat, int32_t lon, const String &date_time, uint32_t now)
+{
+    trackUpload.addEvent(TRACK_RECORD_EXIT, now, lat, lon, active.name.c_str());
+    Serial.println("Exited geofence " + active.name);
 
-            // Reset active geofence variables
-            activeGeofence = "";
-            entryDateTime = "";
-        }
+    // Nothing to write for a short stay that was offline throughout
+    active.exitDateTime = date_time;
+    if (!active.violated && active.entryDocument.length() == 0)
+        return;
+
+    if (pendingExitCount == GEOFENCE_PENDING_EXITS)
+    {
+        // No room: give up the oldest stay, preferring one without a violation
+        size_t drop = 0;
+        while (drop < pendingExitCount - 1 && pendingExits[drop].violated)
+            drop++;
+        Serial.println("Too many zone records waiting, dropped those of " + pendingExits[drop].name);
+        for (size_t k = drop + 1; k < pendingExitCount; k++)
+            std::swap(pendingExits[k - 1], pendingExits[k]);
+        pendingExitCount--;
     }
+    pendingExits[pendingExitCount++] = active;
 }
 
-void uploadToFirebase(double lat, double lon, String date_time)
+// Write the Firestore records the zone logic has queued, ended stays first.
+// Called only while online. Stops at the first failure and waits
+// GEOFENCE_RECORD_RETRY_MS before trying again, so a bad link costs one
+// timeout per wait rather than one per record.
+void writeGeofenceRecords()
 {
-    String path = "/gps_data"; // Fixed path instead of unique millis()
-
-    FirebaseJson json;
-    json.set("latitude", lat);
-    json.set("longitude", lon);
-    json.set("date_time", date_time);
+    if (recordFailed && millis() - lastRecordFailTime < GEOFENCE_RECORD_RETRY_MS)
+        return;
 
-    if (Firebase.RTDB.updateNode(&fbdo, path.c_str(), &json))
+    bool ok = true;
+    while (pendingExitCount > 0)
     {
-        Serial.println("Data updated successfully in Firebase");
+        ok = writeExit(pendingExits[0]);
+        for (size_t k = 1; k < pendingExitCount; k++)
+            std::swap(pendingExits[k - 1], pendingExits[k]);
+        if (!ok)
+            break; // Now last in line, so one that keeps failing cannot hold up the rest
+        pendingExitCount--;
     }
-    else
+
+    for (size_t i = 0; ok && i < activeGeofenceCount; i++)
     {
-        Serial.print("Firebase error: ");
-        Serial.println(fbdo.errorReason());
+        ActiveGeofence &active = activeGeofences[i];
+        if (active.entryPending)
+            ok = writeEntry(active);
+        if (ok && active.violationPending)
+            ok = reportViolation(active);
     }
+
+    recordFailed = !ok;
+    if (!ok)
+        lastRecordFailTime = millis();
 }
 
-void getGPSData()
+void checkGeofence(int32_t lat, int32_t lon, String date_time, uint32_t now)
 {
-
-    while (gpsSerial.available() > 0)
+    // A zone change only counts once the position is clearly across the
+    // boundary (or has stayed across it), so noise along an edge cannot flip
+    // the vehicle in and out of a zone
+    GeofenceHits current;
+    for (size_t k = 0; k < activeGeofenceCount; k++)
+        current.add(activeGeofences[k].zone);
+    const GeofenceHits &hits = geofenceHysteresis.update(geofences, current, findGeofences(lat, lon), lat, lon,
+                                                         positionFilter.sigmaMeters());
+
+    // Both lists are sorted by zone id, so one merge pass finds every entry
+    // and exit. Zones still occupied are moved over untouched.
+    static ActiveGeofence next[GEOFENCE_MAX_HITS];
+    size_t count = 0, i = 0, j = 0;
+    while (i < activeGeofenceCount || j < hits.count)
     {
-        gps.encode(gpsSerial.read());
+        if (j == hits.count || (i < activeGeofenceCount && activeGeofences[i].zone < hits.zones[j]))
+        {
+            exitGeofence(activeGeofences[i++], lat, lon, date_time, now);
+        }
+        else if (i == activeGeofenceCount || hits.zones[j] < activeGeofences[i].zone)
+        {
+            next[count].zone = hits.zones[j++];
+            enterGeofence(next[count++], lat, lon, date_time, now);
+        }
+        else
+        {
+            std::swap(next[count++], activeGeofences[i++]);
+            j++;
+        }
     }
 
-    if (gps.location.isUpdated())
+    for (size_t k = 0; k < count; k++)
     {
-        double lat = gps.location.lat();
-        double lon = gps.location.lng();
-        // double lat = 12.66201;
-        // double lon = 80.01405;
+        std::swap(activeGeofences[k], next[k]);
+        checkDwell(activeGeofences[k], lat, lon, now);
+    }
+    activeGeofenceCount = count;
+}
 
-        // Convert to String with 5 decimal places
-        char latBuffer[10], lonBuffer[10];
-        dtostrf(lat, 8, 5, latBuffer); // (value, min width, decimal places, buffer)
-        dtostrf(lon, 8, 5, lonBuffer);
+bool uploadToFirebase(double lat, double lon, String date_time)
+{
+    // The recorded track goes in the same request
+    trackUpload.setLatest(lat, lon, date_time);
+    FirebaseData &fbdo = sessions.get(RTDB_HOST);
+    if (trackUpload.flush(fbdo, vehicleNo))
+    {
+        uploadsSent++;
+        Serial.printf("Data updated successfully in Firebase with %u journal records (%u sent, %u suppressed)\n",
+                      (unsigned)trackUpload.lastBatch(), (unsigned)uploadsSent, (unsigned)uploadsSuppressed);
+        return true;
+    }
+    Serial.print("Firebase error: ");
+    Serial.println(fbdo.errorReason());
+    return false;
+}
 
-        // Convert back to double
-        lat = atof(latBuffer);
-        lon = atof(lonBuffer);
+// Records waiting long enough, zone events and any backlog from an outage go
+// up on their own when no position update has taken them along
+void flushTrack()
+{
+    if (!trackUpload.due())
+        return;
+    FirebaseData &fbdo = sessions.get(RTDB_HOST);
+    if (trackUpload.flush(fbdo, vehicleNo))
+        Serial.printf("Uploaded %u journal records, %u left, %u lost; %u handshakes (%u resumable), %u avoided\n",
+                      (unsigned)trackUpload.lastBatch(), (unsigned)trackUpload.pending(),
+                      (unsigned)trackUpload.recordsLost(), (unsigned)sessions.handshakes(),
+                      (unsigned)tlsSessions.hits(), (unsigned)sessions.handshakesAvoided());
+    else
+        Serial.println("Track upload failed: " + fbdo.errorReason());
+}
 
-        // Print with strict 5-decimal precision
-        Serial.printf("Lat: %.5f  Lon: %.5f\n", lat, lon);
+// Whether the position is worth sending: far enough from the last one sent,
+// a real turn, or the last one sent is getting old
+bool uploadDue(int32_t latE7, int32_t lonE7, const GpsFix &fix)
+{
+    if (!uploadedOnce || millis() - lastUploadTime >= UPLOAD_MAX_INTERVAL_MS)
+        return true;
 
-        String date_time = getDateAndTime(); // Get GPS time here
+    float moved = geofenceDistanceMeters(lastUploadLat, lastUploadLon, latE7, lonE7, geofenceCosLat(latE7));
+    if (moved >= UPLOAD_DEADBAND_M)
+        return true;
 
-        // Send strict 5-decimal values
-        uploadToFirebase(lat, lon, date_time);
-        checkGeofence(lat, lon, date_time);
+    // Course is noise while standing still
+    if (fix.courseValid && fix.speedValid && fix.speedMps >= STATIONARY_MPS)
+    {
+        float turn = fabsf(fix.courseDeg - lastUploadCourse);
+        if (turn > 180)
+            turn = 360 - turn;
+        return turn >= UPLOAD_DEADBAND_DEG;
     }
-    else
+    return false;
+}
+
+// Round to a multiple of step, halves away from zero
+int32_t roundE7(int32_t e7, int32_t step)
+{
+    int32_t half = step / 2;
+    return (e7 >= 0 ? (e7 + half) / step : (e7 - half) / step) * step;
+}
+
+// The next evaluation is due before the vehicle could reach any zone boundary,
+// even accelerating hard, so the fixes skipped in between add no detection
+// latency. Inside a zone every fix is used to time the dwell.
+void scheduleNextSample(const GpsFix &fix)
+{
+    lastSampleTime = millis();
+    if (activeGeofenceCount > 0 || !fix.speedValid)
     {
-        Serial.println("No GPS Fix Yet...");
+        sampleInterval = SAMPLE_MIN_MS;
+        return;
     }
+
+    // A fix is up to one period old by the time it is used
+    uint32_t reach = geofenceReachTimeMs(geofenceTracker.clearanceMeters(), fix.speedMps);
+    reach = reach > SAMPLE_MIN_MS ? reach - SAMPLE_MIN_MS : 0;
+    sampleInterval = constrain(reach, SAMPLE_MIN_MS, SAMPLE_MAX_MS);
 }
 
-void loop()
+void getGPSData()
 {
-    if (WiFi.status() != WL_CONNECTED)
+    // Only the newest fix matters; older ones queued while loop() was blocked
+    // in a Firebase call are skipped
+    GpsFix fix;
+    while (gpsIngest.pop(fix))
     {
-        Serial.println("WiFi Lost. Reconnecting...");
-        WiFi.begin(WIFI_SSID, WIFI_PASSWORD);
-        while (WiFi.status() != WL_CONNECTED)
+        // The filter sees every fix, including the ones not evaluated. The
+        // velocity of a fix rejected as an outlier is skipped with it.
+        bool accepted = positionFilter.update(fix.receivedMs, fix.latE7, fix.lonE7,
+                                              fix.hdopValid ? fix.hdop / 100.0f : 0, fix.accuracyM);
+        if (accepted && fix.speedValid && fix.courseValid)
+            positionFilter.updateVelocity(fix.speedMps, fix.courseDeg);
+        trackUpload.add(fix.seconds, fix.centisecond, positionFilter.latE7(), positionFilter.lonE7(),
+                        positionFilter.speedMps(), fix.courseValid ? fix.courseDeg : 0);
+        lastFix = fix;
+        fixPending = true;
+        haveFix = true;
+    }
+
+    if (gpsIngest.dropped() != droppedFixesLogged)
+    {
+        droppedFixesLogged = gpsIngest.dropped();
+        Serial.printf("GPS queue full, %u fixes dropped so far\n", (unsigned)droppedFixesLogged);
+    }
+
+    if (!haveFix || millis() - lastFix.receivedMs >= GPS_FIX_TIMEOUT_MS)
+    {
+        if (millis() - lastNoFixLog >= SAMPLE_MIN_MS)
         {
-            Serial.print(".");
-            delay(1000);
+            Serial.println("No GPS Fix Yet...");
+            lastNoFixLog = millis();
         }
-        Serial.println("\nReconnected to WiFi!");
+        return;
     }
 
-    if (millis() - lastFetchTime >= fetchInterval)
+    // Fixes arriving before the next sample is due are skipped; the newest one
+    // stays pending and is used once it is
+    if (!fixPending || millis() - lastSampleTime < sampleInterval)
+        return;
+    fixPending = false;
+
+    // Filtered position, still fixed point
+    int32_t latE7 = positionFilter.latE7();
+    int32_t lonE7 = positionFilter.lonE7();
+    // int32_t latE7 = 126620100;
+    // int32_t lonE7 = 800140500;
+
+    // Uploads keep strict 5-decimal values
+    double lat = geofenceFromE7(roundE7(latE7, 100));
+    double lon = geofenceFromE7(roundE7(lonE7, 100));
+
+    String date_time = getDateAndTime(lastFix); // Get GPS time here
+    checkGeofence(latE7, lonE7, date_time, lastFix.seconds);
+    scheduleNextSample(lastFix);
+
+    // Print with strict 5-decimal precision
+    Serial.printf("Lat: %.5f  Lon: %.5f  +-%.1f m  clearance %.0f m, next in %lu ms\n",
+                  lat, lon, positionFilter.sigmaMeters(), geofenceTracker.clearanceMeters(), sampleInterval);
+
+    // Offline the fix is already in the journal; /gps_data catches up with
+    // the first one evaluated after the link is back
+    if (!connectivity.online())
+        return;
+
+    // A parked vehicle only refreshes its position now and then. A failed
+    // update leaves the deadband where it was, so the next fix retries.
+    if (!uploadDue(latE7, lonE7, lastFix))
+    {
+        uploadsSuppressed++;
+        return;
+    }
+    // Send strict 5-decimal values
+    if (uploadToFirebase(lat, lon, date_time))
+    {
+        lastUploadTime = millis();
+        lastUploadLat = latE7;
+        lastUploadLon = lonE7;
+        lastUploadCourse = lastFix.courseDeg;
+        uploadedOnce = true;
+    }
+}
+
+void loop()
+{
+    // Offline the GPS keeps being read, zones keep being checked and
+    // everything goes to the journal or waits on its zone; only the network
+    // work waits. Online, each kind of request stops at its first failure, so
+    // a pass is bounded by a few Firebase timeouts and the newest fix is
+    // evaluated within them whatever the link does.
+    connectivity.poll();
+    bool online = connectivity.online();
+    sessions.poll();
+
+    if (online && millis() - lastFetchTime >= fetchInterval)
     {
         fetchGeofences();
         lastFetchTime = millis(); // Update last fetch time
+        geofencesFetched = true;
     }
 
     getGPSData();
+    if (online)
+    {
+        flushTrack();
+        writeGeofenceRecords();
+    }
 
-    delay(1000);
+    delay(GPS_POLL_MS);
 }
\ No newline at end of file
@@ -0,0 +1,126 @@
+#include "session_pool.h"
+
+SessionPool::SessionPool() : count(0), handshakeCount(0), reuseCount(0), evictionCount(0), tlsCache(NULL)
+{
+}
+
+bool SessionPool::isOpen(const Entry &entry) const
+{
+    return entry.fbdo->httpConnected() && millis() - entry.openedMs < SESSION_POOL_LIFETIME_MS;
+}
+
+size_t SessionPool::openSessions() const
+{
+    size_t open = 0;
+    for (size_t i = 0; i < count; i++)
+        open += isOpen(entries[i]);
+    return open;
+}
+
+void SessionPool::close(Entry &entry)
+{
+    if (entry.fbdo->httpConnected())
+        entry.fbdo->stopWiFiClient();
+}
+
+// Close the least recently used connections, other than keep's, until one
+// more fits the budget and the heap
+void SessionPool::makeRoom(const Entry &keep)
+{
+    for (;;)
+    {
+        size_t open = openSessions();
+        if ((open + 1) * SESSION_POOL_SESSION_BYTES <= SESSION_POOL_BUDGET_BYTES &&
+            ESP.getFreeHeap() >= SESSION_POOL_MIN_FREE_HEAP)
+            return;
+
+        Entry *oldest = NULL;
+        for (size_t i = 0; i < count; i++)
+        {
+            Entry &entry = entries[i];
+            if (&entry != &keep && entry.fbdo->httpConnected() && (!oldest || entry.lastUseMs < oldest->lastUseMs))
+                oldest = &entry;
+        }
+        if (!oldest)
+            return; // nothing left to close; connect anyway
+        close(*oldest);
+        evictionCount++;
+    }
+}
+
+FirebaseData &SessionPool::get(const char *host)
+{
+    Entry *entry = NULL;
+    for (size_t i = 0; i < count && !entry; i++)
+        if (strcmp(entries[i].host, host) == 0)
+            entry = &entries[i];
+
+    if (!entry)
+    {
+        if (count < SESSION_POOL_HOSTS)
+        {
+            entry = &entries[count++];
+            entry->fbdo = new FirebaseData();
+        }
+        else
+        {
+            // More hosts than expected: the least recently used one changes
+            // hands, and the client reconnects it on the host switch
+            entry = &entries[0];
+            for (size_t i = 1; i < count; i++)
+                if (entries[i].lastUseMs < entry->lastUseMs)
+                    entry = &entries[i];
+            close(*entry);
+        }
+        entry->host = host;
+        entry->openedMs = 0;
+
+        // Whatever session the object held was for another host
+        memset(entry->fbdo->getTLSSession(), 0, sizeof(br_ssl_session_parameters));
+    }
+
+    if (isOpen(*entry))
+    {
+        reuseCount++;
+    }
+    else
+    {
+        makeRoom(*entry);
+        handshakeCount++;
+        entry->openedMs = millis();
+
+        // Start from the newest session known for the host; BearSSL falls
+        // back to a full handshake if the server does not take it
+        if (tlsCache)
+            tlsCache->restore(host, *entry->fbdo->getTLSSession());
+    }
+    entry->lastUseMs = millis();
+    return *entry->fbdo;
+}
+
+void SessionPool::poll()
+{
+    for (size_t i = 0; i < count; i++)
+    {
+        Entry &entry = entries[i];
+
+        // Sessions from handshakes since the last poll (unchanged ones are
+        // skipped, so this rarely writes)
+        if (tlsCache)
+            tlsCache->store(entry.host, *entry.fbdo->getTLSSession());
+
+        if (entry.fbdo->httpConnected() && millis() - entry.lastUseMs >= SESSION_POOL_IDLE_MS)
+        {
+            close(entry);
+            evictionCount++;
+            Serial.printf("Closed idle session to %s (%u handshakes, %u avoided)\n", entry.host,
+                          (unsigned)handshakeCount, (unsigned)reuseCount);
+        }
+    }
+}
+
+void SessionPool::closeAll()
+{
+    for (size_t i = 0; i < count; i++)
+        close(entries[i]);
+}
@@ -0,0 +1,355 @@
+#include "telemetry_journal.h"
+
+#include <stdio.h>
+#include <string.h>
+
+// On flash each record is this header followed by length payload bytes
+struct JournalHeader
+{
+    uint16_t magic;
+    uint8_t type;
+    uint8_t length;
+    uint32_t seq;
+    uint32_t crc; // of type, length, seq and the payload
+};
+
+struct JournalAck
+{
+    uint32_t seq;
+    uint32_t counter;
+    uint32_t crc;
+};
+
+#define RECORD_MAX_BYTES (sizeof(JournalHeader) + JOURNAL_MAX_PAYLOAD)
+
+// CRC-32 (IEEE, reflected), a nibble at a time
+static const uint32_t crcNibbles[16] = {
+    0x00000000, 0x1db71064, 0x3b6e20c8, 0x26d930ac, 0x76dc4190, 0x6b6b51f4, 0x4db26158, 0x5005713c,
+    0xedb88320, 0xf00f9344, 0xd6d6a3e8, 0xcb61b38c, 0x9b64c2b0, 0x86d3d2d4, 0xa00ae278, 0xbdbdf21c};
+
+static uint32_t crcUpdate(uint32_t crc, const void *data, size_t size)
+{
+    const uint8_t *bytes = (const uint8_t *)data;
+    for (size_t i = 0; i < size; i++)
+    {
+        crc ^= bytes[i];
+        crc = (crc >> 4) ^ crcNibbles[crc & 15];
+        crc = (crc >> 4) ^ crcNibbles[crc & 15];
+    }
+    return crc;
+}
+
+static uint32_t recordCrc(uint8_t type, uint8_t length, uint32_t seq, const uint8_t *data)
+{
+    uint32_t crc = 0xffffffff;
+    crc = crcUpdate(crc, &type, 1);
+    crc = crcUpdate(crc, &length, 1);
+    crc = crcUpdate(crc, &seq, sizeof(seq));
+    return ~crcUpdate(crc, data, length);
+}
+
+// Next record of an open segment; false at the end or at a damaged record
+static bool readRecord(MB_FS &fs, JournalRecord &record)
+{
+    JournalHeader header;
+    if (fs.read(mbfs_flash, (uint8_t *)&header, sizeof(header)) != (int)sizeof(header) ||
+        header.magic != JOURNAL_MAGIC || header.length > JOURNAL_MAX_PAYLOAD ||
+        fs.read(mbfs_flash, record.data, header.length) != (int)header.length ||
+        recordCrc(header.type, header.length, header.seq, record.data) != header.crc)
+        return false;
+    record.seq = header.seq;
+    record.type = header.type;
+    record.length = header.length;
+    return true;
+}
+
+TelemetryJournal::TelemetryJournal(MB_FS &fs, const char *path)
+    : fs(fs), path(path), head(0), nextSeq(1), acked(0), ackCounter(0), lostCount(0), stageCount(0),
+      cursorValid(false), cursorSegment(0), cursorOffset(0), cursorSeq(0)
+{
+    memset(segments, 0, sizeof(segments));
+}
+
+void TelemetryJournal::fileName(char *out, size_t size, const char *suffix, unsigned index) const
+{
+    snprintf(out, size, "%s.%s%u", path, suffix, index);
+}
+
+void TelemetryJournal::scanSegment(uint8_t index)
+{
+    Segment &segment = segments[index];
+    memset(&segment, 0, sizeof(segment));
+
+    char name[48];
+    fileName(name, sizeof(name), "", index);
+    int size = fs.open(name, mbfs_flash, mb_fs_open_mode_read);
+    if (size <= 0)
+    {
+        fs.close(mbfs_flash);
+        return;
+    }
+
+    // Records within a segment are consecutive; anything else is the
+    // remains of an interrupted write
+    JournalRecord record;
+    while (segment.bytes < (uint32_t)size && readRecord(fs, record) &&
+           (segment.lastSeq == 0 || record.seq == segment.lastSeq + 1))
+    {
+        if (segment.firstSeq == 0)
+            segment.firstSeq = record.seq;
+        segment.lastSeq = record.seq;
+        segment.bytes += sizeof(JournalHeader) + record.length;
+    }
+    fs.close(mbfs_flash);
+    segment.sealed = segment.bytes < (uint32_t)size || segment.bytes + RECORD_MAX_BYTES > JOURNAL_SEGMENT_BYTES;
+}
+
+bool TelemetryJournal::loadAck()
+{
+    bool found = false;
+    for (unsigned slot = 0; slot < 2; slot++)
+    {
+        char name[48];
+        fileName(name, sizeof(name), "ack", slot);
+        JournalAck saved;
+        bool ok = fs.open(name, mbfs_flash, mb_fs_open_mode_read) == (int)sizeof(saved) &&
+                  fs.read(mbfs_flash, (uint8_t *)&saved, sizeof(saved)) == (int)sizeof(saved) &&
+                  ~crcUpdate(0xffffffff, &saved, 2 * sizeof(uint32_t)) == saved.crc;
+        fs.close(mbfs_flash);
+        if (ok && (!found || saved.counter > ackCounter))
+        {
+            acked = saved.seq;
+            ackCounter = saved.counter;
+            found = true;
+        }
+    }
+    return found;
+}
+
+bool TelemetryJournal::saveAck(uint32_t seq)
+{
+    // Alternate between the two files, so the last good one survives a
+    // write cut short
+    JournalAck saved;
+    saved.seq = seq;
+    saved.counter = ackCounter + 1;
+    saved.crc = ~crcUpdate(0xffffffff, &saved, 2 * sizeof(uint32_t));
+
+    char name[48];
+    fileName(name, sizeof(name), "ack", saved.counter & 1);
+    bool ok = fs.open(name, mbfs_flash, mb_fs_open_mode_write) == 0 &&
+              fs.write(mbfs_flash, (uint8_t *)&saved, sizeof(saved)) == (int)sizeof(saved);
+    fs.close(mbfs_flash);
+    if (ok)
+        ackCounter = saved.counter;
+    return ok;
+}
+
+bool TelemetryJournal::begin()
+{
+    uint32_t last = 0;
+    head = 0;
+    for (uint8_t i = 0; i < JOURNAL_SEGMENTS; i++)
+    {
+        scanSegment(i);
+        if (segments[i].lastSeq > last)
+        {
+            last = segments[i].lastSeq;
+            head = i;
+        }
+    }
+    loadAck();
+    nextSeq = (last > acked ? last : acked) + 1;
+    stageCount = 0;
+    cursorValid = false;
+    return true;
+}
+
+uint32_t TelemetryJournal::append(uint8_t type, const void *data, size_t length)
+{
+    if (length > JOURNAL_MAX_PAYLOAD)
+        return 0;
+    if (stageCount == JOURNAL_STAGE && !commit())
+    {
+        // Flash is failing: the oldest staged record gives way
+        memmove(stage, stage + 1, (JOURNAL_STAGE - 1) * sizeof(JournalRecord));
+        stageCount--;
+        lostCount++;
+    }
+
+    JournalRecord &record = stage[stageCount++];
+    record.seq = nextSeq++;
+    record.type = type;
+    record.length = (uint8_t)length;
+    memcpy(record.data, data, length);
+    return record.seq;
+}
+
+bool TelemetryJournal::startSegment(uint8_t index)
+{
+    // Truncate; whatever was left undelivered there is gone
+    Segment &segment = segments[index];
+    if (segment.lastSeq > acked)
+        lostCount += segment.lastSeq - (segment.firstSeq > acked + 1 ? segment.firstSeq - 1 : acked);
+    if (cursorValid && cursorSegment == index)
+        cursorValid = false;
+
+    char name[48];
+    fileName(name, sizeof(name), "", index);
+    bool ok = fs.open(name, mbfs_flash, mb_fs_open_mode_write) == 0;
+    fs.close(mbfs_flash);
+    memset(&segment, 0, sizeof(segment));
+    segment.sealed = !ok;
+    return ok;
+}
+
+bool TelemetryJournal::commit()
+{
+    if (stageCount == 0)
+        return true;
+
+    static uint8_t buffer[JOURNAL_STAGE * RECORD_MAX_BYTES];
+    size_t size = 0;
+    for (uint8_t i = 0; i < stageCount; i++)
+    {
+        const JournalRecord &record = stage[i];
+        JournalHeader header;
+        header.magic = JOURNAL_MAGIC;
+        header.type = record.type;
+        header.length = record.length;
+        header.seq = record.seq;
+        header.crc = recordCrc(record.type, record.length, record.seq, record.data);
+        memcpy(buffer + size, &header, sizeof(header));
+        memcpy(buffer + size + sizeof(header), record.data, record.length);
+        size += sizeof(header) + record.length;
+    }
+
+    Segment *segment = &segments[head];
+    if (segment->sealed || segment->bytes + size > JOURNAL_SEGMENT_BYTES)
+    {
+        head = (head + 1) % JOURNAL_SEGMENTS;
+        if (!startSegment(head))
+            return false;
+        segment = &segments[head];
+    }
+
+    char name[48];
+    fileName(name, sizeof(name), "", head);
+    bool ok = fs.open(name, mbfs_flash, mb_fs_open_mode_append) == 0 &&
+              fs.write(mbfs_flash, buffer, size) == (int)size;
+    fs.close(mbfs_flash);
+    if (!ok)
+    {
+        // Part of the batch may be on flash; nothing more goes after it. The
+        // batch is written again, whole, to the next segment.
+        segment->sealed = true;
+        return false;
+    }
+
+    if (segment->firstSeq == 0)
+        segment->firstSeq = stage[0].seq;
+    segment->lastSeq = stage[stageCount - 1].seq;
+    segment->bytes += size;
+    segment->sealed = segment->bytes + RECORD_MAX_BYTES > JOURNAL_SEGMENT_BYTES;
+    stageCount = 0;
+    return true;
+}
+
+uint32_t TelemetryJournal::oldestSeq() const
+{
+    uint32_t oldest = stageCount > 0 ? stage[0].seq : nextSeq;
+    for (uint8_t i = 0; i < JOURNAL_SEGMENTS; i++)
+        if (segments[i].firstSeq != 0 && segments[i].firstSeq < oldest)
+            oldest = segments[i].firstSeq;
+    return oldest;
+}
+
+uint32_t TelemetryJournal::pending() const
+{
+    uint32_t oldest = oldestSeq();
+    uint32_t from = acked + 1 > oldest ? acked + 1 : oldest;
+    return nextSeq - from;
+}
+
+size_t TelemetryJournal::read(JournalRecord *out, size_t max)
+{
+    uint32_t want = acked + 1;
+    size_t count = 0;
+    while (count < max)
+    {
+        // The segment holding want; after an interrupted write the same
+        // records can be in two segments, either one will do
+        int found = -1;
+        if (cursorValid && cursorSeq == want && want <= segments[cursorSegment].lastSeq)
+        {
+            found = cursorSegment;
+        }
+        else
+        {
+            uint32_t nextFirst = 0;
+            for (uint8_t i = 0; i < JOURNAL_SEGMENTS; i++)
+            {
+                const Segment &segment = segments[i];
+                if (segment.firstSeq == 0)
+                    continue;
+                if (segment.firstSeq <= want && want <= segment.lastSeq)
+                    found = i;
+                else if (segment.firstSeq > want && (nextFirst == 0 || segment.firstSeq < nextFirst))
+                    nextFirst = segment.firstSeq;
+            }
+            if (found < 0)
+            {
+                // Overwritten before delivery: skip to the oldest record left
+                if (nextFirst == 0)
+                    break;
+                want = nextFirst;
+                continue;
+            }
+            cursorValid = false;
+        }
+
+        const Segment &segment = segments[found];
+        char name[48];
+        fileName(name, sizeof(name), "", found);
+        if (fs.open(name, mbfs_flash, mb_fs_open_mode_read) <= 0)
+        {
+            fs.close(mbfs_flash);
+            break;
+        }
+        uint32_t offset = 0;
+        if (cursorValid && cursorSegment == found && cursorSeq == want)
+        {
+            fs.seek(mbfs_flash, cursorOffset);
+            offset = cursorOffset;
+        }
+
+        JournalRecord record;
+        while (count < max && offset < segment.bytes && readRecord(fs, record))
+        {
+            offset += sizeof(JournalHeader) + record.length;
+            if (record.seq < want)
+                continue;
+            out[count++] = record;
+            want = record.seq + 1;
+        }
+        fs.close(mbfs_flash);
+
+        cursorValid = true;
+        cursorSegment = (uint8_t)found;
+        cursorOffset = offset;
+        cursorSeq = want;
+        if (want <= segment.lastSeq && count < max)
+            break; // the segment ended early: damaged since it was scanned
+    }
+    return count;
+}
+
+bool TelemetryJournal::ack(uint32_t seq)
+{
+    if (seq <= acked)
+        return true;
+    if (!saveAck(seq))
+        return false;
+    acked = seq;
+    return true;
+}
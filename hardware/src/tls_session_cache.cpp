@@ -0,0 +1,133 @@
+#include "tls_session_cache.h"
+
+#include <string.h>
+
+// File layout: magic, the entries as in RAM, then a checksum of both
+struct TlsCacheHeader
+{
+    uint32_t magic;
+    uint32_t size; // bytes of entries that follow
+};
+
+// FNV-1a; only guards against a torn or stale file
+static uint32_t checksum(const void *data, size_t size)
+{
+    const uint8_t *bytes = (const uint8_t *)data;
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < size; i++)
+        hash = (hash ^ bytes[i]) * 16777619u;
+    return hash;
+}
+
+TlsSessionCache::TlsSessionCache() : nextStamp(1), fs(NULL), path(NULL), hitCount(0), missCount(0), storeCount(0)
+{
+    memset(entries, 0, sizeof(entries));
+}
+
+void TlsSessionCache::persistTo(MB_FS &fs, const char *path)
+{
+    this->fs = &fs;
+    this->path = path;
+}
+
+bool TlsSessionCache::load()
+{
+    if (!fs)
+        return false;
+
+    TlsCacheHeader header;
+    uint32_t sum = 0;
+    Entry loaded[TLS_SESSION_CACHE_ENTRIES];
+    bool ok = fs->open(path, mbfs_flash, mb_fs_open_mode_read) ==
+                  (int)(sizeof(header) + sizeof(loaded) + sizeof(sum)) &&
+              fs->read(mbfs_flash, (uint8_t *)&header, sizeof(header)) == (int)sizeof(header) &&
+              header.magic == TLS_SESSION_CACHE_MAGIC && header.size == sizeof(loaded) &&
+              fs->read(mbfs_flash, (uint8_t *)loaded, sizeof(loaded)) == (int)sizeof(loaded) &&
+              fs->read(mbfs_flash, (uint8_t *)&sum, sizeof(sum)) == (int)sizeof(sum) &&
+              sum == checksum(loaded, sizeof(loaded));
+    fs->close(mbfs_flash);
+    if (!ok)
+        return false;
+
+    memcpy(entries, loaded, sizeof(entries));
+    nextStamp = 1;
+    for (size_t i = 0; i < TLS_SESSION_CACHE_ENTRIES; i++)
+    {
+        entries[i].host[TLS_SESSION_CACHE_HOST_LEN - 1] = 0;
+        if (entries[i].stamp >= nextStamp)
+            nextStamp = entries[i].stamp + 1;
+    }
+    return true;
+}
+
+bool TlsSessionCache::save()
+{
+    if (!fs)
+        return false;
+
+    TlsCacheHeader header = {TLS_SESSION_CACHE_MAGIC, sizeof(entries)};
+    uint32_t sum = checksum(entries, sizeof(entries));
+    bool ok = fs->open(path, mbfs_flash, mb_fs_open_mode_write) == 0 &&
+              fs->write(mbfs_flash, (uint8_t *)&header, sizeof(header)) == (int)sizeof(header) &&
+              fs->write(mbfs_flash, (uint8_t *)entries, sizeof(entries)) == (int)sizeof(entries) &&
+              fs->write(mbfs_flash, (uint8_t *)&sum, sizeof(sum)) == (int)sizeof(sum);
+    fs->close(mbfs_flash);
+    return ok;
+}
+
+TlsSessionCache::Entry *TlsSessionCache::find(const char *host)
+{
+    for (size_t i = 0; i < TLS_SESSION_CACHE_ENTRIES; i++)
+        if (entries[i].stamp != 0 && strncmp(entries[i].host, host, TLS_SESSION_CACHE_HOST_LEN - 1) == 0)
+            return &entries[i];
+    return NULL;
+}
+
+bool TlsSessionCache::restore(const char *host, br_ssl_session_parameters &session)
+{
+    Entry *entry = find(host);
+    if (!entry)
+    {
+        missCount++;
+        return false;
+    }
+    session = entry->session;
+    hitCount++;
+    return true;
+}
+
+bool TlsSessionCache::store(const char *host, const br_ssl_session_parameters &session)
+{
+    // Nothing to resume from a connection that never completed a handshake
+    if (session.session_id_len == 0 || session.session_id_len > sizeof(session.session_id))
+        return false;
+
+    Entry *entry = find(host);
+    if (entry && entry->session.session_id_len == session.session_id_len &&
+        memcmp(entry->session.session_id, session.session_id, session.session_id_len) == 0)
+        return false;
+
+    if (!entry)
+    {
+        entry = &entries[0];
+        for (size_t i = 1; i < TLS_SESSION_CACHE_ENTRIES; i++)
+            if (entries[i].stamp < entry->stamp)
+                entry = &entries[i];
+        memset(entry, 0, sizeof(*entry));
+        strncpy(entry->host, host, TLS_SESSION_CACHE_HOST_LEN - 1);
+    }
+    entry->session = session;
+    entry->stamp = nextStamp++;
+    storeCount++;
+    save();
+    return true;
+}
+
+void TlsSessionCache::forget(const char *host)
+{
+    Entry *entry = find(host);
+    if (!entry)
+        return;
+    memset(entry, 0, sizeof(*entry));
+    save();
+}
@@ -0,0 +1,191 @@
+#include "track_upload.h"
+#include "geofence.h"
+
+// Payload layouts, little-endian and unpadded:
+//   fix:   seconds u32, centisecond u8, lat E7 i32, lon E7 i32, speed cm/s u16, course cdeg u16
+//   event: seconds u32, lat E7 i32, lon E7 i32, zone name (rest of the record)
+#define FIX_BYTES 17
+#define EVENT_HEADER_BYTES 12
+
+TrackUpload::TrackUpload(TelemetryJournal &journal, const char *trackRoot, const char *eventRoot)
+    : journal(journal), trackRoot(trackRoot), eventRoot(eventRoot), havePoint(false), lastSeconds(0),
+      lastCentisecond(0), lastLat(0), lastLon(0), oldestMs(0), lastAddMs(0), lastCommitMs(0), lastFlushMs(0),
+      lastFailMs(0), failed(false), eventWaiting(false), backlog(false), latestPending(false), latestLat(0),
+      latestLon(0), batchCount(0), flushCount(0), sentCount(0)
+{
+}
+
+void TrackUpload::add(uint32_t seconds, uint8_t centisecond, int32_t latE7, int32_t lonE7, float speedMps, float courseDeg)
+{
+    if (seconds == 0)
+        return;
+
+    // Skip points that add nothing while parked
+    if (havePoint)
+    {
+        if (lastSeconds == seconds && lastCentisecond == centisecond)
+            return;
+        float moved = geofenceDistanceMeters(lastLat, lastLon, latE7, lonE7, geofenceCosLat(latE7));
+        if (moved < TRACK_UPLOAD_MIN_SPACING_M && millis() - lastAddMs < TRACK_UPLOAD_PARKED_MS)
+            return;
+    }
+
+    uint16_t speedCmps = (uint16_t)constrain(speedMps * 100, 0, UINT16_MAX);
+    uint16_t courseCdeg = (uint16_t)constrain(courseDeg * 100, 0, 35999);
+    uint8_t data[FIX_BYTES];
+    memcpy(data, &seconds, 4);
+    data[4] = centisecond;
+    memcpy(data + 5, &latE7, 4);
+    memcpy(data + 9, &lonE7, 4);
+    memcpy(data + 13, &speedCmps, 2);
+    memcpy(data + 15, &courseCdeg, 2);
+
+    if (journal.pending() == 0)
+        oldestMs = millis();
+    journal.append(TRACK_RECORD_FIX, data, sizeof(data));
+
+    havePoint = true;
+    lastSeconds = seconds;
+    lastCentisecond = centisecond;
+    lastLat = latE7;
+    lastLon = lonE7;
+    lastAddMs = millis();
+
+    // Bound what a reset can take with it
+    if (millis() - lastCommitMs >= TRACK_UPLOAD_COMMIT_MS)
+    {
+        journal.commit();
+        lastCommitMs = millis();
+    }
+}
+
+void TrackUpload::addEvent(uint8_t type, uint32_t seconds, int32_t latE7, int32_t lonE7, const char *zone)
+{
+    uint8_t data[JOURNAL_MAX_PAYLOAD];
+    size_t nameLength = strnlen(zone, sizeof(data) - EVENT_HEADER_BYTES);
+    memcpy(data, &seconds, 4);
+    memcpy(data + 4, &latE7, 4);
+    memcpy(data + 8, &lonE7, 4);
+    memcpy(data + EVENT_HEADER_BYTES, zone, nameLength);
+
+    if (journal.pending() == 0)
+        oldestMs = millis();
+    journal.append(type, data, EVENT_HEADER_BYTES + nameLength);
+    journal.commit();
+    lastCommitMs = millis();
+    eventWaiting = true;
+}
+
+void TrackUpload::setLatest(double lat, double lon, const String &dateTime)
+{
+    latestLat = lat;
+    latestLon = lon;
+    latestDateTime = dateTime;
+    latestPending = true;
+}
+
+bool TrackUpload::due() const
+{
+    uint32_t waiting = journal.pending();
+    if (waiting == 0 || (failed && millis() - lastFailMs < TRACK_UPLOAD_RETRY_MS))
+        return false;
+    if (backlog || waiting >= TRACK_UPLOAD_BATCH)
+        return millis() - lastFlushMs >= TRACK_UPLOAD_DRAIN_MS;
+    return eventWaiting || millis() - oldestMs >= TRACK_UPLOAD_MAX_AGE_MS;
+}
+
+static const char *eventType(uint8_t type)
+{
+    switch (type)
+    {
+    case TRACK_RECORD_ENTER:
+        return "enter";
+    case TRACK_RECORD_EXIT:
+        return "exit";
+    default:
+        return "violation";
+    }
+}
+
+bool TrackUpload::flush(FirebaseData &fbdo, const String &vehicle)
+{
+    static JournalRecord records[TRACK_UPLOAD_DRAIN_BATCH];
+    journal.commit();
+    lastCommitMs = millis();
+    size_t count = journal.read(records, TRACK_UPLOAD_DRAIN_BATCH);
+    if (count == 0 && !latestPending)
+        return true;
+
+    // Keys with slashes are paths: RTDB writes each one and leaves the rest
+    // of the tree alone
+    FirebaseJson json;
+    String trackPrefix = String(trackRoot) + "/" + vehicle + "/";
+    String eventPrefix = String(eventRoot) + "/" + vehicle + "/";
+    char key[24];
+    for (size_t i = 0; i < count; i++)
+    {
+        const JournalRecord &record = records[i];
+        uint32_t seconds;
+        int32_t latE7, lonE7;
+        memcpy(&seconds, record.data, 4);
+        FirebaseJson value;
+
+        if (record.type == TRACK_RECORD_FIX && record.length == FIX_BYTES)
+        {
+            uint16_t speedCmps, courseCdeg;
+            memcpy(&latE7, record.data + 5, 4);
+            memcpy(&lonE7, record.data + 9, 4);
+            memcpy(&speedCmps, record.data + 13, 2);
+            memcpy(&courseCdeg, record.data + 15, 2);
+            snprintf(key, sizeof(key), "%lu%02u", (unsigned long)seconds, (unsigned)record.data[4]);
+            value.add("lat", geofenceFromE7(latE7));
+            value.add("lon", geofenceFromE7(lonE7));
+            value.add("speed", speedCmps / 100.0);
+            value.add("course", courseCdeg / 100.0);
+            json.add(trackPrefix + key, value);
+        }
+        else if (record.type != TRACK_RECORD_FIX && record.length >= EVENT_HEADER_BYTES)
+        {
+            memcpy(&latE7, record.data + 4, 4);
+            memcpy(&lonE7, record.data + 8, 4);
+            String zone;
+            for (size_t c = EVENT_HEADER_BYTES; c < record.length; c++)
+                zone += (char)record.data[c];
+            snprintf(key, sizeof(key), "%lu_%lu", (unsigned long)seconds, (unsigned long)record.seq);
+            value.add("type", eventType(record.type));
+            value.add("zone", zone);
+            value.add("time", (int)seconds);
+            value.add("lat", geofenceFromE7(latE7));
+            value.add("lon", geofenceFromE7(lonE7));
+            json.add(eventPrefix + key, value);
+        }
+    }
+    if (latestPending)
+    {
+        json.add("gps_data/latitude", latestLat);
+        json.add("gps_data/longitude", latestLon);
+        json.add("gps_data/date_time", latestDateTime);
+    }
+
+    lastFlushMs = millis();
+    if (!Firebase.RTDB.updateNode(&fbdo, "/", &json))
+    {
+        failed = true;
+        lastFailMs = millis();
+        return false;
+    }
+
+    // A failed ack only means this batch goes again, to the same keys
+    if (count > 0)
+        journal.ack(records[count - 1].seq);
+    flushCount++;
+    sentCount += count;
+    batchCount = count;
+    backlog = count == TRACK_UPLOAD_DRAIN_BATCH;
+    failed = false;
+    eventWaiting = false;
+    latestPending = false;
+    if (journal.pending() > 0)
+        oldestMs = millis();
+    return true;
+}
@@ -0,0 +1,662 @@
+#include "zone_sync.h"
+
+#include <algorithm>
+
+static void parseCoordinates(String coord, double &lat, double &lon)
+{
+    int commaIndex = coord.indexOf(',');
+    if (commaIndex != -1)
+    {
+        lat = coord.substring(0, commaIndex).toDouble();
+        lon = coord.substring(commaIndex + 1).toDouble();
+    }
+}
+
+// Document id from "projects/.../documents/<collection>/<id>"
+static std::string documentId(const char *name)
+{
+    const char *slash = strrchr(name, '/');
+    return slash ? slash + 1 : name;
+}
+
+// JsonDocument capacities. Every value costs a slot in ArduinoJson 6, so the
+// size of the text says little: Firestore wraps each field in a one-member
+// object like {"integerValue": "30"}, which can take more room parsed than
+// as text. These are instead counted from what the filters keep, and the
+// payload is parsed in place so its strings are not copied into the
+// document as well.
+//
+// One zone document: name, updateTime and fields, the wrapper of each field
+// read, and a polygon of MAX_GEOFENCE_VERTICES vertices (about 2.4 KB on the
+// ESP32, for about 4 KB of text)
+#define ZONE_FIELDS 9 // name, vertices, c1..c4, dwell limit, stamp, tombstone
+static const size_t zoneCapacity = JSON_OBJECT_SIZE(3) + JSON_OBJECT_SIZE(ZONE_FIELDS) +
+                                   ZONE_FIELDS * JSON_OBJECT_SIZE(1) + JSON_OBJECT_SIZE(1) +
+                                   JSON_ARRAY_SIZE(MAX_GEOFENCE_VERTICES) +
+                                   MAX_GEOFENCE_VERTICES * JSON_OBJECT_SIZE(1);
+
+// A page of the full load: documents and nextPageToken
+static const size_t loadPageCapacity = JSON_OBJECT_SIZE(2) + JSON_ARRAY_SIZE(ZONE_SYNC_LOAD_PAGE_SIZE) +
+                                       ZONE_SYNC_LOAD_PAGE_SIZE * zoneCapacity;
+
+// A page of the reconcile listing: name and updateTime per document
+static const size_t listPageCapacity = JSON_OBJECT_SIZE(2) + JSON_ARRAY_SIZE(ZONE_SYNC_PAGE_SIZE) +
+                                       ZONE_SYNC_PAGE_SIZE * JSON_OBJECT_SIZE(2);
+
+// The change query: per row the document's name and updateTime, and its stamp
+// and tombstone fields
+static const size_t changesCapacity =
+    JSON_ARRAY_SIZE(ZONE_SYNC_MAX_DELTA + 1) +
+    (ZONE_SYNC_MAX_DELTA + 1) * (JSON_OBJECT_SIZE(1) + JSON_OBJECT_SIZE(3) + JSON_OBJECT_SIZE(2) + 2 * JSON_OBJECT_SIZE(1));
+
+// Keep only what addZone() and the document table read
+static void filterZone(JsonObject document)
+{
+    document["name"] = true;
+    document["updateTime"] = true;
+    JsonObject fields = document.createNestedObject("fields");
+    const char *kept[] = {"name", "vertices", "c1", "c2", "c3", "c4", "dwell_limit_seconds",
+                          ZONE_SYNC_STAMP_FIELD, ZONE_SYNC_TOMBSTONE_FIELD};
+    for (const char *field : kept)
+        fields[field] = true;
+}
+
+// Parse the response in place (strings stay in payload, which must outlive
+// doc). Returns false, having logged why, if it does not parse or fit.
+static bool parsePayload(JsonDocument &doc, String &payload, JsonDocument &filter, const char *what)
+{
+    DeserializationError error = deserializeJson(doc, payload.begin(), DeserializationOption::Filter(filter));
+    if (!error)
+        return true;
+    Serial.printf("Failed to parse %s: %s (%u bytes)\n", what, error.c_str(), (unsigned)payload.length());
+    return false;
+}
+
+// Sort key for a Firestore timestamp. Firestore drops trailing zeros from the
+// fraction, so the text alone does not sort; pad it to nine digits.
+static std::string stampKey(const std::string &stamp)
+{
+    size_t end = stamp.find('Z');
+    if (end == std::string::npos)
+        return stamp;
+    size_t dot = stamp.find('.');
+    std::string fraction = dot == std::string::npos ? "" : stamp.substr(dot + 1, end - dot - 1);
+    fraction.resize(9, '0');
+    return stamp.substr(0, dot == std::string::npos ? end : dot) + "." + fraction;
+}
+
+// Keep the later of newest and the document's ZONE_SYNC_STAMP_FIELD
+static void noteStamp(std::string &newest, JsonObject fields)
+{
+    const char *stamp = fields[ZONE_SYNC_STAMP_FIELD]["timestampValue"];
+    if (stamp && (newest.empty() || stampKey(stamp) > stampKey(newest)))
+        newest = stamp;
+}
+
+// Optional per-zone "dwell_limit_seconds". Firestore sends integerValue as a
+// string; doubleValue and stringValue are accepted as well.
+static uint32_t dwellLimit(JsonObject value)
+{
+    long seconds = 0;
+    if (value.containsKey("integerValue"))
+        seconds = String(value["integerValue"].as<const char *>()).toInt();
+    else if (value.containsKey("doubleValue"))
+        seconds = value["doubleValue"].as<long>();
+    else if (value.containsKey("stringValue"))
+        seconds = String(value["stringValue"].as<const char *>()).toInt();
+    return seconds > 0 ? (uint32_t)seconds : GEOFENCE_DEFAULT_DWELL_S;
+}
+
+static bool byId(const std::string &a, const std::string &b)
+{
+    return a < b;
+}
+
+// Cache file on flash through the Firebase client's file layer
+class FlashCacheStream : public GeofenceCacheStream
+{
+public:
+    FlashCacheStream(MB_FS &fs, size_t size) : fs(fs), left(size) {}
+
+    size_t read(void *data, size_t size)
+    {
+        int n = fs.read(mbfs_flash, (uint8_t *)data, size);
+        n = n < 0 ? 0 : n;
+        left -= (size_t)n < left ? (size_t)n : left;
+        return (size_t)n;
+    }
+
+    size_t write(const void *data, size_t size)
+    {
+        int n = fs.write(mbfs_flash, (uint8_t *)data, size);
+        return n < 0 ? 0 : (size_t)n;
+    }
+
+    size_t available() const { return left; }
+
+private:
+    MB_FS &fs;
+    size_t left;
+};
+
+ZoneSync::ZoneSync(const char *projectId, const char *collection, GeofenceSet &zones, GeofenceIndex &index)
+    : projectId(projectId), collection(collection), zones(zones), index(index), loaded(false), reconciled(false),
+      lastReconcileMs(0), cacheFs(NULL), cachePath(NULL), blobGeneration(0)
+{
+}
+
+void ZoneSync::useCache(MB_FS &fs, const char *path)
+{
+    cacheFs = &fs;
+    cachePath = path;
+}
+
+bool ZoneSync::readCache(const char *path, GeofenceSet &set, GeofenceIndex &grid, std::string &meta)
+{
+    int size = cacheFs->open(path, mbfs_flash, mb_fs_open_mode_read);
+    if (size <= 0)
+        return false;
+
+    FlashCacheStream stream(*cacheFs, (size_t)size);
+    bool ok = GeofenceCache::read(stream, set, &grid, meta);
+    cacheFs->close(mbfs_flash);
+    if (!ok)
+        Serial.printf("Ignoring invalid geofence cache %s\n", path);
+    return ok;
+}
+
+// The document table rides along in the cache's meta block as
+// "id\0updateTime\0" followed by the zone id in 4 little-endian bytes. A
+// first entry with an empty id holds the newest stamp instead of an
+// updateTime.
+bool ZoneSync::applyCache(GeofenceSet &cachedZones, GeofenceIndex &cachedIndex, const std::string &meta)
+{
+    std::vector<ZoneDoc> cachedDocs;
+    std::string cachedSince;
+    for (size_t pos = 0; pos < meta.size();)
+    {
+        ZoneDoc zoneDoc;
+        size_t idEnd = meta.find('\0', pos);
+        size_t timeEnd = idEnd == std::string::npos ? idEnd : meta.find('\0', idEnd + 1);
+        if (timeEnd == std::string::npos || timeEnd + 5 > meta.size())
+            return false;
+        zoneDoc.id = meta.substr(pos, idEnd - pos);
+        zoneDoc.updateTime = meta.substr(idEnd + 1, timeEnd - idEnd - 1);
+        memcpy(&zoneDoc.zone, &meta[timeEnd + 1], sizeof(zoneDoc.zone));
+        if (zoneDoc.zone != UINT32_MAX && zoneDoc.zone >= cachedZones.size())
+            return false;
+        if (zoneDoc.id.empty())
+            cachedSince = zoneDoc.updateTime;
+        else
+            cachedDocs.push_back(zoneDoc);
+        pos = timeEnd + 5;
+    }
+
+    // Images written before the grid was stored need it built here
+    if (cachedIndex.cellCount() == 0)
+        cachedIndex.build(cachedZones);
+
+    std::swap(zones, cachedZones);
+    std::swap(index, cachedIndex);
+    docs.swap(cachedDocs);
+    changedSince = cachedSince;
+    loaded = true;
+    reconciled = false;
+    return true;
+}
+
+bool ZoneSync::loadCache()
+{
+    if (cacheFs == NULL)
+        return false;
+
+    GeofenceSet cachedZones;
+    GeofenceIndex cachedIndex;
+    std::string meta;
+    unsigned long generation = 0;
+    if (readCache(cachePath, cachedZones, cachedIndex, meta))
+    {
+        generation = readGeneration();
+    }
+    else
+    {
+        // A reset between removing the old cache and renaming a validated
+        // blob over it leaves the blob under its download name
+        String newPath = String(cachePath) + ZONE_SYNC_NEW_SUFFIX;
+        if (!readCache(newPath.c_str(), cachedZones, cachedIndex, meta) || !replaceCache(newPath.c_str()))
+            return false;
+    }
+    if (!applyCache(cachedZones, cachedIndex, meta))
+        return false;
+
+    blobGeneration = generation;
+    Serial.printf("Loaded %u geofences from cache\n", (unsigned)zones.liveCount());
+    return true;
+}
+
+// LittleFS renames over an existing file in one step; SPIFFS will not, so
+// the old cache is removed first
+bool ZoneSync::replaceCache(const char *newPath)
+{
+    if (cacheFs->rename(newPath, cachePath, mbfs_flash))
+        return true;
+    return cacheFs->remove(cachePath, mbfs_flash) && cacheFs->rename(newPath, cachePath, mbfs_flash);
+}
+
+// The generation of the compiled blob in the cache file, 0 if unknown
+unsigned long ZoneSync::readGeneration()
+{
+    String path = String(cachePath) + ZONE_SYNC_GENERATION_SUFFIX;
+    unsigned long generation = 0;
+    bool ok = cacheFs->open(path.c_str(), mbfs_flash, mb_fs_open_mode_read) == (int)sizeof(generation) &&
+              cacheFs->read(mbfs_flash, (uint8_t *)&generation, sizeof(generation)) == (int)sizeof(generation);
+    cacheFs->close(mbfs_flash);
+    return ok ? generation : 0;
+}
+
+void ZoneSync::saveGeneration(unsigned long generation)
+{
+    String path = String(cachePath) + ZONE_SYNC_GENERATION_SUFFIX;
+    bool ok = cacheFs->open(path.c_str(), mbfs_flash, mb_fs_open_mode_write) == 0 &&
+              cacheFs->write(mbfs_flash, (uint8_t *)&generation, sizeof(generation)) == (int)sizeof(generation);
+    cacheFs->close(mbfs_flash);
+    if (!ok)
+        Serial.println("Failed to save compiled geofence generation");
+}
+
+void ZoneSync::saveCache()
+{
+    if (cacheFs == NULL)
+        return;
+
+    std::string meta;
+    uint32_t noZone = UINT32_MAX;
+    meta.push_back('\0');
+    meta.append(changedSince).push_back('\0');
+    meta.append((const char *)&noZone, sizeof(noZone));
+    for (const ZoneDoc &zoneDoc : docs)
+    {
+        meta.append(zoneDoc.id).push_back('\0');
+        meta.append(zoneDoc.updateTime).push_back('\0');
+        meta.append((const char *)&zoneDoc.zone, sizeof(zoneDoc.zone));
+    }
+
+    // The cache no longer holds a compiled blob. A write cut short by a reset
+    // fails the checksum on the next boot, which then falls back to a full
+    // download.
+    cacheFs->remove((String(cachePath) + ZONE_SYNC_GENERATION_SUFFIX).c_str(), mbfs_flash);
+    if (cacheFs->open(cachePath, mbfs_flash, mb_fs_open_mode_write) < 0)
+    {
+        Serial.println("Failed to open geofence cache");
+        return;
+    }
+    FlashCacheStream stream(*cacheFs, 0);
+    if (!GeofenceCache::write(stream, zones, &index, meta))
+        Serial.println("Failed to write geofence cache");
+    cacheFs->close(mbfs_flash);
+}
+
+uint32_t ZoneSync::addZone(GeofenceSet &set, JsonObject fields)
+{
+    if (fields[ZONE_SYNC_TOMBSTONE_FIELD]["booleanValue"] | false)
+        return UINT32_MAX;
+
+    double lats[MAX_GEOFENCE_VERTICES], lons[MAX_GEOFENCE_VERTICES];
+    size_t count = 0;
+
+    // Polygons list their corners in order in the "vertices" array;
+    // older zones only have the four corner fields c1..c4
+    JsonArray vertices = fields["vertices"]["arrayValue"]["values"].as<JsonArray>();
+    if (!vertices.isNull())
+    {
+        for (JsonObject vertex : vertices)
+        {
+            if (count == MAX_GEOFENCE_VERTICES)
+                break;
+            lats[count] = lons[count] = 0;
+            parseCoordinates(vertex["stringValue"].as<String>(), lats[count], lons[count]);
+            count++;
+        }
+    }
+    else
+    {
+        const char *corners[] = {"c1", "c2", "c3", "c4"};
+        for (const char *corner : corners)
+        {
+            lats[count] = lons[count] = 0;
+            parseCoordinates(fields[corner]["stringValue"].as<String>(), lats[count], lons[count]);
+            count++;
+        }
+    }
+
+    String name = fields["name"]["stringValue"].as<String>();
+    int zone = set.add(name.c_str(), lats, lons, count, dwellLimit(fields["dwell_limit_seconds"]));
+    if (zone < 0)
+    {
+        Serial.println("Skipping degenerate geofence: " + name);
+        return UINT32_MAX;
+    }
+
+    for (size_t i = 0; i < count; i++)
+        Serial.printf("Geofence: %s, v%u: %.6f, %.6f\n", name.c_str(), (unsigned)(i + 1), lats[i], lons[i]);
+    return (uint32_t)zone;
+}
+
+bool ZoneSync::fullLoad(FirebaseData &fbdo)
+{
+    Serial.println("Fetching geofences from Firestore...");
+
+    StaticJsonDocument<384> filter;
+    filterZone(filter["documents"].createNestedObject());
+    filter["nextPageToken"] = true;
+    DynamicJsonDocument page(loadPageCapacity);
+
+    // Zones go into a staging set so a failed page keeps the current ones
+    GeofenceSet loadedZones;
+    std::vector<ZoneDoc> loadedDocs;
+    std::string loadedSince;
+    String pageToken = "";
+    do
+    {
+        if (!Firebase.Firestore.listDocuments(&fbdo, projectId, "", collection, ZONE_SYNC_LOAD_PAGE_SIZE,
+                                              pageToken.c_str(), "", "", false))
+        {
+            Serial.println("Failed to retrieve geofences: " + fbdo.errorReason());
+            return false;
+        }
+
+        String payload = fbdo.payload();
+        if (!parsePayload(page, payload, filter, "geofences"))
+            return false;
+
+        for (JsonObject document : page["documents"].as<JsonArray>())
+        {
+            ZoneDoc zoneDoc;
+            zoneDoc.id = documentId(document["name"] | "");
+            zoneDoc.updateTime = document["updateTime"] | "";
+            zoneDoc.zone = addZone(loadedZones, document["fields"]);
+            noteStamp(loadedSince, document["fields"]);
+            loadedDocs.push_back(zoneDoc);
+        }
+        pageToken = page["nextPageToken"] | "";
+    } while (pageToken.length() > 0);
+
+    std::sort(loadedDocs.begin(), loadedDocs.end(), [](const ZoneDoc &a, const ZoneDoc &b) { return byId(a.id, b.id); });
+    std::swap(zones, loadedZones);
+    docs.swap(loadedDocs);
+    changedSince = loadedSince;
+    index.build(zones);
+    loaded = true;
+    reconciled = true;
+    lastReconcileMs = millis();
+    saveCache();
+    return true;
+}
+
+bool ZoneSync::listDocuments(FirebaseData &fbdo, std::vector<ZoneDoc> &listed)
+{
+    // Only the metadata is kept from each page
+    StaticJsonDocument<128> filter;
+    filter["documents"][0]["name"] = true;
+    filter["documents"][0]["updateTime"] = true;
+    filter["nextPageToken"] = true;
+    DynamicJsonDocument page(listPageCapacity);
+
+    listed.clear();
+    listed.reserve(docs.size());
+    String pageToken = "";
+    do
+    {
+        // Masking to the short "name" field keeps the polygons out of the listing
+        if (!Firebase.Firestore.listDocuments(&fbdo, projectId, "", collection, ZONE_SYNC_PAGE_SIZE,
+                                              pageToken.c_str(), "", "name", false))
+        {
+            Serial.println("Failed to list geofences: " + fbdo.errorReason());
+            return false;
+        }
+
+        String payload = fbdo.payload();
+        if (!parsePayload(page, payload, filter, "geofence list"))
+            return false;
+        for (JsonObject document : page["documents"].as<JsonArray>())
+        {
+            ZoneDoc zoneDoc;
+            zoneDoc.id = documentId(document["name"] | "");
+            zoneDoc.updateTime = document["updateTime"] | "";
+            zoneDoc.zone = UINT32_MAX;
+            listed.push_back(zoneDoc);
+        }
+        pageToken = page["nextPageToken"] | "";
+    } while (pageToken.length() > 0);
+
+    std::sort(listed.begin(), listed.end(), [](const ZoneDoc &a, const ZoneDoc &b) { return byId(a.id, b.id); });
+    return true;
+}
+
+bool ZoneSync::fetchZone(FirebaseData &fbdo, ZoneDoc &zoneDoc)
+{
+    String path = String(collection) + "/" + zoneDoc.id.c_str();
+    if (!Firebase.Firestore.getDocument(&fbdo, projectId, "", path.c_str()))
+    {
+        Serial.println("Failed to retrieve geofence " + path + ": " + fbdo.errorReason());
+        return false;
+    }
+
+    StaticJsonDocument<256> filter;
+    filterZone(filter.to<JsonObject>());
+    DynamicJsonDocument doc(zoneCapacity);
+    String payload = fbdo.payload();
+    if (!parsePayload(doc, payload, filter, path.c_str()))
+        return false;
+    zoneDoc.updateTime = doc["updateTime"] | "";
+    zoneDoc.zone = addZone(zones, doc["fields"]);
+    return true;
+}
+
+bool ZoneSync::sync(FirebaseData &fbdo)
+{
+    if (!loaded)
+        return fullLoad(fbdo);
+    if (!reconciled || millis() - lastReconcileMs >= ZONE_SYNC_RECONCILE_MS)
+        return reconcile(fbdo);
+    return queryChanges(fbdo);
+}
+
+bool ZoneSync::queryChanges(FirebaseData &fbdo)
+{
+    // Documents stamped after the newest change applied, oldest first. One
+    // more than ZONE_SYNC_MAX_DELTA is enough to tell a full reload is due.
+    // Only the stamp and the tombstone come back; a changed polygon is
+    // fetched on its own, so no response holds more than one zone.
+    FirebaseJson query;
+    query.set("select/fields/[0]/fieldPath", ZONE_SYNC_STAMP_FIELD);
+    query.set("select/fields/[1]/fieldPath", ZONE_SYNC_TOMBSTONE_FIELD);
+    query.set("from/[0]/collectionId", collection);
+    query.set("where/fieldFilter/field/fieldPath", ZONE_SYNC_STAMP_FIELD);
+    query.set("where/fieldFilter/op", "GREATER_THAN");
+    query.set("where/fieldFilter/value/timestampValue", changedSince.empty() ? "1970-01-01T00:00:00Z" : changedSince.c_str());
+    query.set("orderBy/[0]/field/fieldPath", ZONE_SYNC_STAMP_FIELD);
+    query.set("orderBy/[0]/direction", "ASCENDING");
+    query.set("limit", ZONE_SYNC_MAX_DELTA + 1);
+    if (!Firebase.Firestore.runQuery(&fbdo, projectId, "", "/", &query))
+    {
+        Serial.println("Failed to query geofence changes: " + fbdo.errorReason());
+        return false;
+    }
+
+    StaticJsonDocument<256> filter;
+    filterZone(filter[0].createNestedObject("document"));
+    DynamicJsonDocument result(changesCapacity);
+    String payload = fbdo.payload();
+    if (!parsePayload(result, payload, filter, "geofence changes"))
+        return false;
+
+    // With no match the response is a single row holding only the read time
+    size_t changed = 0;
+    for (JsonObject row : result.as<JsonArray>())
+        changed += !row["document"].isNull();
+    if (changed == 0)
+        return false;
+    if (changed > ZONE_SYNC_MAX_DELTA)
+        return fullLoad(fbdo);
+
+    // In stamp order, so a failed fetch leaves the rest for the next poll.
+    // A batched write gives several documents the same stamp, so the query
+    // only moves past a stamp once every document at it is applied.
+    Serial.printf("Patching %u changed geofence document(s)\n", (unsigned)changed);
+    size_t applied = 0;
+    std::string newest = changedSince;   // of the documents applied so far
+    std::string complete = changedSince; // every document up to this stamp is applied
+    for (JsonObject row : result.as<JsonArray>())
+    {
+        JsonObject document = row["document"];
+        if (document.isNull())
+            continue;
+
+        std::string stamp;
+        noteStamp(stamp, document["fields"]);
+        if (stampKey(stamp) != stampKey(newest))
+            complete = newest;
+
+        ZoneDoc zoneDoc;
+        zoneDoc.id = documentId(document["name"] | "");
+        zoneDoc.updateTime = document["updateTime"] | "";
+        zoneDoc.zone = UINT32_MAX; // a tombstone stays in the table with no zone, as in a listing
+        bool tombstone = document["fields"][ZONE_SYNC_TOMBSTONE_FIELD]["booleanValue"] | false;
+        if (!tombstone && !fetchZone(fbdo, zoneDoc))
+        {
+            newest = complete;
+            break;
+        }
+
+        std::vector<ZoneDoc>::iterator known =
+            std::lower_bound(docs.begin(), docs.end(), zoneDoc, [](const ZoneDoc &a, const ZoneDoc &b) { return byId(a.id, b.id); });
+        bool found = known != docs.end() && known->id == zoneDoc.id;
+        if (found && known->zone != UINT32_MAX)
+            zones.remove(known->zone);
+        if (found)
+            *known = zoneDoc;
+        else
+            docs.insert(known, zoneDoc);
+        noteStamp(newest, document["fields"]);
+        applied++;
+    }
+    changedSince = newest;
+    if (applied == 0)
+        return false;
+    compactIfSparse();
+    index.build(zones);
+    saveCache();
+    return true;
+}
+
+bool ZoneSync::reconcile(FirebaseData &fbdo)
+{
+    std::vector<ZoneDoc> listed;
+    if (!listDocuments(fbdo, listed))
+        return false;
+    reconciled = true;
+    lastReconcileMs = millis();
+
+    // Both lists are sorted by id: one merge pass classifies every document
+    size_t delta = 0;
+    for (size_t i = 0, j = 0; i < docs.size() || j < listed.size();)
+    {
+        if (j == listed.size() || (i < docs.size() && byId(docs[i].id, listed[j].id)))
+            delta++, i++; // deleted
+        else if (i == docs.size() || byId(listed[j].id, docs[i].id))
+            delta++, j++; // new
+        else
+            delta += docs[i++].updateTime != listed[j++].updateTime;
+    }
+    if (delta == 0)
+        return false;
+    if (delta > ZONE_SYNC_MAX_DELTA)
+        return fullLoad(fbdo);
+
+    Serial.printf("Reconciling %u geofence document(s)\n", (unsigned)delta);
+    for (size_t i = 0, j = 0; i < docs.size() || j < listed.size();)
+    {
+        bool deleted = j == listed.size() || (i < docs.size() && byId(docs[i].id, listed[j].id));
+        bool added = !deleted && (i == docs.size() || byId(listed[j].id, docs[i].id));
+
+        if (deleted || (!added && docs[i].updateTime != listed[j].updateTime))
+        {
+            if (docs[i].zone != UINT32_MAX)
+                zones.remove(docs[i].zone);
+        }
+        if (!deleted && !added && docs[i].updateTime == listed[j].updateTime)
+            listed[j].zone = docs[i].zone;
+        else if (!deleted && !fetchZone(fbdo, listed[j]))
+        {
+            listed[j].updateTime.clear(); // retried on the next poll
+            reconciled = false;
+        }
+
+        if (!added)
+            i++;
+        if (!deleted)
+            j++;
+    }
+    docs.swap(listed);
+    compactIfSparse();
+    index.build(zones);
+    saveCache();
+    return true;
+}
+
+bool ZoneSync::syncCompiled(FirebaseData &fbdo, const char *bucket, const char *object)
+{
+    if (cacheFs == NULL)
+        return false;
+
+    if (!Firebase.Storage.getMetadata(&fbdo, bucket, object))
+    {
+        Serial.println("Failed to check compiled geofences: " + fbdo.errorReason());
+        return false;
+    }
+    unsigned long generation = fbdo.metaData().generation;
+    if (loaded && generation == blobGeneration)
+        return false;
+
+    // Download beside the cache, which is only replaced once the blob reads
+    // back whole, so a failed or corrupt download keeps the last good set
+    String newPath = String(cachePath) + ZONE_SYNC_NEW_SUFFIX;
+    Serial.println("Downloading compiled geofences...");
+    if (!Firebase.Storage.download(&fbdo, bucket, object, newPath.c_str(), mem_storage_type_flash))
+    {
+        Serial.println("Failed to download compiled geofences: " + fbdo.errorReason());
+        return false;
+    }
+
+    GeofenceSet blobZones;
+    GeofenceIndex blobIndex;
+    std::string meta;
+    if (!readCache(newPath.c_str(), blobZones, blobIndex, meta) || !applyCache(blobZones, blobIndex, meta))
+        return false;
+
+    // The generation is only recorded next to the blob it belongs to
+    blobGeneration = generation;
+    if (replaceCache(newPath.c_str()))
+        saveGeneration(generation);
+    else
+        Serial.println("Failed to replace geofence cache");
+    Serial.printf("Loaded %u compiled geofences\n", (unsigned)zones.liveCount());
+    return true;
+}
+
+// Removed zones still occupy their slots; once they make up half the set,
+// renumber the live ones and fix up the stored ids
+void ZoneSync::compactIfSparse()
+{
+    if (zones.removedZones() == 0 || zones.removedZones() * 2 < zones.size())
+        return;
+
+    std::vector<uint32_t> remap;
+    zones.compact(&remap);
+    for (ZoneDoc &zoneDoc : docs)
+    {
+        if (zoneDoc.zone != UINT32_MAX)
+            zoneDoc.zone = remap[zoneDoc.zone];
+    }
+}
@@ -0,0 +1,167 @@
+// Host-side benchmark for the batch distance functions.
+//
+// Build and run from the hardware directory:
+//   pio run -e distance_bench -t exec
+// or directly:
+//   g++ -O2 -march=native -std=c++17 -Itools/host -Ilib/Geofence/src -Ilib/TinyGPSPlus/src
+//       -o distance_bench tools/distance_bench.cpp lib/Geofence/src/geofence.cpp
+//       lib/Geofence/src/geofence_distance.cpp lib/TinyGPSPlus/src/TinyGPS++.cpp
+//   ./distance_bench
+// Leave out -march=native to measure the scalar kernels.
+//
+// The first table is throughput: a million points around one reference,
+// through TinyGPSPlus::distanceBetween() one call at a time and through
+// geofenceDistances() in each mode. The second is the largest relative error
+// of each mode against the exact great-circle distance (long double), over
+// random pairs in distance and latitude bands; these back the bounds quoted
+// in geofence_distance.h.
+
+#include "geofence_distance.h"
+#include "TinyGPS++.h"
+
+#include <chrono>
+#include <math.h>
+#include <random>
+#include <stdio.h>
+#include <vector>
+
+#define POINTS 1000000
+#define ROUNDS 5
+#define REFERENCES 200
+#define PAIRS_PER_REFERENCE 500
+
+static const char *modeNames[] = {"haversine", "equirectangular", "local plane"};
+
+static long double exactMeters(int32_t lat1, int32_t lon1, int32_t lat2, int32_t lon2)
+{
+    const long double toRadians = 3.14159265358979323846264338327950288L / 180 / GEOFENCE_E7;
+    long double p1 = lat1 * toRadians, p2 = lat2 * toRadians;
+    long double dLat = sinl((p2 - p1) / 2), dLon = sinl(((int64_t)lon2 - lon1) * toRadians / 2);
+    long double h = dLat * dLat + cosl(p1) * cosl(p2) * dLon * dLon;
+    return 2 * GEOFENCE_EARTH_RADIUS_M * asinl(sqrtl(h < 1 ? h : 1));
+}
+
+// Point at the given distance and course from (lat, lon) on the sphere
+static void destination(double lat, double lon, double meters, double course, int32_t &outLat, int32_t &outLon)
+{
+    double p1 = lat * M_PI / 180, l1 = lon * M_PI / 180, a = meters / GEOFENCE_EARTH_RADIUS_M;
+    double p2 = asin(sin(p1) * cos(a) + cos(p1) * sin(a) * cos(course));
+    double l2 = l1 + atan2(sin(course) * sin(a) * cos(p1), cos(a) - sin(p1) * sin(p2));
+    double lonDeg = fmod(l2 * 180 / M_PI + 540, 360) - 180;
+    outLat = geofenceToE7(p2 * 180 / M_PI);
+    outLon = geofenceToE7(lonDeg);
+}
+
+template <typename F>
+static double bestMpointsPerSecond(F run)
+{
+    double best = 0;
+    for (int round = 0; round < ROUNDS; round++)
+    {
+        auto start = std::chrono::steady_clock::now();
+        run();
+        auto end = std::chrono::steady_clock::now();
+        double rate = POINTS / std::chrono::duration<double, std::micro>(end - start).count();
+        if (rate > best)
+            best = rate;
+    }
+    return best;
+}
+
+int main()
+{
+    std::mt19937 rng(17);
+    std::uniform_real_distribution<double> unit(0, 1);
+
+    // Throughput, points within 30 km of a reference in Chennai
+    int32_t lat0 = geofenceToE7(13.0827), lon0 = geofenceToE7(80.2707);
+    std::vector<int32_t> lats(POINTS), lons(POINTS);
+    std::vector<double> latDeg(POINTS), lonDeg(POINTS);
+    for (size_t i = 0; i < POINTS; i++)
+    {
+        destination(13.0827, 80.2707, 30000 * unit(rng), 2 * M_PI * unit(rng), lats[i], lons[i]);
+        latDeg[i] = geofenceFromE7(lats[i]);
+        lonDeg[i] = geofenceFromE7(lons[i]);
+    }
+    std::vector<float> meters(POINTS);
+    volatile double sink = 0;
+
+    printf("kernel: %s\n\n", geofenceDistanceKernel());
+    printf("%-34s %12s\n", "distances", "Mpoints/s");
+    double scalar = bestMpointsPerSecond([&]() {
+        double sum = 0;
+        for (size_t i = 0; i < POINTS; i++)
+            sum += TinyGPSPlus::distanceBetween(13.0827, 80.2707, latDeg[i], lonDeg[i]);
+        sink = sum;
+    });
+    printf("%-34s %12.1f\n", "TinyGPSPlus::distanceBetween", scalar);
+    for (int mode = 0; mode < 3; mode++)
+    {
+        double rate = bestMpointsPerSecond([&]() {
+            geofenceDistances((GeofenceDistanceMode)mode, lat0, lon0, lats.data(), lons.data(), POINTS, meters.data());
+            sink = meters[POINTS / 2];
+        });
+        char name[64];
+        snprintf(name, sizeof(name), "geofenceDistances %s", modeNames[mode]);
+        printf("%-34s %12.1f %7.1fx\n", name, rate, rate / scalar);
+    }
+    double courses = bestMpointsPerSecond([&]() {
+        geofenceCourses(GEOFENCE_DISTANCE_LOCAL_PLANE, lat0, lon0, lats.data(), lons.data(), POINTS, meters.data());
+        sink = meters[POINTS / 2];
+    });
+    printf("%-34s %12.1f\n", "geofenceCourses local plane", courses);
+
+    // Agreement of the haversine mode with TinyGPS++
+    double worstTiny = 0;
+    geofenceDistances(GEOFENCE_DISTANCE_HAVERSINE, lat0, lon0, lats.data(), lons.data(), POINTS, meters.data());
+    for (size_t i = 0; i < POINTS; i += 97)
+    {
+        double tiny = TinyGPSPlus::distanceBetween(geofenceFromE7(lat0), geofenceFromE7(lon0), latDeg[i], lonDeg[i]);
+        if (tiny > 1)
+            worstTiny = fmax(worstTiny, fabs(meters[i] - tiny) / tiny);
+    }
+    printf("\nhaversine vs TinyGPSPlus::distanceBetween: max relative difference %.1e\n\n", worstTiny);
+
+    // Error bands
+    static const double bands[][2] = {{10, 1000}, {1000, 10000}, {10000, 100000}, {100000, 1000000}};
+    static const double latitudes[] = {30, 70};
+    printf("%-16s %-14s %14s %14s %14s\n", "max |lat| (deg)", "distance (m)", modeNames[0], modeNames[1], modeNames[2]);
+    std::vector<int32_t> bandLats(PAIRS_PER_REFERENCE), bandLons(PAIRS_PER_REFERENCE);
+    std::vector<float> results(PAIRS_PER_REFERENCE);
+    for (double maxLat : latitudes)
+    {
+        for (const auto &band : bands)
+        {
+            double worst[3] = {0, 0, 0};
+            for (int r = 0; r < REFERENCES; r++)
+            {
+                // Keep the whole band inside the latitude limit
+                double reach = band[1] / GEOFENCE_EARTH_RADIUS_M * 180 / M_PI;
+                double lat = (2 * unit(rng) - 1) * (maxLat - reach);
+                double lon = 360 * unit(rng) - 180;
+                int32_t refLat = geofenceToE7(lat), refLon = geofenceToE7(lon);
+                for (int k = 0; k < PAIRS_PER_REFERENCE; k++)
+                {
+                    double d = band[0] * pow(band[1] / band[0], unit(rng));
+                    destination(lat, lon, d, 2 * M_PI * unit(rng), bandLats[k], bandLons[k]);
+                }
+                for (int mode = 0; mode < 3; mode++)
+                {
+                    geofenceDistances((GeofenceDistanceMode)mode, refLat, refLon, bandLats.data(), bandLons.data(),
+                                      PAIRS_PER_REFERENCE, results.data());
+                    for (int k = 0; k < PAIRS_PER_REFERENCE; k++)
+                    {
+                        long double truth = exactMeters(refLat, refLon, bandLats[k], bandLons[k]);
+                        double error = (double)(fabsl(results[k] - truth) / truth);
+                        worst[mode] = fmax(worst[mode], error);
+                    }
+                }
+            }
+            char range[32];
+            snprintf(range, sizeof(range), "%.0f-%.0f", band[0], band[1]);
+            printf("%-16.0f %-14s %13.5f%% %13.5f%% %13.5f%%\n", maxLat, range,
+                   100 * worst[0], 100 * worst[1], 100 * worst[2]);
+        }
+    }
+    return 0;
+}
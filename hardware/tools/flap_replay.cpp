@@ -0,0 +1,447 @@
+// Host-side replay of GNSS traces through the zone logic, with and without
+// the smoothing filter and entry/exit hysteresis.
+//
+// Build and run from the hardware directory:
+//   pio run -e flap_replay -t exec
+// or directly:
+//   g++ -O2 -std=c++17 -Itools/host -Ilib/Geofence/src -Ilib/TinyGPSPlus/src -o flap_replay
+//       tools/flap_replay.cpp lib/Geofence/src/geofence.cpp lib/Geofence/src/geofence_cache.cpp
+//       lib/Geofence/src/geofence_filter.cpp lib/TinyGPSPlus/src/TinyGPS++.cpp
+//   ./flap_replay [trace.nmea geofences.bin]
+//
+// With a trace (raw receiver output, NMEA or UBX) and a zone image from
+// tools/zone_compiler.cpp, every fix is evaluated twice: on the raw position,
+// as the firmware used to, and on the filtered position through
+// GeofenceHysteresis. Prints the zone entries, exits, violations and Firestore
+// writes each way.
+//
+// Without arguments, simulates a 200 x 20 m no-parking strip and a receiver
+// at 1 Hz with HDOP-scaled white noise, a slowly wandering bias and the odd
+// multipath jump, over a few drives: parked just outside and just inside the
+// strip, driving along its edge, and crossing it. The noise-free track gives
+// the true number of crossings. Exits non-zero if the filtered path does not
+// match it in every scenario. The drives keep 2 m or more from the line: any
+// closer and the receiver's bias alone decides the side, filter or not.
+//
+// No recorded trace ships with the tool, so the default run only checks the
+// filter and hysteresis against this simulated receiver. A real capture has
+// to be replayed by hand before tuning them further.
+//
+// Writes are counted the way main.cpp makes them: an entry creates a
+// geofence_entries document; a violation creates the violation record; and
+// leaving deletes the entry, in one commit with the violation's exit time if
+// there is one.
+
+#include "geofence.h"
+#include "geofence_cache.h"
+#include "geofence_filter.h"
+#include "TinyGPS++.h"
+
+#include <math.h>
+#include <random>
+#include <stdio.h>
+#include <string>
+#include <vector>
+
+#define ORIGIN_LAT 13.0400
+#define ORIGIN_LON 80.2400
+#define STRIP_LENGTH_M 200.0
+#define STRIP_WIDTH_M 20.0
+#define DWELL_S 120
+
+struct Fix
+{
+    uint32_t ms;
+    int32_t lat, lon;
+    float hdop; // 0 if unknown
+    bool velocityValid;
+    float speedMps, courseDeg;
+    bool inside; // noise-free position, synthetic traces only
+};
+
+struct Counts
+{
+    uint32_t entries, exits, violations, writes;
+};
+
+// Stays and their writes, as checkGeofence() and checkDwell() make them
+class ZoneLog
+{
+public:
+    ZoneLog() : counts() {}
+
+    void update(const GeofenceHits &hits, uint32_t seconds)
+    {
+        size_t i = 0, j = 0;
+        std::vector<Stay> next;
+        while (i < stays.size() || j < hits.count)
+        {
+            if (j == hits.count || (i < stays.size() && stays[i].zone < hits.zones[j]))
+            {
+                counts.exits++;
+                counts.writes++; // delete the entry and close any violation
+                i++;
+            }
+            else if (i == stays.size() || hits.zones[j] < stays[i].zone)
+            {
+                counts.entries++;
+                counts.writes++; // create the entry
+                next.push_back({hits.zones[j++], seconds, false});
+            }
+            else
+            {
+                next.push_back(stays[i++]);
+                j++;
+            }
+        }
+        stays.swap(next);
+
+        for (Stay &stay : stays)
+        {
+            if (!stay.violated && seconds - stay.entrySeconds >= DWELL_S)
+            {
+                stay.violated = true;
+                counts.violations++;
+                counts.writes++; // create the violation
+            }
+        }
+    }
+
+    GeofenceHits current() const
+    {
+        GeofenceHits hits;
+        for (const Stay &stay : stays)
+            hits.add(stay.zone);
+        return hits;
+    }
+
+    Counts counts;
+
+private:
+    struct Stay
+    {
+        uint32_t zone;
+        uint32_t entrySeconds;
+        bool violated;
+    };
+    std::vector<Stay> stays;
+};
+
+struct Result
+{
+    Counts raw, filtered, truth;
+    uint32_t suppressed, rejected;
+};
+
+static Result replay(const std::vector<Fix> &fixes, const GeofenceSet &zones, const GeofenceIndex &index)
+{
+    ZoneLog raw, filtered, truth;
+    GeofenceFilter filter;
+    GeofenceHysteresis hysteresis;
+    GeofenceHits observed;
+    for (const Fix &fix : fixes)
+    {
+        uint32_t seconds = fix.ms / 1000;
+        index.findAll(zones, fix.lat, fix.lon, observed);
+        raw.update(observed, seconds);
+
+        filter.update(fix.ms, fix.lat, fix.lon, fix.hdop);
+        if (fix.velocityValid)
+            filter.updateVelocity(fix.speedMps, fix.courseDeg);
+        int32_t lat = filter.latE7(), lon = filter.lonE7();
+        index.findAll(zones, lat, lon, observed);
+        filtered.update(hysteresis.update(zones, filtered.current(), observed, lat, lon, filter.sigmaMeters()), seconds);
+
+        GeofenceHits real;
+        if (fix.inside)
+            real.add(0);
+        truth.update(real, seconds);
+    }
+    return {raw.counts, filtered.counts, truth.counts, hysteresis.suppressed(), filter.rejected()};
+}
+
+static void printHeader()
+{
+    printf("%-28s %-9s %8s %8s %10s %8s\n", "trace", "path", "entries", "exits", "violations", "writes");
+}
+
+static void printRow(const char *name, const char *path, const Counts &c)
+{
+    printf("%-28s %-9s %8u %8u %10u %8u\n", name, path, c.entries, c.exits, c.violations, c.writes);
+}
+
+// Recorded trace: one fix per new location from TinyGPS++
+static bool readTrace(const char *path, std::vector<Fix> &fixes)
+{
+    FILE *in = fopen(path, "rb");
+    if (!in)
+    {
+        perror(path);
+        return false;
+    }
+
+    TinyGPSPlus gps;
+    char block[64];
+    size_t n;
+    uint32_t day = 0, lastTime = UINT32_MAX;
+    while ((n = fread(block, 1, sizeof(block), in)) > 0)
+    {
+        for (size_t i = 0; i < n; i++)
+        {
+            if (!gps.encode(block[i]) || !gps.location.isUpdated() || !gps.location.isValid() || !gps.time.isValid())
+                continue;
+            uint32_t time = gps.time.value();
+            if (time == lastTime)
+                continue;
+            if (lastTime != UINT32_MAX && time < lastTime)
+                day++; // past midnight
+            lastTime = time;
+
+            Fix fix = {};
+            fix.ms = day * 86400000u + gps.time.hour() * 3600000u + gps.time.minute() * 60000u +
+                     gps.time.second() * 1000u + gps.time.centisecond() * 10u;
+            fix.lat = (int32_t)lround(gps.location.lat() * GEOFENCE_E7);
+            fix.lon = (int32_t)lround(gps.location.lng() * GEOFENCE_E7);
+            fix.hdop = gps.hdop.isValid() ? (float)gps.hdop.hdop() : 0;
+            fix.velocityValid = gps.speed.isValid() && gps.course.isValid();
+            fix.speedMps = (float)gps.speed.mps();
+            fix.courseDeg = (float)gps.course.deg();
+            fixes.push_back(fix);
+        }
+    }
+    fclose(in);
+    return true;
+}
+
+static int replayRecorded(const char *tracePath, const char *zonesPath)
+{
+    GeofenceCacheMapping mapping;
+    GeofenceSet zones;
+    GeofenceIndex index;
+    std::string meta;
+    if (!mapping.open(zonesPath))
+    {
+        perror(zonesPath);
+        return 1;
+    }
+    GeofenceMemoryStream stream(mapping.data(), mapping.size());
+    if (!GeofenceCache::read(stream, zones, &index, meta))
+    {
+        fprintf(stderr, "%s: not a zone image\n", zonesPath);
+        return 1;
+    }
+    if (index.cellCount() == 0)
+        index.build(zones);
+
+    std::vector<Fix> fixes;
+    if (!readTrace(tracePath, fixes))
+        return 1;
+
+    Result result = replay(fixes, zones, index);
+    printf("%u fixes, %u zones\n\n", (unsigned)fixes.size(), (unsigned)zones.liveCount());
+    printHeader();
+    printRow(tracePath, "raw", result.raw);
+    printRow(tracePath, "filtered", result.filtered);
+    printf("\n%u outliers rejected, %u zone changes held back\n", result.rejected, result.suppressed);
+    return 0;
+}
+
+// Synthetic drives, in metres east and north of the strip's south-west corner
+class Simulator
+{
+public:
+    Simulator(const GeofenceSet &zones, const GeofenceIndex &index, uint32_t seed)
+        : zones(zones), index(index), rng(seed), gauss(0, 1), unit(0, 1), ms(0), x(0), y(0),
+          biasX(0), biasY(0), hdop(1.2)
+    {
+    }
+
+    void jump(double toX, double toY)
+    {
+        x = toX;
+        y = toY;
+    }
+
+    void drive(double toX, double toY, double speedMps)
+    {
+        double dx = toX - x, dy = toY - y, length = sqrt(dx * dx + dy * dy);
+        double course = atan2(dx, dy) * 180 / M_PI;
+        int steps = (int)ceil(length / speedMps);
+        double fromX = x, fromY = y;
+        for (int i = 1; i <= steps; i++)
+        {
+            double t = (double)i / steps;
+            x = fromX + t * dx;
+            y = fromY + t * dy;
+            sample(speedMps, course < 0 ? course + 360 : course);
+        }
+    }
+
+    void park(int seconds)
+    {
+        for (int i = 0; i < seconds; i++)
+            sample(0, 0);
+    }
+
+    std::vector<Fix> fixes;
+
+private:
+    const GeofenceSet &zones;
+    const GeofenceIndex &index;
+    std::mt19937 rng;
+    std::normal_distribution<double> gauss;
+    std::uniform_real_distribution<double> unit;
+    uint32_t ms;
+    double x, y;
+    double biasX, biasY; // slowly wandering error, 1.5 m over about a minute
+    double hdop;
+
+    void sample(double speedMps, double courseDeg)
+    {
+        ms += 1000;
+        hdop = fmin(fmax(hdop + 0.05 * gauss(rng), 0.7), 2.5);
+        double decay = exp(-1.0 / 60);
+        double kick = 1.5 * sqrt(1 - decay * decay);
+        biasX = decay * biasX + kick * gauss(rng);
+        biasY = decay * biasY + kick * gauss(rng);
+
+        double sigma = 1.5 * hdop;
+        double nx = x + biasX + sigma * gauss(rng), ny = y + biasY + sigma * gauss(rng);
+        double reported = hdop;
+        if (unit(rng) < 0.01)
+        {
+            // Multipath: a jump of tens of metres the HDOP does not show
+            double angle = 2 * M_PI * unit(rng), size = 15 + 25 * unit(rng);
+            nx += size * sin(angle);
+            ny += size * cos(angle);
+        }
+
+        Fix fix = {};
+        fix.ms = ms;
+        fix.lat = toLat(ny);
+        fix.lon = toLon(nx);
+        fix.hdop = (float)reported;
+        fix.velocityValid = true;
+        fix.speedMps = (float)fmax(0, speedMps + 0.15 * gauss(rng));
+        fix.courseDeg = (float)(speedMps < 0.5 ? 360 * unit(rng) : fmod(courseDeg + 2 * gauss(rng) + 360, 360));
+        GeofenceHits real;
+        fix.inside = index.findAll(zones, toLat(y), toLon(x), real) > 0;
+        fixes.push_back(fix);
+    }
+
+public:
+    static int32_t toLat(double north)
+    {
+        return geofenceToE7(ORIGIN_LAT) + (int32_t)lround(north / GEOFENCE_METERS_PER_E7);
+    }
+
+    static int32_t toLon(double east)
+    {
+        return geofenceToE7(ORIGIN_LON) +
+               (int32_t)lround(east / (GEOFENCE_METERS_PER_E7 * cos(ORIGIN_LAT * M_PI / 180)));
+    }
+};
+
+static int selfTest()
+{
+    GeofenceSet zones;
+    double lats[4], lons[4];
+    const double corners[4][2] = {{0, 0}, {STRIP_LENGTH_M, 0}, {STRIP_LENGTH_M, STRIP_WIDTH_M}, {0, STRIP_WIDTH_M}};
+    for (int i = 0; i < 4; i++)
+    {
+        lats[i] = geofenceFromE7(Simulator::toLat(corners[i][1]));
+        lons[i] = geofenceFromE7(Simulator::toLon(corners[i][0]));
+    }
+    zones.add("strip", lats, lons, 4, DWELL_S);
+    GeofenceIndex index;
+    index.build(zones);
+
+    printHeader();
+    bool ok = true;
+    Counts total[3] = {};
+    for (int scenario = 0; scenario < 5; scenario++)
+    {
+        Simulator sim(zones, index, 18 + scenario);
+        const char *name = "";
+        switch (scenario)
+        {
+        case 0:
+            name = "parked 3 m outside, 15 min";
+            sim.jump(-100, -3);
+            sim.drive(100, -3, 8);
+            sim.park(900);
+            sim.drive(300, -3, 8);
+            break;
+        case 1:
+            name = "parked 3 m inside, 15 min";
+            sim.jump(-100, 3);
+            sim.drive(100, 3, 8);
+            sim.park(900);
+            sim.drive(300, 3, 8);
+            break;
+        case 2:
+            name = "along the edge, 2 m out";
+            sim.jump(-100, -2);
+            for (int pass = 0; pass < 5; pass++)
+            {
+                sim.drive(300, -2, 6);
+                sim.drive(-100, -2, 6);
+            }
+            break;
+        case 3:
+            name = "crossing, 10 passes";
+            sim.jump(20, -60);
+            for (int pass = 0; pass < 10; pass++)
+            {
+                double across = 20 + 16 * pass;
+                sim.drive(across, pass % 2 ? -60 : 80, 10);
+                sim.drive(across + 16, pass % 2 ? -60 : 80, 10);
+            }
+            break;
+        case 4:
+            name = "stop and go past the end";
+            sim.jump(-150, 10);
+            for (int stop = 0; stop < 6; stop++)
+            {
+                sim.drive(-4, 10, 5); // queue up short of the strip
+                sim.park(60);
+                sim.drive(-150, 10, 5);
+            }
+            break;
+        }
+
+        Result result = replay(sim.fixes, zones, index);
+        printRow(name, "raw", result.raw);
+        printRow("", "filtered", result.filtered);
+        printRow("", "true", result.truth);
+        const Counts *rows[3] = {&result.raw, &result.filtered, &result.truth};
+        for (int k = 0; k < 3; k++)
+        {
+            total[k].entries += rows[k]->entries;
+            total[k].exits += rows[k]->exits;
+            total[k].violations += rows[k]->violations;
+            total[k].writes += rows[k]->writes;
+        }
+        ok = ok && result.filtered.entries == result.truth.entries && result.filtered.exits == result.truth.exits &&
+             result.filtered.violations == result.truth.violations;
+    }
+
+    printf("\n");
+    printRow("all", "raw", total[0]);
+    printRow("", "filtered", total[1]);
+    printRow("", "true", total[2]);
+    printf("\nwrites from flapping: %u raw, %u filtered\n", total[0].writes - total[2].writes,
+           total[1].writes - total[2].writes);
+    printf("%s\n", ok ? "ok" : "FAILED");
+    return ok ? 0 : 1;
+}
+
+int main(int argc, char **argv)
+{
+    if (argc != 1 && argc != 3)
+    {
+        fprintf(stderr, "usage: %s [trace.nmea geofences.bin]\n", argv[0]);
+        return 2;
+    }
+    return argc == 3 ? replayRecorded(argv[1], argv[2]) : selfTest();
+}
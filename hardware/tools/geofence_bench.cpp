@@ -0,0 +1,236 @@
+// Host-side benchmark for the geofence lookup.
+//
+// Build and run from the hardware directory:
+//   pio run -e native -t exec
+// or directly:
+//   g++ -O2 -march=native -std=c++17 -Ilib/Geofence/src -o geofence_bench
+//       tools/geofence_bench.cpp lib/Geofence/src/*.cpp -lpthread
+//   ./geofence_bench
+//
+// Zones are random 4-12 vertex polygons (10-60 m across) scattered over a 30 x 30 km
+// area, roughly the size of a city. Reports the per-fix cost of the old linear
+// scan, of the grid index and of the grid index with the fixed-point (1e-7 deg)
+// containment test at 10, 1k and 50k zones.
+//
+// A second table replays a simulated drive (1 Hz fixes, stops included)
+// through GeofenceTracker and reports how many fixes needed a full evaluation.
+// The same drive is then sampled the way the firmware's adaptive scheduler
+// does it: how many fixes get evaluated and uploaded, and how many fixes saw a
+// zone entry or exit go unnoticed ("late", which should be 0).
+// A third measures GeofenceBatch throughput on uniformly scattered fixes.
+
+#include "geofence.h"
+#include "geofence_batch.h"
+
+#include <algorithm>
+#include <chrono>
+#include <math.h>
+#include <random>
+#include <stdio.h>
+
+#define AREA_LAT 12.80
+#define AREA_LON 80.05
+#define AREA_SPAN 0.27 // ~30 km
+#define FIXES 200000
+
+static void makeZones(GeofenceSet &zones, size_t n, std::mt19937 &rng)
+{
+    std::uniform_real_distribution<double> pos(0, AREA_SPAN);
+    std::uniform_real_distribution<double> size(0.00005, 0.00025);
+    std::uniform_int_distribution<int> sides(4, 12);
+    double lats[12], lons[12];
+    zones.clear();
+    for (size_t i = 0; i < n; i++)
+    {
+        // Star-shaped polygon with 4-12 vertices around a random centre
+        double lat = AREA_LAT + pos(rng), lon = AREA_LON + pos(rng);
+        int count = sides(rng);
+        for (int v = 0; v < count; v++)
+        {
+            double angle = 2 * M_PI * v / count;
+            double r = size(rng);
+            lats[v] = lat + r * sin(angle);
+            lons[v] = lon + r * cos(angle);
+        }
+        zones.add("zone" + std::to_string(i), lats, lons, count);
+    }
+}
+
+static int linearFind(const GeofenceSet &zones, double lat, double lon)
+{
+    for (uint32_t i = 0; i < zones.size(); i++)
+        if (zones.contains(i, lat, lon))
+            return (int)i;
+    return -1;
+}
+
+template <typename F>
+static double nsPerFix(const std::vector<double> &lats, const std::vector<double> &lons, F fn, long &hits)
+{
+    hits = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < lats.size(); i++)
+        hits += fn(lats[i], lons[i]) >= 0;
+    auto end = std::chrono::steady_clock::now();
+    return std::chrono::duration<double, std::nano>(end - start).count() / lats.size();
+}
+
+static double nsPerFixE7(const std::vector<int32_t> &lats, const std::vector<int32_t> &lons,
+                         const GeofenceIndex &index, const GeofenceSet &zones, long &hits)
+{
+    hits = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < lats.size(); i++)
+        hits += index.find(zones, lats[i], lons[i]) >= 0;
+    auto end = std::chrono::steady_clock::now();
+    return std::chrono::duration<double, std::nano>(end - start).count() / lats.size();
+}
+
+int main()
+{
+    std::mt19937 rng(42);
+    std::uniform_real_distribution<double> pos(0, AREA_SPAN);
+    std::vector<double> lats(FIXES), lons(FIXES);
+    for (size_t i = 0; i < FIXES; i++)
+    {
+        lats[i] = AREA_LAT + pos(rng);
+        lons[i] = AREA_LON + pos(rng);
+    }
+
+    printf("%8s %10s %14s %14s %14s %8s\n", "zones", "cells", "linear ns/fix", "grid ns/fix", "grid E7 ns/fix", "hits");
+    const size_t counts[] = {10, 1000, 50000};
+    for (size_t n : counts)
+    {
+        GeofenceSet zones;
+        makeZones(zones, n, rng);
+        GeofenceIndex index;
+        index.build(zones);
+
+        // The linear scan is too slow to run every fix at 50k zones
+        std::vector<double> la(lats.begin(), lats.begin() + (n > 1000 ? FIXES / 100 : FIXES));
+        std::vector<double> lo(lons.begin(), lons.begin() + la.size());
+
+        std::vector<int32_t> laE7(la.size()), loE7(lo.size());
+        for (size_t i = 0; i < la.size(); i++)
+        {
+            laE7[i] = geofenceToE7(la[i]);
+            loE7[i] = geofenceToE7(lo[i]);
+        }
+
+        long linearHits, gridHits, fixedHits;
+        double linear = nsPerFix(la, lo, [&](double lat, double lon) { return linearFind(zones, lat, lon); }, linearHits);
+        double grid = nsPerFix(la, lo, [&](double lat, double lon) { return index.find(zones, lat, lon); }, gridHits);
+        double fixed = nsPerFixE7(laE7, loE7, index, zones, fixedHits);
+        if (linearHits != gridHits || gridHits != fixedHits)
+            printf("MISMATCH: linear %ld hits, grid %ld hits, grid E7 %ld hits\n", linearHits, gridHits, fixedHits);
+        printf("%8zu %10zu %14.1f %14.1f %14.1f %8ld\n", n, index.cellCount(), linear, grid, fixed, gridHits);
+    }
+
+    printf("\n%8s %10s %12s %14s %10s %10s %10s %6s\n", "zones", "fixes", "evaluations", "tracker ns/fix", "mismatch",
+           "sampled", "uploads", "late");
+    for (size_t n : counts)
+    {
+        GeofenceSet zones;
+        makeZones(zones, n, rng);
+        GeofenceIndex index;
+        index.build(zones);
+
+        // Random walk: 0-20 m/s changing by up to 2.5 m/s each second, turning
+        // a little each second, parked 30% of the time
+        const size_t fixes = 20000;
+        std::uniform_real_distribution<double> unit(0, 1);
+        double lat = AREA_LAT + AREA_SPAN / 2, lon = AREA_LON + AREA_SPAN / 2, heading = 0, speed = 0;
+        std::vector<int32_t> laE7(fixes), loE7(fixes);
+        std::vector<float> speeds(fixes);
+        for (size_t i = 0; i < fixes; i++)
+        {
+            double target = (i / 600) % 10 < 3 ? 0 : 20 * unit(rng);
+            speed += std::max(-2.5, std::min(2.5, target - speed));
+            speeds[i] = (float)speed;
+            heading += (unit(rng) - 0.5) * 0.5;
+            lat += speed * cos(heading) / 111195.0;
+            lon += speed * sin(heading) / (111195.0 * cos(lat * M_PI / 180));
+            laE7[i] = geofenceToE7(lat);
+            loE7[i] = geofenceToE7(lon);
+        }
+
+        GeofenceTracker tracker;
+        long mismatch = 0;
+        std::vector<GeofenceHits> result(fixes);
+        auto start = std::chrono::steady_clock::now();
+        for (size_t i = 0; i < fixes; i++)
+            result[i] = tracker.update(zones, index, laE7[i], loE7[i]);
+        auto end = std::chrono::steady_clock::now();
+        for (size_t i = 0; i < fixes; i++)
+        {
+            GeofenceHits all;
+            index.findAll(zones, laE7[i], loE7[i], all);
+            mismatch += result[i] != all;
+        }
+
+        // Adaptive sampling as in the firmware's scheduleNextSample()
+        GeofenceTracker sampler;
+        GeofenceHits seen;
+        long sampled = 0, uploads = 0, late = 0;
+        uint32_t lastSample = 0, interval = 0, lastUpload = 0;
+        for (size_t i = 0; i < fixes; i++)
+        {
+            uint32_t now = (uint32_t)i * 1000;
+            if (i == 0 || now - lastSample >= interval)
+            {
+                seen = sampler.update(zones, index, laE7[i], loE7[i]);
+                sampled++;
+                lastSample = now;
+                uint32_t reach = geofenceReachTimeMs(sampler.clearanceMeters(), speeds[i]);
+                reach = reach > 1000 ? reach - 1000 : 0;
+                interval = seen.count > 0 ? 1000 : std::max(1000u, std::min(30000u, reach));
+                if (speeds[i] >= 0.5f || seen.count > 0 || now - lastUpload >= 60000)
+                {
+                    uploads++;
+                    lastUpload = now;
+                }
+            }
+            late += seen != result[i];
+        }
+
+        double ns = std::chrono::duration<double, std::nano>(end - start).count() / fixes;
+        printf("%8zu %10zu %12u %14.1f %10ld %10ld %10ld %6ld\n", n, fixes, (unsigned)tracker.evaluations(), ns, mismatch,
+               sampled, uploads, late);
+    }
+
+    GeofenceBatch batch;
+    printf("\nbatch: %u thread(s), %s kernel\n", batch.threads(), GeofenceBatch::kernel());
+    printf("%8s %10s %16s %10s\n", "zones", "fixes", "Mfix/s", "mismatch");
+    for (size_t n : counts)
+    {
+        GeofenceSet zones;
+        makeZones(zones, n, rng);
+        GeofenceIndex index;
+        index.build(zones);
+
+        const size_t fixes = 10000000;
+        std::vector<int32_t> laE7(fixes), loE7(fixes);
+        for (size_t i = 0; i < fixes; i++)
+        {
+            laE7[i] = geofenceToE7(AREA_LAT + pos(rng));
+            loE7[i] = geofenceToE7(AREA_LON + pos(rng));
+        }
+
+        std::vector<GeofenceHits> result(fixes);
+        auto start = std::chrono::steady_clock::now();
+        batch.evaluate(zones, index, laE7.data(), loE7.data(), fixes, result.data());
+        auto end = std::chrono::steady_clock::now();
+
+        long mismatch = 0;
+        for (size_t i = 0; i < fixes; i += 7)
+        {
+            GeofenceHits all;
+            index.findAll(zones, laE7[i], loE7[i], all);
+            mismatch += result[i] != all;
+        }
+
+        double seconds = std::chrono::duration<double>(end - start).count();
+        printf("%8zu %10zu %16.1f %10ld\n", n, fixes, fixes / seconds / 1e6, mismatch);
+    }
+    return 0;
+}
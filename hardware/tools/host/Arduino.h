@@ -0,0 +1,22 @@
+// Just enough of Arduino.h to build the device libraries on the host for the
+// tools in this directory. TinyGPS++.cpp supplies millis() when ARDUINO is
+// not defined.
+#ifndef HOST_ARDUINO_H
+#define HOST_ARDUINO_H
+
+#include <chrono>
+#include <math.h>
+#include <stddef.h>
+#include <stdint.h>
+
+typedef uint8_t byte;
+
+#define PI 3.1415926535897932384626433832795
+#define TWO_PI 6.283185307179586476925286766559
+#define radians(deg) ((deg) * (PI / 180.0))
+#define degrees(rad) ((rad) * (180.0 / PI))
+#define sq(x) ((x) * (x))
+
+unsigned long millis();
+
+#endif // HOST_ARDUINO_H
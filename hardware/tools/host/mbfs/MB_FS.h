@@ -0,0 +1,132 @@
+// File-backed stand-in for the Firebase client's MB_FS, for building the
+// device code that keeps files in flash on the host. Only the flash calls the
+// firmware makes are here, with the same return conventions: open() gives the
+// size (read) or 0 (write, append), or a negative error.
+//
+// Files live under the directory set with hostRoot(). hostFailAfter() makes
+// the write that crosses the given number of bytes stop part way, as a power
+// cut in the middle of a flash write would, and every write after it fail.
+#ifndef HOST_MBFS_H
+#define HOST_MBFS_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define MB_FS_ERROR_FILE_IO_ERROR -300
+#define MB_FS_ERROR_FILE_NOT_FOUND -301
+
+typedef std::string MB_String;
+
+typedef enum
+{
+    mb_fs_mem_storage_type_undefined,
+    mb_fs_mem_storage_type_flash,
+    mb_fs_mem_storage_type_sd
+} mb_fs_mem_storage_type;
+
+typedef enum
+{
+    mb_fs_open_mode_undefined = -1,
+    mb_fs_open_mode_read = 0,
+    mb_fs_open_mode_write,
+    mb_fs_open_mode_append
+} mb_fs_open_mode;
+
+#define mbfs_file_type mb_fs_mem_storage_type
+#define mbfs_flash mb_fs_mem_storage_type_flash
+
+class MB_FS
+{
+public:
+    MB_FS() : root("."), file(NULL), failAfter(-1), written(0) {}
+    ~MB_FS() { close(mbfs_flash); }
+
+    void hostRoot(const std::string &dir) { root = dir; }
+    void hostFailAfter(long bytes)
+    {
+        failAfter = bytes;
+        written = 0;
+    }
+    bool hostFailed() const { return failAfter >= 0 && written >= failAfter; }
+
+    int open(const MB_String &filename, mbfs_file_type type, mb_fs_open_mode mode)
+    {
+        if (type != mbfs_flash)
+            return MB_FS_ERROR_FILE_IO_ERROR;
+        close(type);
+        std::string path = root + filename;
+        if (mode == mb_fs_open_mode_read && !existed(filename, type))
+            return MB_FS_ERROR_FILE_NOT_FOUND;
+        file = fopen(path.c_str(), mode == mb_fs_open_mode_read ? "rb" : mode == mb_fs_open_mode_write ? "wb" : "ab");
+        if (!file)
+            return MB_FS_ERROR_FILE_IO_ERROR;
+        return mode == mb_fs_open_mode_read ? size(type) : 0;
+    }
+
+    int size(mbfs_file_type type)
+    {
+        struct stat st;
+        return type == mbfs_flash && file && fstat(fileno(file), &st) == 0 ? (int)st.st_size : 0;
+    }
+
+    int read(mbfs_file_type type, uint8_t *buf, size_t len)
+    {
+        return type == mbfs_flash && file ? (int)fread(buf, 1, len, file) : 0;
+    }
+
+    int write(mbfs_file_type type, uint8_t *buf, size_t len)
+    {
+        if (type != mbfs_flash || !file)
+            return 0;
+        if (failAfter >= 0 && written + (long)len > failAfter)
+        {
+            // Torn write: whatever made it before the cut stays
+            size_t part = written < failAfter ? (size_t)(failAfter - written) : 0;
+            fwrite(buf, 1, part, file);
+            written = failAfter;
+            return (int)part;
+        }
+        written += (long)len;
+        return (int)fwrite(buf, 1, len, file);
+    }
+
+    bool seek(mbfs_file_type type, int pos)
+    {
+        return type == mbfs_flash && file && fseek(file, pos, SEEK_SET) == 0;
+    }
+
+    void close(mbfs_file_type type)
+    {
+        if (type == mbfs_flash && file)
+        {
+            fclose(file);
+            file = NULL;
+        }
+    }
+
+    bool existed(const MB_String &filename, mbfs_file_type type)
+    {
+        struct stat st;
+        return type == mbfs_flash && stat((root + filename).c_str(), &st) == 0;
+    }
+
+    bool remove(const MB_String &filename, mbfs_file_type type)
+    {
+        return type == mbfs_flash && unlink((root + filename).c_str()) == 0;
+    }
+
+    bool rename(const MB_String &from, const MB_String &to, mbfs_file_type type)
+    {
+        return type == mbfs_flash && ::rename((root + from).c_str(), (root + to).c_str()) == 0;
+    }
+
+private:
+    std::string root;
+    FILE *file;
+    long failAfter, written;
+};
+
+#endif // HOST_MBFS_H
@@ -0,0 +1,390 @@
+// Host-side simulation of the telemetry journal through network outages,
+// resets and power cuts.
+//
+// Build and run from the hardware directory:
+//   pio run -e journal_sim -t exec
+// or directly:
+//   g++ -O2 -std=c++17 -Itools/host -Iinclude -o journal_sim tools/journal_sim.cpp src/telemetry_journal.cpp
+//   ./journal_sim [seed]
+//
+// The journal runs on the file-backed MB_FS from tools/host, in a temporary
+// directory. A simulated device appends a fix every second and a zone event
+// now and then, commits the way TrackUpload does, and uploads the way it
+// does: a batch when one is due, and back to back batches while a backlog
+// drains. The link drops for minutes to an hour at a time and single
+// requests fail. The device resets at random, sometimes between an upload
+// and its ack, and sometimes in the middle of a flash write (the shim tears
+// the write part way), and comes back with begin().
+//
+// The server keeps records by seq, as RTDB does with the journal's keys.
+// Checks that every committed record reaches it with the content appended,
+// that batches arrive in order with no gaps, that a record only arrives twice
+// after a reset between upload and ack, and that nothing is lost while the
+// outages fit in the journal. A second run keeps the link down for longer than
+// the journal holds and checks that exactly the oldest records are dropped.
+// Exits non-zero on any failure.
+
+#include "telemetry_journal.h"
+
+#include <map>
+#include <memory>
+#include <random>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include <string.h>
+#include <vector>
+
+// Mirror of the TrackUpload settings
+#define SIM_BATCH 30        // records before an upload is due
+#define SIM_MAX_AGE_S 30    // or the oldest is this old
+#define SIM_DRAIN_BATCH 100 // records per request
+#define SIM_DRAIN_S 1       // request spacing while draining
+#define SIM_COMMIT_S 10     // staged fixes are committed this often
+#define SIM_RETRY_S 5       // wait after a failed request
+#define SIM_FIX_BYTES 17
+
+#define SIM_FIX 1
+#define SIM_EVENT 2
+
+struct Sim
+{
+    std::mt19937 rng;
+    std::string dir;
+    MB_FS fs;
+    std::unique_ptr<TelemetryJournal> journal;
+
+    std::map<uint32_t, std::string> appended; // seq -> payload, latest append
+    uint32_t committedUpTo = 0;               // every seq up to here is on flash
+
+    std::map<uint32_t, std::string> server;
+    std::map<uint32_t, unsigned> deliveries;
+    uint32_t serverLast = 0; // highest seq received
+    bool resetSinceDelivery = false;
+
+    unsigned requests = 0, failedRequests = 0, resets = 0, tornWrites = 0, tornAcks = 0;
+    unsigned resends = 0, errors = 0;
+    uint32_t lost = 0; // journal.lost() summed over boots
+
+    explicit Sim(unsigned seed) : rng(seed)
+    {
+        char pattern[] = "/tmp/journal_sim.XXXXXX";
+        if (!mkdtemp(pattern))
+        {
+            perror("mkdtemp");
+            exit(2);
+        }
+        dir = pattern;
+        fs.hostRoot(dir);
+        boot();
+    }
+
+    ~Sim()
+    {
+        journal.reset();
+        std::string command = "rm -rf " + dir;
+        if (system(command.c_str()) != 0)
+            fprintf(stderr, "could not remove %s\n", dir.c_str());
+    }
+
+    void boot()
+    {
+        if (journal)
+            lost += journal->lost();
+        fs.hostFailAfter(-1);
+        journal.reset(new TelemetryJournal(fs, "/journal"));
+        journal->begin();
+    }
+
+    void noteCommitted()
+    {
+        uint32_t upTo = journal->lastSeq() - journal->staged();
+        if (upTo > committedUpTo)
+            committedUpTo = upTo;
+    }
+
+    void append(uint8_t type, const std::string &payload)
+    {
+        uint32_t seq = journal->append(type, payload.data(), payload.size());
+        if (seq == 0)
+        {
+            printf("  FAIL: append refused a %u byte record\n", (unsigned)payload.size());
+            errors++;
+            return;
+        }
+        appended[seq] = std::string(1, (char)type) + payload;
+        noteCommitted(); // a full stage commits itself
+    }
+
+    std::string payload(uint32_t t, size_t size)
+    {
+        std::string data(size, 0);
+        memcpy(&data[0], &t, sizeof(t));
+        for (size_t i = sizeof(t); i < size; i++)
+            data[i] = (char)rng();
+        return data;
+    }
+
+    bool commit()
+    {
+        bool ok = journal->commit();
+        noteCommitted();
+        return ok;
+    }
+
+    // Power cut: staged records are gone, flash keeps what was written
+    void reset()
+    {
+        resets++;
+        resetSinceDelivery = true;
+        boot();
+        if (journal->lastSeq() < committedUpTo)
+        {
+            printf("  FAIL: after a reset the journal ends at %u, %u were committed\n",
+                   (unsigned)journal->lastSeq(), (unsigned)committedUpTo);
+            errors++;
+        }
+    }
+
+    // A power cut part way through the next flash write
+    void tornReset(bool duringAck)
+    {
+        std::uniform_int_distribution<long> cut(0, 40);
+        fs.hostFailAfter(cut(rng));
+        if (duringAck)
+        {
+            tornAcks++;
+            upload(true, true);
+        }
+        else
+        {
+            tornWrites++;
+            append(SIM_FIX, payload(0, SIM_FIX_BYTES));
+            commit();
+        }
+        reset();
+    }
+
+    void receive(const JournalRecord *records, size_t count)
+    {
+        for (size_t i = 0; i < count; i++)
+        {
+            const JournalRecord &record = records[i];
+            std::string content = std::string(1, (char)record.type) + std::string((const char *)record.data, record.length);
+            auto expected = appended.find(record.seq);
+            if (expected == appended.end() || expected->second != content)
+            {
+                printf("  FAIL: seq %u arrived with content that was never appended\n", (unsigned)record.seq);
+                errors++;
+            }
+
+            if (record.seq <= serverLast)
+            {
+                // Only a reset between an upload and its ack sends a record again
+                if (!resetSinceDelivery)
+                {
+                    printf("  FAIL: seq %u sent again without a reset\n", (unsigned)record.seq);
+                    errors++;
+                }
+                if (server[record.seq] != content)
+                {
+                    printf("  FAIL: seq %u sent again with different content\n", (unsigned)record.seq);
+                    errors++;
+                }
+                resends++;
+            }
+            else if (record.seq != serverLast + 1 && lost == 0 && journal->lost() == 0)
+            {
+                printf("  FAIL: seq %u follows %u\n", (unsigned)record.seq, (unsigned)serverLast);
+                errors++;
+            }
+            server[record.seq] = content;
+            deliveries[record.seq]++;
+            if (record.seq > serverLast)
+                serverLast = record.seq;
+        }
+    }
+
+    // One request. Returns false if nothing went (or it failed).
+    bool upload(bool online, bool resetBeforeAck)
+    {
+        static JournalRecord records[SIM_DRAIN_BATCH];
+        commit();
+        size_t count = journal->read(records, SIM_DRAIN_BATCH);
+        if (count == 0)
+            return false;
+        requests++;
+        if (!online || std::uniform_int_distribution<int>(0, 99)(rng) < 3)
+        {
+            failedRequests++;
+            return false;
+        }
+        receive(records, count);
+        if (resetBeforeAck)
+            return true;
+        resetSinceDelivery = false;
+        journal->ack(records[count - 1].seq);
+        return true;
+    }
+
+    // Everything committed and not dropped has arrived, exactly as appended
+    void verify(uint32_t expectLost)
+    {
+        lost += journal->lost();
+        uint32_t missing = 0;
+        for (uint32_t seq = 1; seq <= committedUpTo; seq++)
+        {
+            auto got = server.find(seq);
+            if (got == server.end())
+                missing++;
+            else if (got->second != appended[seq])
+            {
+                printf("  FAIL: seq %u stored with the wrong content\n", (unsigned)seq);
+                errors++;
+            }
+        }
+        if (missing != expectLost || lost != expectLost)
+        {
+            printf("  FAIL: %u records missing and %u reported lost, expected %u\n", (unsigned)missing,
+                   (unsigned)lost, (unsigned)expectLost);
+            errors++;
+        }
+        if (expectLost > 0 && missing == expectLost)
+        {
+            // The ones dropped must be the oldest
+            for (uint32_t seq = 1; seq <= expectLost; seq++)
+                if (server.count(seq))
+                {
+                    printf("  FAIL: seq %u delivered although older records were dropped\n", (unsigned)seq);
+                    errors++;
+                    break;
+                }
+        }
+        if (journal->pending() != 0)
+        {
+            printf("  FAIL: %u records still pending after the final drain\n", (unsigned)journal->pending());
+            errors++;
+        }
+    }
+};
+
+// Device loop: 1 Hz fixes, zone events, TrackUpload's commit and upload
+// timing. outage(t) says whether the link is down at second t.
+template <typename Outage>
+static void drive(Sim &sim, uint32_t seconds, Outage outage, bool faults)
+{
+    std::uniform_int_distribution<int> percent(0, 9999);
+    uint32_t lastUpload = 0, lastCommit = 0, lastFail = 0;
+    bool failed = false;
+    for (uint32_t t = 1; t <= seconds; t++)
+    {
+        sim.append(SIM_FIX, sim.payload(t, SIM_FIX_BYTES));
+        if (percent(sim.rng) < 100)
+        {
+            // Zone events are committed straight away
+            sim.append(SIM_EVENT, sim.payload(t, 4 + (size_t)(percent(sim.rng) % 40)));
+            sim.commit();
+        }
+        if (t - lastCommit >= SIM_COMMIT_S)
+        {
+            sim.commit();
+            lastCommit = t;
+        }
+
+        uint32_t pending = sim.journal->pending();
+        bool draining = pending > SIM_BATCH && t - lastUpload >= SIM_DRAIN_S;
+        bool backingOff = failed && t - lastFail < SIM_RETRY_S;
+        if (!backingOff && pending > 0 && (draining || pending >= SIM_BATCH || t - lastUpload >= SIM_MAX_AGE_S))
+        {
+            bool resetBeforeAck = faults && percent(sim.rng) < 200;
+            failed = !sim.upload(!outage(t), resetBeforeAck);
+            lastUpload = t;
+            if (failed)
+                lastFail = t;
+            if (resetBeforeAck)
+                sim.reset();
+        }
+
+        if (faults)
+        {
+            int roll = percent(sim.rng);
+            if (roll < 5)
+                sim.reset();
+            else if (roll < 10)
+                sim.tornReset(false);
+            else if (roll < 13)
+                sim.tornReset(true);
+        }
+    }
+}
+
+static void drainAll(Sim &sim)
+{
+    for (int i = 0; i < 100000 && sim.journal->pending() > 0; i++)
+        sim.upload(true, false);
+}
+
+static unsigned faultRun(unsigned seed)
+{
+    printf("Outages up to 1 h, resets and torn writes, 3 days at 1 Hz (seed %u)\n", seed);
+    Sim sim(seed);
+
+    // Outages of 1 to 60 minutes, roughly every 3 hours
+    std::vector<std::pair<uint32_t, uint32_t>> outages;
+    std::uniform_int_distribution<uint32_t> gap(3600, 18000), length(60, 3600);
+    const uint32_t days = 3 * 86400;
+    for (uint32_t t = gap(sim.rng); t < days; t += gap(sim.rng))
+    {
+        uint32_t end = t + length(sim.rng);
+        outages.push_back(std::make_pair(t, end));
+        t = end;
+    }
+    size_t next = 0;
+    drive(sim, days, [&](uint32_t t) {
+        while (next < outages.size() && outages[next].second < t)
+            next++;
+        return next < outages.size() && outages[next].first <= t;
+    }, true);
+    drainAll(sim);
+    sim.verify(0);
+
+    unsigned twice = 0;
+    for (const auto &d : sim.deliveries)
+        twice += d.second > 1;
+    printf("  %u records, %u requests (%u failed), %u outages\n", (unsigned)sim.committedUpTo, sim.requests,
+           sim.failedRequests, (unsigned)outages.size());
+    printf("  %u resets, %u torn record writes, %u torn ack writes\n", sim.resets, sim.tornWrites, sim.tornAcks);
+    printf("  %u records resent after a reset, stored once: %u with more than one delivery\n", sim.resends, twice);
+    printf("  %s\n", sim.errors ? "FAILED" : "ok");
+    return sim.errors;
+}
+
+static unsigned overflowRun(unsigned seed)
+{
+    printf("Link down for 4 h, longer than the journal holds (seed %u)\n", seed);
+    Sim sim(seed);
+    const uint32_t down = 4 * 3600;
+    drive(sim, down, [](uint32_t) { return true; }, false);
+    sim.commit();
+
+    // Whatever the ring could not hold is exactly the oldest records
+    uint32_t kept = sim.journal->pending();
+    uint32_t expectLost = sim.committedUpTo - kept;
+    uint32_t requestsBefore = sim.requests;
+    drainAll(sim);
+    sim.verify(expectLost);
+    printf("  %u records, %u kept in the journal, %u dropped\n", (unsigned)sim.committedUpTo, (unsigned)kept,
+           (unsigned)expectLost);
+    printf("  drained in %u requests (%u s at one request per %u s)\n", sim.requests - requestsBefore,
+           (sim.requests - requestsBefore) * SIM_DRAIN_S, SIM_DRAIN_S);
+    printf("  %s\n", sim.errors ? "FAILED" : "ok");
+    return sim.errors;
+}
+
+int main(int argc, char **argv)
+{
+    unsigned seed = argc > 1 ? (unsigned)strtoul(argv[1], NULL, 10) : 1;
+    unsigned errors = faultRun(seed);
+    errors += overflowRun(seed + 1);
+    return errors ? 1 : 0;
+}
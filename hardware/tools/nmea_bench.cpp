@@ -0,0 +1,162 @@
+// Host-side benchmark for NMEA decoding with TinyGPS++.
+//
+// Build and run from the hardware directory:
+//   pio run -e nmea_bench -t exec
+// or directly:
+//   g++ -O2 -std=c++17 -Itools/host -Ilib/TinyGPSPlus/src -o nmea_bench
+//       tools/nmea_bench.cpp lib/TinyGPSPlus/src/TinyGPS++.cpp
+//   ./nmea_bench
+//
+// Feeds the same stream, the mix a 1 Hz multi-constellation receiver sends
+// (GNRMC, GNGGA, a GNGSA per constellation, GSV from GPS, GLONASS and Galileo
+// and GNVTG per fix, some with bad checksums or oversized terms), to
+// encode(char) one byte at a time and to encode(buf, len) in the 64-byte
+// blocks the ingest task reads from the UART. Reports MB/s for both, and for
+// the block path with eight TinyGPSCustom fields registered, and checks that
+// both paths end in the same state.
+
+#include "TinyGPS++.h"
+
+#include <chrono>
+#include <random>
+#include <stdio.h>
+#include <string.h>
+#include <string>
+
+#define FIXES 20000
+#define BLOCK_SIZE 64
+#define ROUNDS 5
+
+static void appendSentence(std::string &stream, const std::string &body, bool corrupt)
+{
+    uint8_t parity = 0;
+    for (char c : body)
+        parity ^= (uint8_t)c;
+    char tail[8];
+    snprintf(tail, sizeof(tail), "*%02X\r\n", corrupt ? parity ^ 0x5A : parity);
+    stream += '$';
+    stream += body;
+    stream += tail;
+}
+
+static std::string makeStream(std::mt19937 &rng)
+{
+    std::uniform_real_distribution<double> jitter(-0.0005, 0.0005);
+    std::uniform_int_distribution<int> percent(0, 99);
+    std::string stream;
+    char body[160];
+    double lat = 1302.1234, lon = 8014.5678;
+
+    for (int i = 0; i < FIXES; i++)
+    {
+        int hh = (i / 3600) % 24, mm = (i / 60) % 60, ss = i % 60;
+        lat += jitter(rng);
+        lon += jitter(rng);
+
+        snprintf(body, sizeof(body), "GNRMC,%02d%02d%02d.00,A,%.5f,N,%.5f,E,%.3f,%.2f,170526,,,A",
+                 hh, mm, ss, lat, lon, 12.5 + jitter(rng) * 1000, 87.3);
+        appendSentence(stream, body, percent(rng) < 2);
+
+        snprintf(body, sizeof(body), "GNGGA,%02d%02d%02d.00,%.5f,N,%.5f,E,1,09,0.92,%.1f,M,-86.0,M,,",
+                 hh, mm, ss, lat, lon, 15.2 + jitter(rng) * 1000);
+        appendSentence(stream, body, percent(rng) < 2);
+
+        appendSentence(stream, "GNGSA,A,3,04,05,09,12,17,20,24,25,29,,,,1.65,0.92,1.37", false);
+        appendSentence(stream, "GNGSA,A,3,65,66,72,81,82,,,,,,,,1.65,0.92,1.37", false);
+        appendSentence(stream, "GNGSA,A,3,07,13,26,,,,,,,,,,1.65,0.92,1.37", false);
+        appendSentence(stream, "GPGSV,3,1,11,04,42,057,38,05,21,293,31,09,65,103,44,12,17,176,29", false);
+        appendSentence(stream, "GPGSV,3,2,11,17,36,318,40,20,09,234,22,24,55,011,43,25,29,143,35", false);
+        appendSentence(stream, "GPGSV,3,3,11,29,12,061,27,31,03,201,,32,07,322,", false);
+        appendSentence(stream, "GLGSV,2,1,07,65,37,045,28,66,58,328,30,72,25,270,,81,14,042,", false);
+        appendSentence(stream, "GLGSV,2,2,07,82,44,118,33,87,10,300,,88,05,020,", false);
+        appendSentence(stream, "GAGSV,1,1,03,07,33,140,31,13,61,210,36,26,22,075,24", false);
+        appendSentence(stream, "GNVTG,87.30,T,,M,12.500,N,23.150,K,A", false);
+
+        // A term longer than the parser keeps, which both paths must truncate
+        if (percent(rng) < 1)
+            appendSentence(stream, "GPTXT,01,01,02,ANTENNA_STATUS_OK_WITH_A_VERY_LONG_TERM", false);
+    }
+    return stream;
+}
+
+static bool sameState(TinyGPSPlus &a, TinyGPSPlus &b)
+{
+    return a.charsProcessed() == b.charsProcessed() && a.sentencesWithFix() == b.sentencesWithFix() &&
+           a.failedChecksum() == b.failedChecksum() && a.passedChecksum() == b.passedChecksum() &&
+           a.location.rawLat().billionths == b.location.rawLat().billionths &&
+           a.location.rawLng().billionths == b.location.rawLng().billionths &&
+           a.time.value() == b.time.value() && a.date.value() == b.date.value() &&
+           a.speed.value() == b.speed.value() && a.course.value() == b.course.value() &&
+           a.altitude.value() == b.altitude.value() && a.satellites.value() == b.satellites.value() &&
+           a.hdop.value() == b.hdop.value() && a.pdop.value() == b.pdop.value() &&
+           a.satellitesInView.value() == b.satellitesInView.value();
+}
+
+// Best MB/s over ROUNDS runs
+static double measure(const char *data, size_t size, bool bulk, bool customs)
+{
+    double best = 0;
+    for (int round = 0; round < ROUNDS; round++)
+    {
+        TinyGPSPlus gps;
+        TinyGPSCustom fields[8];
+        if (customs)
+        {
+            fields[0].begin(gps, "GPGSV", 4);
+            fields[1].begin(gps, "GPGSV", 7);
+            fields[2].begin(gps, "GLGSV", 4);
+            fields[3].begin(gps, "GLGSV", 7);
+            fields[4].begin(gps, "GAGSV", 4);
+            fields[5].begin(gps, "GNGSA", 2);
+            fields[6].begin(gps, "GNGSA", 17);
+            fields[7].begin(gps, "GNVTG", 7);
+        }
+
+        auto start = std::chrono::steady_clock::now();
+        if (bulk)
+            for (size_t i = 0; i < size; i += BLOCK_SIZE)
+                gps.encode(data + i, size - i < BLOCK_SIZE ? size - i : BLOCK_SIZE);
+        else
+            for (size_t i = 0; i < size; i++)
+                gps.encode(data[i]);
+        auto end = std::chrono::steady_clock::now();
+
+        double mbps = size / std::chrono::duration<double, std::micro>(end - start).count();
+        if (mbps > best)
+            best = mbps;
+    }
+    return best;
+}
+
+int main()
+{
+    std::mt19937 rng(7);
+    std::string stream = makeStream(rng);
+    const char *data = stream.data();
+    size_t size = stream.size();
+    printf("%u fixes, %.1f MB of NMEA\n\n", FIXES, size / 1e6);
+
+    TinyGPSPlus bytewise, bulk;
+    size_t valid = 0;
+    for (size_t i = 0; i < size; i++)
+        valid += bytewise.encode(data[i]);
+    size_t bulkValid = 0;
+    for (size_t i = 0; i < size; i += BLOCK_SIZE)
+        bulkValid += bulk.encode(data + i, size - i < BLOCK_SIZE ? size - i : BLOCK_SIZE);
+
+    bool same = sameState(bytewise, bulk) && valid == bulkValid && bulkValid == bulk.passedChecksum();
+    printf("sentences: %u passed, %u failed, %u with fix; bulk count %u; state %s\n\n",
+           (unsigned)bytewise.passedChecksum(), (unsigned)bytewise.failedChecksum(),
+           (unsigned)bytewise.sentencesWithFix(), (unsigned)bulkValid, same ? "identical" : "DIFFERS");
+
+    double bestChar = measure(data, size, false, false);
+    double bestBulk = measure(data, size, true, false);
+    double bestCustom = measure(data, size, true, true);
+
+    printf("%-24s %10s\n", "path", "MB/s");
+    printf("%-24s %10.1f\n", "encode(char)", bestChar);
+    printf("%-24s %10.1f\n", "encode(buf, 64)", bestBulk);
+    printf("%-24s %9.2fx\n", "speedup", bestBulk / bestChar);
+    printf("%-24s %10.1f\n", "  with 8 custom fields", bestCustom);
+    return same ? 0 : 1;
+}
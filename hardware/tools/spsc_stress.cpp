@@ -0,0 +1,138 @@
+// Host-side stress test and benchmark for SpscQueue, the queue between the
+// GNSS ingest task and loop().
+//
+// Build and run from the hardware directory:
+//   pio run -e spsc_stress -t exec
+// or directly:
+//   g++ -O2 -std=c++17 -Ilib/SpscQueue/src -o spsc_stress tools/spsc_stress.cpp -lpthread
+//   ./spsc_stress
+// Adding -fsanitize=thread checks the memory ordering as well.
+//
+// A producer thread pushes numbered items, each filled with a pattern derived
+// from its number, while a consumer thread pops them and checks that every
+// item arrives once, in order and intact. Runs with a fix-sized item at the
+// firmware's queue depth and at a deeper one, with both sides polling, and
+// with the consumer stalling now and then the way loop() does in a Firebase
+// call (the producer then drops, as the ingest task does). Exits non-zero on
+// any error.
+
+#include "spsc_queue.h"
+
+#include <atomic>
+#include <chrono>
+#include <stdio.h>
+#include <stdint.h>
+#include <thread>
+
+#define ITEMS 5000000
+
+// Same size as GpsFix
+struct Item
+{
+    uint64_t sequence;
+    uint32_t words[7];
+};
+
+static void fill(Item &item, uint64_t sequence)
+{
+    item.sequence = sequence;
+    for (int i = 0; i < 7; i++)
+        item.words[i] = (uint32_t)(sequence * 2654435761u) ^ (uint32_t)i;
+}
+
+static bool intact(const Item &item)
+{
+    for (int i = 0; i < 7; i++)
+        if (item.words[i] != ((uint32_t)(item.sequence * 2654435761u) ^ (uint32_t)i))
+            return false;
+    return true;
+}
+
+struct Result
+{
+    uint64_t received, dropped, errors;
+    double seconds;
+};
+
+// stallEvery > 0 makes the consumer sleep 1 ms after every stallEvery items,
+// and the producer pace itself and drop items when the queue is full instead
+// of retrying
+template <size_t Capacity>
+static Result run(uint64_t items, uint64_t stallEvery)
+{
+    static SpscQueue<Item, Capacity> queue;
+    std::atomic<bool> done(false);
+    Result result = {0, 0, 0, 0};
+
+    auto start = std::chrono::steady_clock::now();
+    std::thread producer([&]() {
+        Item item;
+        for (uint64_t sequence = 0; sequence < items; sequence++)
+        {
+            fill(item, sequence);
+            while (!queue.push(item))
+            {
+                if (stallEvery > 0)
+                {
+                    result.dropped++;
+                    break;
+                }
+                std::this_thread::yield();
+            }
+            // Paced like a receiver, so the stalls are what overflows the queue
+            if (stallEvery > 0 && sequence % 16 == 15)
+                std::this_thread::sleep_for(std::chrono::microseconds(50));
+        }
+        done.store(true, std::memory_order_release);
+    });
+
+    uint64_t next = 0;
+    Item item;
+    for (;;)
+    {
+        if (!queue.pop(item))
+        {
+            if (done.load(std::memory_order_acquire) && queue.empty())
+                break;
+            std::this_thread::yield();
+            continue;
+        }
+
+        // With drops the sequence may jump forward, never back
+        bool inOrder = stallEvery > 0 ? item.sequence >= next : item.sequence == next;
+        if (!inOrder || !intact(item))
+            result.errors++;
+        next = item.sequence + 1;
+        result.received++;
+
+        if (stallEvery > 0 && result.received % stallEvery == 0)
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    producer.join();
+    auto end = std::chrono::steady_clock::now();
+
+    result.seconds = std::chrono::duration<double>(end - start).count();
+    if (result.received + result.dropped != items)
+        result.errors++;
+    return result;
+}
+
+static bool report(const char *name, const Result &result)
+{
+    printf("%-30s %12llu %12llu %10.1f %8llu\n", name, (unsigned long long)result.received,
+           (unsigned long long)result.dropped, result.received / result.seconds / 1e6,
+           (unsigned long long)result.errors);
+    return result.errors == 0;
+}
+
+int main()
+{
+    printf("%-30s %12s %12s %10s %8s\n", "run", "received", "dropped", "Mitems/s", "errors");
+    bool ok = true;
+    ok &= report("capacity 32, polling", run<32>(ITEMS, 0));
+    ok &= report("capacity 1024, polling", run<1024>(ITEMS, 0));
+    ok &= report("capacity 2, polling", run<2>(ITEMS / 10, 0));
+    ok &= report("capacity 32, stalling consumer", run<32>(ITEMS / 100, 500));
+    printf("%s\n", ok ? "ok" : "FAILED");
+    return ok ? 0 : 1;
+}
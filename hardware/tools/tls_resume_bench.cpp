@@ -0,0 +1,360 @@
+// Host-side benchmark of TLS handshakes with and without session resumption
+// through TlsSessionCache, against a local TLS test server.
+//
+// Build and run from the hardware directory (needs the openssl command line
+// tool for the test server and its certificates):
+//   pio run -e tls_resume_bench -t exec
+// or directly:
+//   gcc -O2 -c -Ilib/Firebase_ESP_Client/src/client/SSLClient/bssl lib/Firebase_ESP_Client/src/client/SSLClient/bssl/*.c
+//   g++ -O2 -std=c++17 -Itools/host -Iinclude -Ilib/Firebase_ESP_Client/src -o tls_resume_bench
+//       tools/tls_resume_bench.cpp src/tls_session_cache.cpp *.o
+//   ./tls_resume_bench [rounds]
+//
+// Uses the BearSSL copy bundled with the Firebase client, the same engine the
+// firmware runs. Makes a throwaway RSA-2048 CA and an ECDSA P-256 server
+// certificate, as Google's front ends present, and starts openssl s_server
+// on a local port with its session cache on. Then connects rounds times
+// with a full handshake (ECDHE and the certificate chain checked against the
+// CA) and rounds times resuming a session. Each resumed connection starts
+// from a fresh TlsSessionCache loaded from its file, as after a reboot.
+//
+// Reports the client's CPU time per handshake, the part that takes seconds
+// on the ESP32, and the wall time. The host is far faster than the ESP32,
+// so the ratio is the figure to carry over, not the milliseconds. Exits
+// non-zero if a session offered from the cache was not resumed.
+
+#include "tls_session_cache.h"
+#include "client/SSLClient/bssl/bearssl.h"
+
+#include <algorithm>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+#include <vector>
+
+#define BENCH_HOST "localhost"
+
+static double cpuMs()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+static double wallMs()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+static bool run(const std::string &command)
+{
+    return system((command + " >/dev/null 2>&1").c_str()) == 0;
+}
+
+static std::vector<unsigned char> readFile(const std::string &path)
+{
+    std::vector<unsigned char> data;
+    FILE *f = fopen(path.c_str(), "rb");
+    if (!f)
+        return data;
+    unsigned char buf[4096];
+    size_t n;
+    while ((n = fread(buf, 1, sizeof(buf), f)) > 0)
+        data.insert(data.end(), buf, buf + n);
+    fclose(f);
+    return data;
+}
+
+// Trust anchor from the first certificate of a PEM file
+struct Anchor
+{
+    std::vector<unsigned char> dn, n, e;
+    br_x509_trust_anchor ta;
+};
+
+static void appendBytes(void *ctx, const void *data, size_t len)
+{
+    std::vector<unsigned char> *out = (std::vector<unsigned char> *)ctx;
+    out->insert(out->end(), (const unsigned char *)data, (const unsigned char *)data + len);
+}
+
+static bool loadAnchor(const std::string &path, Anchor &anchor)
+{
+    std::vector<unsigned char> pem = readFile(path), der;
+    br_pem_decoder_context pc;
+    br_pem_decoder_init(&pc);
+    bool inObject = false, done = false;
+    for (size_t i = 0; i < pem.size() && !done;)
+    {
+        i += br_pem_decoder_push(&pc, &pem[i], pem.size() - i);
+        switch (br_pem_decoder_event(&pc))
+        {
+        case BR_PEM_BEGIN_OBJ:
+            inObject = true;
+            br_pem_decoder_setdest(&pc, appendBytes, &der);
+            break;
+        case BR_PEM_END_OBJ:
+            done = inObject;
+            break;
+        case BR_PEM_ERROR:
+            return false;
+        }
+    }
+    if (!done)
+        return false;
+
+    br_x509_decoder_context dc;
+    br_x509_decoder_init(&dc, appendBytes, &anchor.dn);
+    br_x509_decoder_push(&dc, der.data(), der.size());
+    br_x509_pkey *pkey = br_x509_decoder_get_pkey(&dc);
+    if (!pkey || pkey->key_type != BR_KEYTYPE_RSA)
+        return false;
+    anchor.n.assign(pkey->key.rsa.n, pkey->key.rsa.n + pkey->key.rsa.nlen);
+    anchor.e.assign(pkey->key.rsa.e, pkey->key.rsa.e + pkey->key.rsa.elen);
+
+    memset(&anchor.ta, 0, sizeof(anchor.ta));
+    anchor.ta.dn.data = anchor.dn.data();
+    anchor.ta.dn.len = anchor.dn.size();
+    anchor.ta.flags = BR_X509_TA_CA;
+    anchor.ta.pkey.key_type = BR_KEYTYPE_RSA;
+    anchor.ta.pkey.key.rsa.n = anchor.n.data();
+    anchor.ta.pkey.key.rsa.nlen = anchor.n.size();
+    anchor.ta.pkey.key.rsa.e = anchor.e.data();
+    anchor.ta.pkey.key.rsa.elen = anchor.e.size();
+    return true;
+}
+
+static int sockRead(void *ctx, unsigned char *buf, size_t len)
+{
+    ssize_t n = read(*(int *)ctx, buf, len);
+    return n > 0 ? (int)n : -1;
+}
+
+static int sockWrite(void *ctx, const unsigned char *buf, size_t len)
+{
+    ssize_t n = write(*(int *)ctx, buf, len);
+    return n > 0 ? (int)n : -1;
+}
+
+static int connectLocal(int port)
+{
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0)
+    {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+struct Handshake
+{
+    bool ok;
+    bool resumed;
+    double cpu, wall;
+};
+
+// One connection: handshake and a request, timed up to the request going
+// out, then the reply read and the connection closed
+static Handshake connectOnce(int port, const Anchor &anchor, br_ssl_session_parameters *session)
+{
+    Handshake result = {false, false, 0, 0};
+    static unsigned char iobuf[BR_SSL_BUFSIZE_BIDI];
+    br_ssl_client_context sc;
+    br_x509_minimal_context xc;
+    br_ssl_client_init_full(&sc, &xc, &anchor.ta, 1);
+    br_ssl_engine_set_buffer(&sc.eng, iobuf, sizeof(iobuf), 1);
+
+    // Validity dates are checked against the host clock
+    time_t now = time(NULL);
+    br_x509_minimal_set_time(&xc, (uint32_t)(now / 86400 + 719528), (uint32_t)(now % 86400));
+
+    unsigned char seed[32];
+    FILE *urandom = fopen("/dev/urandom", "rb");
+    if (!urandom || fread(seed, 1, sizeof(seed), urandom) != sizeof(seed))
+        return result;
+    fclose(urandom);
+    br_ssl_engine_inject_entropy(&sc.eng, seed, sizeof(seed));
+
+    bool offered = session && session->session_id_len > 0;
+    if (offered)
+        br_ssl_engine_set_session_parameters(&sc.eng, session);
+
+    int fd = connectLocal(port);
+    if (fd < 0)
+        return result;
+
+    double cpu0 = cpuMs(), wall0 = wallMs();
+    br_ssl_client_reset(&sc, BENCH_HOST, offered ? 1 : 0);
+    br_sslio_context ioc;
+    br_sslio_init(&ioc, &sc.eng, sockRead, &fd, sockWrite, &fd);
+    static const char request[] = "GET / HTTP/1.0\r\nHost: " BENCH_HOST "\r\n\r\n";
+    bool sent = br_sslio_write_all(&ioc, request, sizeof(request) - 1) == 0 && br_sslio_flush(&ioc) == 0;
+    result.cpu = cpuMs() - cpu0;
+    result.wall = wallMs() - wall0;
+
+    if (sent)
+    {
+        unsigned char reply[512];
+        while (br_sslio_read(&ioc, reply, sizeof(reply)) > 0)
+        {
+        }
+        br_ssl_session_parameters fresh;
+        br_ssl_engine_get_session_parameters(&sc.eng, &fresh);
+        result.resumed = offered && fresh.session_id_len == session->session_id_len &&
+                         memcmp(fresh.session_id, session->session_id, fresh.session_id_len) == 0;
+        if (session)
+            *session = fresh;
+        result.ok = true;
+    }
+    else
+    {
+        fprintf(stderr, "handshake failed: BearSSL error %d\n", br_ssl_engine_last_error(&sc.eng));
+    }
+    close(fd);
+    return result;
+}
+
+static double median(std::vector<double> values)
+{
+    std::sort(values.begin(), values.end());
+    return values.empty() ? 0 : values[values.size() / 2];
+}
+
+int main(int argc, char **argv)
+{
+    int rounds = argc > 1 ? atoi(argv[1]) : 30;
+    if (rounds < 1)
+        rounds = 1;
+
+    char pattern[] = "/tmp/tls_resume_bench.XXXXXX";
+    if (!mkdtemp(pattern))
+    {
+        perror("mkdtemp");
+        return 2;
+    }
+    std::string dir = pattern;
+
+    // Throwaway CA and server certificate
+    std::string ca = dir + "/ca", server = dir + "/server";
+    FILE *ext = fopen((dir + "/san.ext").c_str(), "w");
+    if (ext)
+    {
+        fputs("subjectAltName=DNS:" BENCH_HOST "\n", ext);
+        fclose(ext);
+    }
+    if (!ext ||
+        !run("openssl req -x509 -newkey rsa:2048 -nodes -days 2 -subj /CN=bench-ca -keyout " + ca + ".key -out " + ca +
+             ".pem") ||
+        !run("openssl req -newkey ec -pkeyopt ec_paramgen_curve:prime256v1 -nodes -subj /CN=" BENCH_HOST " -keyout " +
+             server + ".key -out " + server + ".csr") ||
+        !run("openssl x509 -req -days 2 -in " + server + ".csr -CA " + ca + ".pem -CAkey " + ca +
+             ".key -CAcreateserial -extfile " + dir + "/san.ext -out " + server + ".pem"))
+    {
+        fprintf(stderr, "could not make the test certificates (is openssl installed?)\n");
+        return 2;
+    }
+    Anchor anchor;
+    if (!loadAnchor(ca + ".pem", anchor))
+    {
+        fprintf(stderr, "could not load %s.pem\n", ca.c_str());
+        return 2;
+    }
+
+    int port = 20000 + getpid() % 20000;
+    pid_t serverPid = fork();
+    if (serverPid == 0)
+    {
+        freopen("/dev/null", "w", stdout);
+        freopen("/dev/null", "w", stderr);
+        std::string portText = std::to_string(port);
+        execlp("openssl", "openssl", "s_server", "-accept", portText.c_str(), "-cert", (server + ".pem").c_str(),
+               "-key", (server + ".key").c_str(), "-tls1_2", "-www", "-quiet", (char *)NULL);
+        _exit(127);
+    }
+    int fd = -1;
+    for (int i = 0; i < 100 && fd < 0; i++)
+    {
+        usleep(50000);
+        fd = connectLocal(port);
+    }
+    if (fd < 0)
+    {
+        fprintf(stderr, "test server did not start on port %d\n", port);
+        kill(serverPid, SIGTERM);
+        return 2;
+    }
+    close(fd);
+    printf("TLS 1.2 test server on port %d: ECDSA P-256 certificate, RSA-2048 CA\n", port);
+
+    int failures = 0;
+    std::vector<double> fullCpu, fullWall, resumedCpu, resumedWall;
+    for (int i = 0; i < rounds; i++)
+    {
+        Handshake h = connectOnce(port, anchor, NULL);
+        failures += !h.ok;
+        fullCpu.push_back(h.cpu);
+        fullWall.push_back(h.wall);
+    }
+
+    // First connection fills the cache; every later one starts from the file
+    MB_FS fs;
+    fs.hostRoot(dir);
+    {
+        TlsSessionCache cache;
+        cache.persistTo(fs, "/tls_sessions.bin");
+        br_ssl_session_parameters session;
+        memset(&session, 0, sizeof(session));
+        Handshake h = connectOnce(port, anchor, &session);
+        failures += !h.ok;
+        cache.store(BENCH_HOST, session);
+    }
+    int resumed = 0;
+    for (int i = 0; i < rounds; i++)
+    {
+        TlsSessionCache cache;
+        cache.persistTo(fs, "/tls_sessions.bin");
+        br_ssl_session_parameters session;
+        memset(&session, 0, sizeof(session));
+        if (!cache.load() || !cache.restore(BENCH_HOST, session))
+        {
+            fprintf(stderr, "session cache file did not load\n");
+            failures++;
+            break;
+        }
+        Handshake h = connectOnce(port, anchor, &session);
+        failures += !h.ok;
+        resumed += h.resumed;
+        resumedCpu.push_back(h.cpu);
+        resumedWall.push_back(h.wall);
+        cache.store(BENCH_HOST, session);
+    }
+
+    kill(serverPid, SIGTERM);
+    waitpid(serverPid, NULL, 0);
+    run("rm -rf " + dir);
+
+    printf("%-28s %10s %10s\n", "median per connection", "cpu ms", "wall ms");
+    printf("%-28s %10.2f %10.2f\n", "full handshake", median(fullCpu), median(fullWall));
+    printf("%-28s %10.2f %10.2f\n", "resumed from cache file", median(resumedCpu), median(resumedWall));
+    if (median(resumedCpu) > 0)
+        printf("resumption saves %.0f%% of the handshake CPU time (%.1fx)\n",
+               100 * (1 - median(resumedCpu) / median(fullCpu)), median(fullCpu) / median(resumedCpu));
+    printf("%d of %d offered sessions resumed, %d failed connections\n", resumed, rounds, failures);
+    return failures || resumed != rounds ? 1 : 0;
+}
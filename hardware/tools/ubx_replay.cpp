@@ -0,0 +1,272 @@
+// Host-side replay of UBX captures through TinyGPS++.
+//
+// Build and run from the hardware directory:
+//   pio run -e ubx_replay -t exec
+// or directly:
+//   g++ -O2 -std=c++17 -Itools/host -Ilib/TinyGPSPlus/src -o ubx_replay
+//       tools/ubx_replay.cpp lib/TinyGPSPlus/src/TinyGPS++.cpp
+//   ./ubx_replay capture.ubx
+//
+// With a capture (the raw receiver output as logged by u-center or
+// "cat /dev/ttyUSB0 > capture.ubx", NMEA mixed in or not), prints every
+// NAV-PVT solution decoded and the frame counts.
+//
+// Without one, records a capture in memory instead: NAV-PVT at 10 Hz along a
+// drive, with NMEA text, other UBX frames, flipped bytes, truncated frames
+// and a corrupt length mixed in. Every solution decoded must match the frame
+// it came from, no more than one solution may be lost per damaged frame, and
+// the block and byte-wise paths must agree. Also reports the bytes per fix
+// against GGA + RMC and the fix rate either fits in at 9600 baud. Exits
+// non-zero on any mismatch.
+//
+// No receiver capture ships with the tool, so the default run only checks
+// the decoder against frames it builds itself from the u-blox protocol
+// description. A capture from a real receiver has to be replayed by hand.
+
+#include "TinyGPS++.h"
+
+#include <random>
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+
+#define BAUD_RATE 9600
+#define FIXES 6000
+#define BLOCK_SIZE 64
+
+struct Solution
+{
+    uint16_t year;
+    uint8_t month, day, hour, minute, second;
+    int32_t nano;
+    int32_t latE7, lonE7;
+    int32_t heightMm;
+    int32_t speedMmps;
+    int32_t headingE5;
+    uint8_t satellites;
+    uint16_t pdop;
+    bool fix;
+};
+
+static void put2(uint8_t *p, uint32_t v)
+{
+    p[0] = (uint8_t)v;
+    p[1] = (uint8_t)(v >> 8);
+}
+
+static void put4(uint8_t *p, uint32_t v)
+{
+    put2(p, v);
+    put2(p + 2, v >> 16);
+}
+
+static void appendFrame(std::vector<uint8_t> &out, uint8_t msgClass, uint8_t msgId, const uint8_t *payload, uint16_t len)
+{
+    size_t at = out.size();
+    out.resize(at + len + 8);
+    TinyGPSPlus::ubxFrame(msgClass, msgId, payload, len, out.data() + at);
+}
+
+static void appendNavPvt(std::vector<uint8_t> &out, const Solution &s)
+{
+    uint8_t p[_GPS_UBX_NAV_PVT_LEN] = {};
+    put2(p + 4, s.year);
+    p[6] = s.month;
+    p[7] = s.day;
+    p[8] = s.hour;
+    p[9] = s.minute;
+    p[10] = s.second;
+    p[11] = 0x07; // validDate, validTime, fullyResolved
+    put4(p + 16, (uint32_t)s.nano);
+    p[20] = s.fix ? 3 : 0;
+    p[21] = s.fix ? 0x01 : 0;
+    p[23] = s.satellites;
+    put4(p + 24, (uint32_t)s.lonE7);
+    put4(p + 28, (uint32_t)s.latE7);
+    put4(p + 36, (uint32_t)s.heightMm);
+    put4(p + 60, (uint32_t)s.speedMmps);
+    put4(p + 64, (uint32_t)s.headingE5);
+    put2(p + 76, s.pdop);
+    appendFrame(out, _GPS_UBX_CLASS_NAV, _GPS_UBX_ID_NAV_PVT, p, sizeof(p));
+}
+
+static int32_t toE7(const RawDegrees &raw)
+{
+    int32_t e7 = (int32_t)raw.deg * 10000000 + (int32_t)((raw.billionths + 50) / 100);
+    return raw.negative ? -e7 : e7;
+}
+
+static void print(TinyGPSPlus &gps)
+{
+    printf("%02u:%02u:%02u.%02u  %12.7f %12.7f  %6.2f kn  %6.2f deg  %7.2f m  %2u sats  pdop %.2f\n",
+           gps.time.hour(), gps.time.minute(), gps.time.second(), gps.time.centisecond(),
+           toE7(gps.location.rawLat()) / 1e7, toE7(gps.location.rawLng()) / 1e7, gps.speed.knots(),
+           gps.course.deg(), gps.altitude.meters(), (unsigned)gps.satellites.value(), gps.pdop.value() / 100.0);
+}
+
+static int replay(const char *path)
+{
+    FILE *in = fopen(path, "rb");
+    if (!in)
+    {
+        perror(path);
+        return 1;
+    }
+
+    TinyGPSPlus gps;
+    char block[BLOCK_SIZE];
+    size_t n, solutions = 0;
+    while ((n = fread(block, 1, sizeof(block), in)) > 0)
+    {
+        for (size_t i = 0; i < n; i++)
+            if (gps.encode(block[i]) && gps.location.isUpdated())
+            {
+                print(gps);
+                solutions++;
+            }
+    }
+    fclose(in);
+
+    printf("\n%u bytes, %u frames or sentences passed, %u failed, %u solutions with a fix\n",
+           (unsigned)gps.charsProcessed(), (unsigned)gps.passedChecksum(), (unsigned)gps.failedChecksum(),
+           (unsigned)solutions);
+    return 0;
+}
+
+static uint32_t timeOf(const Solution &s)
+{
+    return s.hour * 1000000UL + s.minute * 10000UL + s.second * 100UL + s.nano / 10000000;
+}
+
+static bool matches(TinyGPSPlus &gps, const Solution &s)
+{
+    int32_t speed = (int32_t)(((int64_t)s.speedMmps * 100000 + 257222) / 514444);
+    return toE7(gps.location.rawLat()) == s.latE7 && toE7(gps.location.rawLng()) == s.lonE7 &&
+           gps.date.year() == s.year && gps.date.month() == s.month && gps.date.day() == s.day &&
+           gps.time.hour() == s.hour && gps.time.minute() == s.minute && gps.time.second() == s.second &&
+           gps.time.centisecond() == s.nano / 10000000 && gps.speed.value() == speed &&
+           gps.course.value() == s.headingE5 / 1000 && gps.altitude.value() == s.heightMm / 10 &&
+           gps.satellites.value() == s.satellites && gps.pdop.value() == s.pdop;
+}
+
+static int selfTest()
+{
+    std::mt19937 rng(16);
+    std::uniform_int_distribution<int> percent(0, 99);
+    std::uniform_int_distribution<int> byte(0, 255);
+
+    // Record the capture, remembering which solutions should come out
+    std::vector<uint8_t> capture;
+    std::vector<Solution> expected;
+    size_t damaged = 0, pvtBytes = 0;
+    Solution s = {2026, 5, 17, 6, 30, 0, 0, 130421234, 802345678, 15200, 0, 0, 12, 145, false};
+    for (int i = 0; i < FIXES; i++)
+    {
+        int tenths = i % 10;
+        s.second = (uint8_t)((i / 10) % 60);
+        s.minute = (uint8_t)(30 + i / 600);
+        s.nano = tenths * 100000000;
+        s.fix = i >= 20; // no fix for the first two seconds
+        s.speedMmps = 8000 + (int32_t)(i % 300) * 20;
+        s.headingE5 = (int32_t)((i * 37) % 36000000);
+        s.latE7 += 70 + (i % 7);
+        s.lonE7 -= 40 + (i % 5);
+        s.satellites = (uint8_t)(9 + i % 4);
+
+        size_t at = capture.size();
+        appendNavPvt(capture, s);
+        pvtBytes += capture.size() - at;
+
+        int roll = percent(rng);
+        if (roll < 3)
+        {
+            // Flip one byte after the sync characters
+            size_t offset = at + 2 + byte(rng) % (capture.size() - at - 2);
+            capture[offset] ^= (uint8_t)(1 + byte(rng) % 255);
+            damaged++;
+        }
+        else if (roll < 4)
+        {
+            // Cut short; the next frame's bytes are then taken as its payload
+            capture.resize(at + 40);
+            damaged++;
+        }
+        else if (s.fix)
+        {
+            expected.push_back(s);
+        }
+
+        // Other traffic between solutions
+        if (i % 10 == 0)
+        {
+            const char *text = "$GPTXT,01,01,02,u-blox ag - www.u-blox.com*50\r\n";
+            capture.insert(capture.end(), text, text + strlen(text));
+            uint8_t sat[8 + 12 * 10];
+            for (uint8_t &b : sat)
+                b = (uint8_t)byte(rng);
+            appendFrame(capture, 0x01, 0x35, sat, sizeof(sat)); // NAV-SAT
+        }
+        if (i == FIXES / 2)
+        {
+            // A corrupt length field far beyond any real frame
+            const uint8_t bad[] = {_GPS_UBX_SYNC1, _GPS_UBX_SYNC2, 0x01, 0x07, 0xFF, 0xFF};
+            capture.insert(capture.end(), bad, bad + sizeof(bad));
+            damaged++;
+        }
+    }
+
+    // Byte-wise: check every solution as it is committed against the frame
+    // with the same time stamp
+    TinyGPSPlus gps;
+    size_t decoded = 0, wrong = 0, next = 0;
+    for (uint8_t b : capture)
+    {
+        if (!gps.encode((char)b) || !gps.location.isUpdated())
+            continue;
+        uint32_t time = gps.time.value();
+        while (next < expected.size() && timeOf(expected[next]) < time)
+            next++;
+        if (next < expected.size() && timeOf(expected[next]) == time && matches(gps, expected[next]))
+            decoded++;
+        else
+            wrong++;
+    }
+
+    // Blocks: same end state
+    TinyGPSPlus bulk;
+    size_t bulkValid = 0;
+    for (size_t i = 0; i < capture.size(); i += BLOCK_SIZE)
+        bulkValid += bulk.encode((const char *)capture.data() + i,
+                                 capture.size() - i < BLOCK_SIZE ? capture.size() - i : BLOCK_SIZE);
+    bool same = bulkValid == bulk.passedChecksum() && bulk.passedChecksum() == gps.passedChecksum() &&
+                bulk.failedChecksum() == gps.failedChecksum() && bulk.sentencesWithFix() == gps.sentencesWithFix() &&
+                toE7(bulk.location.rawLat()) == toE7(gps.location.rawLat()) && bulk.time.value() == gps.time.value();
+
+    // A damaged frame may take the following frame down with it (a cut frame
+    // swallows the next one as payload), but never more than that
+    bool ok = wrong == 0 && decoded + damaged >= expected.size() && same;
+    printf("%u NAV-PVT frames, %u damaged; %u solutions expected, %u decoded, %u wrong\n",
+           FIXES, (unsigned)damaged, (unsigned)expected.size(), (unsigned)decoded, (unsigned)wrong);
+    printf("checksum: %u passed, %u failed; block path %s\n\n", (unsigned)gps.passedChecksum(),
+           (unsigned)gps.failedChecksum(), same ? "identical" : "DIFFERS");
+
+    // Link budget: 10 bits per byte on the UART
+    double bytesPerSecond = BAUD_RATE / 10.0;
+    double pvt = pvtBytes / (double)FIXES;
+    double nmea = 72 + 75; // typical GGA + RMC
+    printf("%-16s %10s %14s\n", "format", "bytes/fix", "max Hz @ 9600");
+    printf("%-16s %10.0f %14.1f\n", "GGA + RMC", nmea, bytesPerSecond / nmea);
+    printf("%-16s %10.0f %14.1f\n", "UBX NAV-PVT", pvt, bytesPerSecond / pvt);
+    printf("%s\n", ok ? "ok" : "FAILED");
+    return ok ? 0 : 1;
+}
+
+int main(int argc, char **argv)
+{
+    if (argc > 2)
+    {
+        fprintf(stderr, "usage: %s [capture.ubx]\n", argv[0]);
+        return 2;
+    }
+    return argc == 2 ? replay(argv[1]) : selfTest();
+}
@@ -0,0 +1,306 @@
+// Offline compiler for no-parking zones.
+//
+// Build and run from the hardware directory:
+//   pio run -e zone_compiler
+//   .pio/build/zone_compiler/program zones.txt geofences.bin
+// or directly:
+//   g++ -O2 -std=c++17 -Ilib/Geofence/src -o zone_compiler
+//       tools/zone_compiler.cpp lib/Geofence/src/geofence.cpp lib/Geofence/src/geofence_cache.cpp
+//   ./zone_compiler zones.txt geofences.bin
+//
+// Input has one zone per line: the name, then every vertex as "lat,lon" (the
+// same strings the dashboard stores), separated by semicolons:
+//   Anna Salai;13.0601,80.2496;13.0605,80.2501;13.0598,80.2507
+// A "dwell=SECONDS" field sets how long a vehicle may stay before it is a
+// violation (GEOFENCE_DEFAULT_DWELL_S otherwise):
+//   Anna Salai;dwell=300;13.0601,80.2496;13.0605,80.2501;13.0598,80.2507
+// Blank lines and lines starting with '#' are skipped.
+//
+// Every polygon is checked before anything is written: at least three
+// distinct vertices, non-zero area and no self-intersection, tested exactly on
+// the 1e-7 degree coordinates the firmware uses. Clockwise polygons are
+// reversed so that every zone in the output winds counter-clockwise. Any error
+// fails the build and no output is written.
+//
+// The output is a GeofenceCache image holding the zones with their bounding
+// boxes and edge coefficients, the zone names (ids are line order) and the
+// grid index. The firmware loads it with ZoneSync::syncCompiled() and uses the
+// arrays as they are. Pass "-" as the output to only validate.
+
+#include "geofence.h"
+#include "geofence_cache.h"
+
+#include <algorithm>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+struct Vertex
+{
+    int32_t lat, lon;
+};
+
+struct Zone
+{
+    std::string name;
+    std::vector<Vertex> vertices;
+    uint32_t dwellSeconds;
+    int line;
+};
+
+// Sign of the cross product (b - a) x (c - a), exact for any E7 coordinates
+static int orientation(const Vertex &a, const Vertex &b, const Vertex &c)
+{
+    __int128 cross = (__int128)((int64_t)b.lon - a.lon) * ((int64_t)c.lat - a.lat) -
+                     (__int128)((int64_t)b.lat - a.lat) * ((int64_t)c.lon - a.lon);
+    return (cross > 0) - (cross < 0);
+}
+
+// c lies within the bounding box of segment ab (used once a, b, c are collinear)
+static bool within(const Vertex &a, const Vertex &b, const Vertex &c)
+{
+    return c.lat >= std::min(a.lat, b.lat) && c.lat <= std::max(a.lat, b.lat) &&
+           c.lon >= std::min(a.lon, b.lon) && c.lon <= std::max(a.lon, b.lon);
+}
+
+// Segments ab and cd share at least one point
+static bool intersects(const Vertex &a, const Vertex &b, const Vertex &c, const Vertex &d)
+{
+    int o1 = orientation(a, b, c), o2 = orientation(a, b, d);
+    int o3 = orientation(c, d, a), o4 = orientation(c, d, b);
+    if (o1 != o2 && o3 != o4)
+        return true;
+    return (o1 == 0 && within(a, b, c)) || (o2 == 0 && within(a, b, d)) ||
+           (o3 == 0 && within(c, d, a)) || (o4 == 0 && within(c, d, b));
+}
+
+// Twice the signed area; positive for counter-clockwise (lon east, lat north)
+static __int128 signedArea(const std::vector<Vertex> &v)
+{
+    __int128 area = 0;
+    for (size_t i = 0, j = v.size() - 1; i < v.size(); j = i++)
+        area += (__int128)v[j].lon * v[i].lat - (__int128)v[i].lon * v[j].lat;
+    return area;
+}
+
+static bool parseVertex(const std::string &text, Vertex &vertex)
+{
+    const char *s = text.c_str();
+    char *end;
+    double lat = strtod(s, &end);
+    if (end == s || *end != ',')
+        return false;
+    s = end + 1;
+    double lon = strtod(s, &end);
+    while (*end == ' ' || *end == '\t' || *end == '\r')
+        end++;
+    if (end == s || *end != '\0' || lat < -90 || lat > 90 || lon < -180 || lon > 180)
+        return false;
+    vertex.lat = geofenceToE7(lat);
+    vertex.lon = geofenceToE7(lon);
+    return true;
+}
+
+static std::vector<std::string> split(const std::string &line, char separator)
+{
+    std::vector<std::string> parts;
+    size_t start = 0;
+    for (;;)
+    {
+        size_t end = line.find(separator, start);
+        parts.push_back(line.substr(start, end == std::string::npos ? end : end - start));
+        if (end == std::string::npos)
+            return parts;
+        start = end + 1;
+    }
+}
+
+static void fail(const Zone &zone, const char *message)
+{
+    fprintf(stderr, "line %d (%s): %s\n", zone.line, zone.name.c_str(), message);
+}
+
+// Normalises the polygon in place; returns false with a message on error
+static bool validate(Zone &zone, bool &reversed)
+{
+    std::vector<Vertex> &v = zone.vertices;
+
+    // Drop repeated vertices, including a closing copy of the first one
+    std::vector<Vertex> distinct;
+    for (const Vertex &vertex : v)
+        if (distinct.empty() || vertex.lat != distinct.back().lat || vertex.lon != distinct.back().lon)
+            distinct.push_back(vertex);
+    while (distinct.size() > 1 && distinct.front().lat == distinct.back().lat &&
+           distinct.front().lon == distinct.back().lon)
+        distinct.pop_back();
+    v.swap(distinct);
+
+    if (v.size() < 3)
+    {
+        fail(zone, "fewer than 3 distinct vertices");
+        return false;
+    }
+
+    size_t n = v.size();
+    for (size_t i = 0; i < n; i++)
+    {
+        const Vertex &a = v[i], &b = v[(i + 1) % n];
+        for (size_t j = i + 1; j < n; j++)
+        {
+            const Vertex &c = v[j], &d = v[(j + 1) % n];
+            bool adjacent = j == i + 1 || (i == 0 && j == n - 1);
+            if (!adjacent)
+            {
+                if (intersects(a, b, c, d))
+                {
+                    char message[96];
+                    snprintf(message, sizeof(message), "edges %u and %u intersect", (unsigned)i + 1, (unsigned)j + 1);
+                    fail(zone, message);
+                    return false;
+                }
+                continue;
+            }
+
+            // Neighbours share one vertex; they may only touch there, so a
+            // spike that doubles back along the previous edge is rejected
+            const Vertex &shared = (j == i + 1) ? b : a;
+            const Vertex &p = (j == i + 1) ? a : b, &q = (j == i + 1) ? d : c;
+            if (orientation(p, shared, q) == 0 && (within(p, shared, q) || within(shared, q, p)))
+            {
+                char message[96];
+                snprintf(message, sizeof(message), "edges %u and %u overlap", (unsigned)i + 1, (unsigned)j + 1);
+                fail(zone, message);
+                return false;
+            }
+        }
+    }
+
+    __int128 area = signedArea(v);
+    if (area == 0)
+    {
+        fail(zone, "zero area");
+        return false;
+    }
+    reversed = area < 0;
+    if (reversed)
+        std::reverse(v.begin(), v.end());
+    return true;
+}
+
+int main(int argc, char **argv)
+{
+    if (argc != 3)
+    {
+        fprintf(stderr, "usage: %s zones.txt geofences.bin|-\n", argv[0]);
+        return 2;
+    }
+
+    FILE *in = fopen(argv[1], "r");
+    if (!in)
+    {
+        perror(argv[1]);
+        return 1;
+    }
+
+    std::vector<Zone> zones;
+    int errors = 0, lineNumber = 0;
+    char buffer[65536];
+    while (fgets(buffer, sizeof(buffer), in))
+    {
+        lineNumber++;
+        std::string line(buffer);
+        while (!line.empty() && (line.back() == '\n' || line.back() == '\r'))
+            line.pop_back();
+        if (line.empty() || line[0] == '#')
+            continue;
+
+        std::vector<std::string> fields = split(line, ';');
+        Zone zone;
+        zone.name = fields[0];
+        zone.line = lineNumber;
+        zone.dwellSeconds = GEOFENCE_DEFAULT_DWELL_S;
+        bool ok = true;
+        for (size_t i = 1; ok && i < fields.size(); i++)
+        {
+            if (fields[i].compare(0, 6, "dwell=") == 0)
+            {
+                char *end;
+                long seconds = strtol(fields[i].c_str() + 6, &end, 10);
+                ok = *end == '\0' && seconds > 0;
+                if (ok)
+                    zone.dwellSeconds = (uint32_t)seconds;
+                else
+                    fail(zone, ("bad dwell limit \"" + fields[i] + "\"").c_str());
+                continue;
+            }
+
+            Vertex vertex;
+            ok = parseVertex(fields[i], vertex);
+            if (ok)
+                zone.vertices.push_back(vertex);
+            else
+                fail(zone, ("bad vertex \"" + fields[i] + "\"").c_str());
+        }
+        if (ok)
+            zones.push_back(zone);
+        else
+            errors++;
+    }
+    fclose(in);
+
+    GeofenceSet set;
+    size_t reversedCount = 0;
+    std::vector<double> lats, lons;
+    for (Zone &zone : zones)
+    {
+        bool reversed = false;
+        if (!validate(zone, reversed))
+        {
+            errors++;
+            continue;
+        }
+        reversedCount += reversed;
+
+        lats.clear();
+        lons.clear();
+        for (const Vertex &vertex : zone.vertices)
+        {
+            lats.push_back(geofenceFromE7(vertex.lat));
+            lons.push_back(geofenceFromE7(vertex.lon));
+        }
+        set.add(zone.name, lats.data(), lons.data(), lats.size(), zone.dwellSeconds);
+    }
+
+    if (errors > 0)
+    {
+        fprintf(stderr, "%d error(s), nothing written\n", errors);
+        return 1;
+    }
+
+    GeofenceIndex index;
+    index.build(set);
+    printf("%u zones, %u edges, %u grid cells, %u reversed to counter-clockwise\n",
+           (unsigned)set.size(), (unsigned)set.edgeCount(), (unsigned)index.cellCount(), (unsigned)reversedCount);
+
+    if (strcmp(argv[2], "-") == 0)
+        return 0;
+
+    std::vector<uint8_t> image;
+    GeofenceMemoryStream stream(image);
+    if (!GeofenceCache::write(stream, set, &index, std::string()))
+    {
+        fprintf(stderr, "failed to encode %s\n", argv[2]);
+        return 1;
+    }
+
+    FILE *out = fopen(argv[2], "wb");
+    if (!out || fwrite(image.data(), 1, image.size(), out) != image.size() || fclose(out) != 0)
+    {
+        perror(argv[2]);
+        return 1;
+    }
+    printf("wrote %s, %u bytes\n", argv[2], (unsigned)image.size());
+    return 0;
+}